@@ -22,16 +22,10 @@ SCRIPT_DIR = Path(path.dirname(__file__))
 # we expect a certain directory configuration, followed by the conan package
 PKG_DIR = SCRIPT_DIR.parent.parent.parent.absolute()
 
-GHIDRA_DIR = os.getenv("GHIDRA")
-if not GHIDRA_DIR:
-    raise RuntimeError("Please, specify ghidra location with GHIDRA environment variable")
-GHIDRA_DIR = Path(GHIDRA_DIR)
-GHIDRA_ANALYZE_HEADLESS = GHIDRA_DIR / 'support' / 'analyzeHeadless'
 GHIDRA_SCRIPTS_PATH = SCRIPT_DIR
 GET_BBS_SCRIPT_PATH = GHIDRA_SCRIPTS_PATH / 'GetBBS.java'
 
 UWIN_LIFT_PATH = os.getenv("UWIN_LIFT_PATH", PKG_DIR / "bin/uwin-lift")
-UWIN_CLANG_PATH = os.getenv("UWIN_CLANG_PATH", PKG_DIR / "bin/remill-clang")
 
 SHOW_SPINNERS = True
 
@@ -54,6 +48,13 @@ def spin(*args, **kwargs):
         return noop_spinner()
     return yaspin(*args, **kwargs)
 
+# Ghidra is only needed unless uwin-lift discovers the basic blocks itself
+def ghidra_analyze_headless():
+    ghidra_dir = os.getenv("GHIDRA")
+    if not ghidra_dir:
+        raise RuntimeError("Please, specify ghidra location with GHIDRA environment variable")
+    return Path(ghidra_dir) / 'support' / 'analyzeHeadless'
+
 # Maybe implement caching? For large executables this process can take quite some time...
 
 def ghidralize(exe_name, extra_code_addresses):
@@ -66,7 +67,7 @@ def ghidralize(exe_name, extra_code_addresses):
             bbs_filename = dpath / 'bbs.txt'
 
             try:
-                subprocess.check_output([str(GHIDRA_ANALYZE_HEADLESS),
+                subprocess.check_output([str(ghidra_analyze_headless()),
                                          dpath, 'ghidra_project',
                                          '-import', exe_name,
                                          '-deleteProject',
@@ -86,55 +87,53 @@ def ghidralize(exe_name, extra_code_addresses):
             return res
 
 
-def extract_code_and_debug_info(exe_name):
-    with spin(text='extracting code and debug info...', timer=True).dqpb.white.on_green as spinner:
-        pe = pefile.PE(exe_name)
+# The sections, entry point and exports are read by uwin-lift itself
+def extract_debug_info(exe_name):
+    with spin(text='extracting debug info...', timer=True).dqpb.white.on_green as spinner:
+        pe = pefile.PE(exe_name, fast_load=True)
         try:
-            # TODO: come up with some better logic (probably needs some work in remill-lift)
-            text_sections = [x for x in pe.sections if x.Name == b'.text\x00\x00\x00' or x.IMAGE_SCN_MEM_EXECUTE]
-            assert len(text_sections) == 1
-            text_section = text_sections[0]
-
-            addr = pe.OPTIONAL_HEADER.ImageBase + text_section.VirtualAddress
-            data = text_section.get_data()
-
             debug_info = try_get_watcom_debug_info(pe, exe_name)
 
             extra_code_addresses = list(set(map(lambda x: x[0],debug_info.values())))
             name_map = {v: k for k, v in debug_info.items()}
 
             spinner.ok("✓")
-            return (addr, data, extra_code_addresses, name_map)
+            return (extra_code_addresses, name_map)
         finally:
             pe.close()
 
 
-def recompile(ir_path, o_path):
-    with spin(text='recompiling...', timer=True).material.white.on_yellow as spinner:
-        try:
-            subprocess.check_output([str(UWIN_CLANG_PATH),
-                                     Path(ir_path).absolute(), '-c', '-O3', '-fPIC',
-                                     '-o', Path(o_path).absolute()
-                                     ], stderr=subprocess.STDOUT, text=True)
-
-            spinner.ok("✓")
-        except subprocess.CalledProcessError as exc:
-            eprint('uwin-clang output:\n' + exc.output)
-            raise
-
-
-def lift(code_bin_path, code_address, bbs_path, name_map_path, ir_path):
+def lift(exe_path, bbs_path, name_map_path, o_path, trace_cache_dir=None,
+         optimization_profile=None, profile_instrument=False, profile_use=None, entry_points_path=None,
+         trace_heads=None, import_signatures=None, jump_tables=True, dse_calling_convention=None):
     with spin(text='lifting...', timer=True).noise.white.bold.on_blue as spinner:
+        extra_args = ['--entry_points_filename', Path(entry_points_path).absolute()]
+        if bbs_path:
+            extra_args += ['--basic_blocks_filename', Path(bbs_path).absolute()]
+        if trace_heads:
+            extra_args += ['--trace_heads', trace_heads]
+        if import_signatures:
+            extra_args += ['--import_signatures_filename', Path(import_signatures).absolute()]
+        if not jump_tables:
+            extra_args += ['--nojump_tables']
+        if dse_calling_convention:
+            extra_args += ['--dse_calling_convention', dse_calling_convention]
+        if trace_cache_dir:
+            extra_args += ['--trace_cache_dir', Path(trace_cache_dir).absolute()]
+        if optimization_profile:
+            extra_args += ['--optimization_profile', optimization_profile]
+        if profile_instrument:
+            extra_args += ['--profile_instrument']
+        if profile_use:
+            extra_args += ['--profile_use', Path(profile_use).absolute()]
         try:
             subprocess.check_output([str(UWIN_LIFT_PATH),
-                                     '--code_filename', Path(code_bin_path).absolute(),
-                                     '--code_address', str(code_address),
-                                     '--basic_blocks_filename', Path(bbs_path).absolute(),
+                                     '--exe_filename', Path(exe_path).absolute(),
                                      '--name_map_filename', Path(name_map_path).absolute(),
-                                     '--ir_out', Path(ir_path).absolute(),
+                                     '--obj_out', Path(o_path).absolute(),
                                      '--semantics_search_paths', PKG_DIR / "share/remill/semantics"
                                      '--intrinsics_filename', PKG_DIR / "share/uwin/intrinsics.bc"
-                                     ], stderr=subprocess.STDOUT, text=True)
+                                     ] + extra_args, stderr=subprocess.STDOUT, text=True)
 
             spinner.ok("✓")
         except subprocess.CalledProcessError as exc:
@@ -142,26 +141,30 @@ def lift(code_bin_path, code_address, bbs_path, name_map_path, ir_path):
             raise
 
 
-def do_the_thing(exe_name, extra_code_addresses, o_path):
+def do_the_thing(exe_name, extra_code_addresses, o_path, trace_cache_dir=None, optimization_profile=None,
+                 profile_instrument=False, profile_use=None, discover_cfg=False, trace_heads=None,
+                 import_signatures=None, jump_tables=True, dse_calling_convention=None):
     with tempfile.TemporaryDirectory() as d:
         dpath = Path(d)
-        code_path = dpath / 'code.bin'
         bbs_path = dpath / 'bbs.txt'
         nm_path = dpath / 'nm.txt'
-        ir_path = dpath / 'ir_out.ll'
-
-        code_addr, code_data, extra_code_addresses_1, name_map = extract_code_and_debug_info(exe_name)
-        bbs = ghidralize(Path(exe_name).absolute(), extra_code_addresses_1 + extra_code_addresses)
-
-        with open(bbs_path, 'w') as f:
-            f.write('\n'.join(map(str, bbs)))
+        entry_points_path = dpath / 'entry_points.txt'
+
+        extra_code_addresses_1, name_map = extract_debug_info(exe_name)
+        with open(entry_points_path, 'w') as f:
+            f.write('\n'.join(map(str, sorted(set(extra_code_addresses_1 + extra_code_addresses)))))
+        if discover_cfg:
+            bbs_path = None
+        else:
+            bbs = ghidralize(Path(exe_name).absolute(), extra_code_addresses_1 + extra_code_addresses)
+            with open(bbs_path, 'w') as f:
+                f.write('\n'.join(map(str, bbs)))
         with open(nm_path, 'w') as f:
             f.write('\n'.join(map(lambda x: f"{x[0][0]} {x[0][1]} {x[1]}", name_map.items())))
-        with open(code_path, 'wb') as f:
-            f.write(code_data)
 
-        lift(code_path, code_addr, bbs_path, nm_path, ir_path)
-        recompile(ir_path, o_path)
+        lift(exe_name, bbs_path, nm_path, o_path, trace_cache_dir, optimization_profile,
+             profile_instrument, profile_use, entry_points_path, trace_heads, import_signatures,
+             jump_tables, dse_calling_convention)
 
 
 def main():
@@ -174,6 +177,31 @@ def main():
     parser.add_argument('output_path')
     parser.add_argument('--extra-code-addresses-file')
     parser.add_argument('--silent', action='store_true')
+    parser.add_argument('--trace-cache-dir', help='Reuse optimized traces that did not change since a previous run '
+                                                  'from this directory')
+    parser.add_argument('--optimization-profile', choices=['max-speed', 'balanced', 'fast-compile', 'size'],
+                        help='How hard to optimize the lifted code (default: max-speed)')
+    parser.add_argument('--discover-cfg', action='store_true',
+                        help='Find the basic blocks with uwin-lift, by decoding everything reachable from the entry '
+                             'point, the exports and the debug symbols, instead of with Ghidra')
+    parser.add_argument('--trace-heads', choices=['blocks', 'functions'],
+                        help='Lift every basic block into a function of its own, or whole functions, which are '
+                             'entered at their other blocks through a switch (default: blocks)')
+    parser.add_argument('--import-signatures',
+                        help='Call the native functions in this table directly, one '
+                             '"offset name stdcall|cdecl return_type [arg_type...]" per line')
+    parser.add_argument('--no-jump-tables', action='store_true',
+                        help='Lift jumps through jump tables to the dispatcher, instead of to a switch over the '
+                             'table targets')
+    parser.add_argument('--dse-calling-convention',
+                        help='Comma-separated assumptions about calls that dead store elimination may make: none, '
+                             'cdecl (EAX, ECX and EDX are clobbered by calls; wrong for Watcom __watcall code) and '
+                             'eflags (the arithmetic flags are dead across calls) (default: none)')
+    profile_group = parser.add_mutually_exclusive_group()
+    profile_group.add_argument('--profile-instrument', action='store_true',
+                               help='Make the lifted code count what it executes, and append the counts to '
+                                    '$UWIN_LIFT_PROFILE (default: uwin-lift.profile) on exit')
+    profile_group.add_argument('--profile-use', help='Optimize for the counts in this profile')
 
     args = parser.parse_args()
 
@@ -185,7 +213,10 @@ def main():
             extra_code_addresses = [int(x) for x in f.read().split('\n')]
     else:
         extra_code_addresses = []
-    do_the_thing(args.exe_path, extra_code_addresses, args.output_path)
+    do_the_thing(args.exe_path, extra_code_addresses, args.output_path, args.trace_cache_dir,
+                 args.optimization_profile, args.profile_instrument, args.profile_use, args.discover_cfg,
+                 args.trace_heads, args.import_signatures, not args.no_jump_tables,
+                 args.dse_calling_convention)
     # print(ghidralize(EXE_FILE, []))
 
 
@@ -0,0 +1,111 @@
+#include "CodeImage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void CodeImage::AddSection(uint64_t address, const std::string &filename) {
+  auto fd_or_err = llvm::sys::fs::openNativeFileForRead(filename);
+  if (!fd_or_err) {
+    llvm::consumeError(fd_or_err.takeError());
+    throw std::runtime_error("Can't open code file " + filename);
+  }
+  auto fd = *fd_or_err;
+
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(fd, status)) {
+    llvm::sys::fs::closeFile(fd);
+    throw std::runtime_error("Can't stat code file " + filename);
+  }
+  const auto size = status.getSize();
+
+  // Empty sections are legal, but can't be mapped.
+  if (!size) {
+    llvm::sys::fs::closeFile(fd);
+    return;
+  }
+
+  std::error_code ec;
+  auto region = std::make_unique<llvm::sys::fs::mapped_file_region>(
+      fd, llvm::sys::fs::mapped_file_region::readonly, size, 0, ec);
+  llvm::sys::fs::closeFile(fd);
+  if (ec) {
+    throw std::runtime_error("Can't map code file " + filename + ": " +
+                             ec.message());
+  }
+
+  AddSection(address,
+             llvm::ArrayRef<uint8_t>(
+                 reinterpret_cast<const uint8_t *>(region->const_data()),
+                 region->size()));
+  regions.emplace_back(std::move(region));
+}
+
+void CodeImage::AddSection(uint64_t address, llvm::ArrayRef<uint8_t> data,
+                           bool is_executable) {
+  if (data.empty()) {
+    return;
+  }
+
+  Section section{address, data, is_executable};
+  auto it = std::upper_bound(
+      sections.begin(), sections.end(), address,
+      [](uint64_t addr, const Section &sec) { return addr < sec.address; });
+
+  if ((it != sections.end() && it->address < section.EndAddress()) ||
+      (it != sections.begin() && address < std::prev(it)->EndAddress())) {
+    throw std::runtime_error("Overlapping code sections");
+  }
+
+  sections.insert(it, section);
+}
+
+const CodeImage::Section *CodeImage::FindSection(uint64_t addr) const {
+
+  // The common case is one big `.text`.
+  if (sections.size() == 1) {
+    const auto &sec = sections.front();
+    return (addr >= sec.address && addr < sec.EndAddress()) ? &sec : nullptr;
+  }
+
+  auto it = std::upper_bound(
+      sections.begin(), sections.end(), addr,
+      [](uint64_t addr, const Section &sec) { return addr < sec.address; });
+  if (it == sections.begin()) {
+    return nullptr;
+  }
+
+  --it;
+  return addr < it->EndAddress() ? &*it : nullptr;
+}
+
+bool CodeImage::ReadByte(uint64_t addr, uint8_t *byte) const {
+  auto sec = FindSection(addr);
+  if (!sec) {
+    return false;
+  }
+  *byte = sec->data[addr - sec->address];
+  return true;
+}
+
+size_t CodeImage::Read(uint64_t addr, uint8_t *out, size_t size) const {
+  size_t num_read = 0;
+  auto sec = FindSection(addr);
+  while (sec && num_read < size) {
+    const auto offset = addr - sec->address;
+    const auto avail = std::min<uint64_t>(sec->data.size() - offset,
+                                          size - num_read);
+    memcpy(out + num_read, sec->data.data() + offset, avail);
+    num_read += avail;
+    addr += avail;
+
+    // Continue into the next section only if it starts right where this one
+    // ended.
+    const auto next = sec + 1;
+    if (next == sections.data() + sections.size() || next->address != addr) {
+      break;
+    }
+    sec = next;
+  }
+  return num_read;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only view of the guest code, and of the data next to it. Every section
+// is a flat byte range at a fixed guest address; raw section dumps are mapped
+// straight from disk, so no per-byte bookkeeping is ever done.
+class CodeImage {
+ public:
+  struct Section {
+    uint64_t address;
+    llvm::ArrayRef<uint8_t> data;
+
+    // Sections of data can be read, and even lifted if something leads there,
+    // but aren't searched for code.
+    bool is_executable;
+
+    inline uint64_t EndAddress(void) const {
+      return address + data.size();
+    }
+  };
+
+  // Map the file `filename` and expose its contents at `address`.
+  void AddSection(uint64_t address, const std::string &filename);
+
+  // Expose `data` at `address`. The memory is not owned by the image and
+  // must outlive it.
+  void AddSection(uint64_t address, llvm::ArrayRef<uint8_t> data,
+                  bool is_executable = true);
+
+  // Returns the section containing `addr`, or `nullptr`.
+  const Section *FindSection(uint64_t addr) const;
+
+  // Read a single byte. Returns `false` if `addr` is outside of the image.
+  bool ReadByte(uint64_t addr, uint8_t *byte) const;
+
+  // Read up to `size` bytes starting at `addr` into `out`, crossing into
+  // adjacent sections if they are contiguous. Returns the number of bytes
+  // actually read.
+  size_t Read(uint64_t addr, uint8_t *out, size_t size) const;
+
+  inline const std::vector<Section> &Sections(void) const {
+    return sections;
+  }
+
+ private:
+  // Sorted by `Section::address`, non-overlapping.
+  std::vector<Section> sections;
+
+  // Keeps the file mappings alive.
+  std::vector<std::unique_ptr<llvm::sys::fs::mapped_file_region>> regions;
+};
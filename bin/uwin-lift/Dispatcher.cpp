@@ -0,0 +1,430 @@
+#include "Dispatcher.h"
+
+#include <glog/logging.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "Profile.h"
+
+const char * const kRuntimeDispatcherName = "uwin_xcute_remill_dispatch";
+const char * const kRecompiledDispatcherName =
+    "uwin_xcute_remill_dispatch_recompiled";
+const char * const kUnknownDispatchTargetName =
+    "uwin_xcute_remill_dispatch_unknown";
+
+bool ParseDispatcherKind(std::string_view name, DispatcherKind &kind) {
+  if (name == "switch") {
+    kind = DispatcherKind::kSwitch;
+  } else if (name == "binary_search") {
+    kind = DispatcherKind::kBinarySearch;
+  } else if (name == "page_table") {
+    kind = DispatcherKind::kPageTable;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// Everything the different dispatcher flavours share.
+struct DispatcherBuilder {
+  llvm::Module *module;
+  llvm::LLVMContext &context;
+  llvm::FunctionType *lifted_func_type;
+  llvm::Function *dispatcher_fun;
+  std::vector<llvm::Value*> args;
+  llvm::Value *pc;
+  llvm::BasicBlock *entry;
+  llvm::BasicBlock *abort;
+
+  // Sorted addresses and the lifted functions for them.
+  std::vector<uint64_t> addrs;
+  std::vector<llvm::Function*> funs;
+
+  // Built on demand.
+  llvm::GlobalVariable *addr_table{nullptr};
+  llvm::GlobalVariable *fun_table{nullptr};
+
+  // If instrumenting, the counter of `addrs[i]` is `first_counter + i`.
+  ProfileInstrumenter *instrumenter{nullptr};
+  uint64_t first_counter{0};
+
+  llvm::IntegerType *AddrType(void) const {
+    return llvm::cast<llvm::IntegerType>(pc->getType());
+  }
+
+  llvm::PointerType *FunPtrType(void) const {
+    return lifted_func_type->getPointerTo();
+  }
+
+  llvm::GlobalVariable *MakeTable(llvm::Type *elem_type,
+                                  std::vector<llvm::Constant*> const& elems,
+                                  const char *name) {
+    auto type = llvm::ArrayType::get(elem_type, elems.size());
+    return new llvm::GlobalVariable(
+        *module, type, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(type, elems), name);
+  }
+
+  void MakeTables(void) {
+    std::vector<llvm::Constant*> addr_elems;
+    std::vector<llvm::Constant*> fun_elems;
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      addr_elems.push_back(llvm::ConstantInt::get(AddrType(), addrs[i]));
+      fun_elems.push_back(llvm::ConstantExpr::getBitCast(funs[i], FunPtrType()));
+    }
+    addr_table = MakeTable(AddrType(), addr_elems, "uwin_dispatch_addrs");
+    fun_table = MakeTable(FunPtrType(), fun_elems, "uwin_dispatch_funs");
+  }
+
+  llvm::Value *LoadEntry(llvm::IRBuilder<> &builder, llvm::GlobalVariable *table,
+                         llvm::Value *index) {
+    auto table_type = table->getValueType();
+    auto elem_type = table_type->getArrayElementType();
+    llvm::Value *indices[] = {builder.getInt64(0), index};
+    auto ptr = builder.CreateInBoundsGEP(table_type, table, indices);
+    return builder.CreateLoad(elem_type, ptr);
+  }
+
+  // Calls `funs[i]`.
+  void CallTrace(llvm::IRBuilder<> &builder, size_t i) {
+    if (instrumenter) {
+      instrumenter->Increment(builder, first_counter + i);
+    }
+    auto newmem = builder.CreateCall(funs[i], args);
+    builder.CreateRet(newmem);
+  }
+
+  // Calls the function from `fun_table` at `index`.
+  void CallTableEntry(llvm::IRBuilder<> &builder, llvm::Value *index) {
+    if (instrumenter) {
+      instrumenter->Increment(builder, first_counter, index);
+    }
+    auto fun = LoadEntry(builder, fun_table, index);
+    auto call = builder.CreateCall(lifted_func_type, fun, args);
+    call->setTailCall();
+    builder.CreateRet(call);
+  }
+
+  void EmitHotTargets(std::vector<size_t> const& hot);
+  void EmitSwitch(DispatchProfile const& profile);
+  void EmitBinarySearch(void);
+  void EmitPageTable(void);
+};
+
+// Compares the PC with the traces `addrs[hot[i]]` one by one, before it is
+// looked up. The lookup then starts in the new `entry`.
+void DispatcherBuilder::EmitHotTargets(std::vector<size_t> const& hot) {
+  llvm::IRBuilder<> builder(entry);
+  for (auto i : hot) {
+    std::stringstream hexbbss;
+    hexbbss << std::hex << addrs[i];
+    std::string hexbb = hexbbss.str();
+
+    auto call = llvm::BasicBlock::Create(context, "hot_" + hexbb,
+                                         dispatcher_fun);
+    auto next = llvm::BasicBlock::Create(context, "", dispatcher_fun);
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(pc, llvm::ConstantInt::get(AddrType(), addrs[i])),
+        call, next);
+
+    builder.SetInsertPoint(call);
+    CallTrace(builder, i);
+
+    builder.SetInsertPoint(next);
+  }
+  entry = builder.GetInsertBlock();
+}
+
+void DispatcherBuilder::EmitSwitch(DispatchProfile const& profile) {
+  llvm::IRBuilder<> builder(entry);
+
+  auto sw = builder.CreateSwitch(pc, abort, addrs.size());
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    std::stringstream hexbbss;
+    hexbbss << std::hex << addrs[i];
+    std::string hexbb = hexbbss.str();
+
+    auto call = llvm::BasicBlock::Create(context, "call_" + hexbb,
+                                         dispatcher_fun);
+
+    builder.SetInsertPoint(call);
+    CallTrace(builder, i);
+
+    sw->addCase(llvm::ConstantInt::get(AddrType(), addrs[i]), call);
+  }
+
+  // Let LLVM balance the lowered switch by how often each case is taken.
+  if (!profile.counts.empty()) {
+    std::vector<uint64_t> counts = {profile.num_unknown};
+    for (auto addr : addrs) {
+      auto count_it = profile.counts.find(addr);
+      counts.push_back(count_it != profile.counts.end() ? count_it->second : 0);
+    }
+    const auto max_count = *std::max_element(counts.begin(), counts.end());
+    std::vector<uint32_t> weights;
+    for (auto count : counts) {
+      weights.push_back(ScaleBranchWeight(count, max_count));
+    }
+    sw->setMetadata(llvm::LLVMContext::MD_prof,
+                    llvm::MDBuilder(context).createBranchWeights(weights));
+  }
+}
+
+// Branchless lower bound over the sorted address table. The number of steps
+// only depends on the number of traces, so the search is fully unrolled.
+void DispatcherBuilder::EmitBinarySearch(void) {
+  llvm::IRBuilder<> builder(entry);
+  if (addrs.empty()) {
+    builder.CreateBr(abort);
+    return;
+  }
+
+  MakeTables();
+
+  llvm::Value *base = builder.getInt64(0);
+  for (uint64_t n = addrs.size(); n > 1; ) {
+    const auto half = n / 2;
+    auto probe = builder.CreateAdd(base, builder.getInt64(half));
+    auto probe_addr = LoadEntry(builder, addr_table, probe);
+    base = builder.CreateSelect(builder.CreateICmpULE(probe_addr, pc), probe,
+                                base);
+    n -= half;
+  }
+
+  auto found = llvm::BasicBlock::Create(context, "found", dispatcher_fun);
+  auto found_addr = LoadEntry(builder, addr_table, base);
+  builder.CreateCondBr(builder.CreateICmpEQ(found_addr, pc), found, abort);
+
+  builder.SetInsertPoint(found);
+  CallTableEntry(builder, base);
+}
+
+// Two-level lookup: the bucket of the PC indexes a table of start offsets
+// into the sorted address table, and the (short) run of addresses within the
+// bucket is then scanned linearly.
+void DispatcherBuilder::EmitPageTable(void) {
+  llvm::IRBuilder<> builder(entry);
+  if (addrs.empty()) {
+    builder.CreateBr(abort);
+    return;
+  }
+
+  MakeTables();
+
+  const auto min_base = addrs.front() >> kDispatchBucketShift;
+  const auto num_buckets = (addrs.back() >> kDispatchBucketShift) - min_base + 1;
+
+  // `starts[b]` is the index of the first trace in bucket `b` or later;
+  // `starts[num_buckets]` is the total number of traces.
+  std::vector<llvm::Constant*> starts;
+  auto i32_type = builder.getInt32Ty();
+  for (uint64_t bucket = 0, i = 0; bucket <= num_buckets; ++bucket) {
+    while (i < addrs.size() &&
+           ((addrs[i] >> kDispatchBucketShift) - min_base) < bucket) {
+      ++i;
+    }
+    starts.push_back(llvm::ConstantInt::get(i32_type, i));
+  }
+  auto start_table = MakeTable(i32_type, starts, "uwin_dispatch_buckets");
+
+  auto lookup = llvm::BasicBlock::Create(context, "lookup", dispatcher_fun);
+  auto loop = llvm::BasicBlock::Create(context, "scan", dispatcher_fun);
+  auto body = llvm::BasicBlock::Create(context, "scan_body", dispatcher_fun);
+  auto next = llvm::BasicBlock::Create(context, "scan_next", dispatcher_fun);
+  auto found = llvm::BasicBlock::Create(context, "found", dispatcher_fun);
+
+  // PCs below the first bucket wrap around and end up out of range, too.
+  auto offset = builder.CreateSub(
+      pc, llvm::ConstantInt::get(AddrType(), min_base << kDispatchBucketShift));
+  auto bucket = builder.CreateLShr(offset, kDispatchBucketShift);
+  builder.CreateCondBr(
+      builder.CreateICmpULT(bucket,
+                            llvm::ConstantInt::get(AddrType(), num_buckets)),
+      lookup, abort);
+
+  builder.SetInsertPoint(lookup);
+  auto bucket_index = builder.CreateZExt(bucket, builder.getInt64Ty());
+  auto lo = builder.CreateZExt(LoadEntry(builder, start_table, bucket_index),
+                               builder.getInt64Ty());
+  auto hi = builder.CreateZExt(
+      LoadEntry(builder, start_table,
+                builder.CreateAdd(bucket_index, builder.getInt64(1))),
+      builder.getInt64Ty());
+  builder.CreateBr(loop);
+
+  builder.SetInsertPoint(loop);
+  auto index = builder.CreatePHI(builder.getInt64Ty(), 2);
+  index->addIncoming(lo, lookup);
+  builder.CreateCondBr(builder.CreateICmpULT(index, hi), body, abort);
+
+  builder.SetInsertPoint(body);
+  auto addr = LoadEntry(builder, addr_table, index);
+  builder.CreateCondBr(builder.CreateICmpEQ(addr, pc), found, next);
+
+  builder.SetInsertPoint(next);
+  index->addIncoming(builder.CreateAdd(index, builder.getInt64(1)), next);
+  builder.CreateBr(loop);
+
+  builder.SetInsertPoint(found);
+  CallTableEntry(builder, index);
+}
+
+}  // namespace
+
+llvm::Function *EmitDispatcher(llvm::Module *module,
+                               llvm::FunctionType *lifted_func_type,
+                               std::map<uint64_t, std::string> const& traces,
+                               DispatcherKind kind,
+                               bool internalize_traces,
+                               DispatchProfile const& profile) {
+  auto &context = module->getContext();
+  auto dispatcher_fun = llvm::Function::Create(lifted_func_type,
+                                               llvm::GlobalValue::LinkageTypes::ExternalLinkage,
+                                               kRecompiledDispatcherName,
+                                               *module);
+
+  auto args_ptr = dispatcher_fun->arg_begin();
+  auto state = args_ptr++;
+  auto pc = args_ptr++;
+  auto mem = args_ptr++;
+
+  DispatcherBuilder db{module, context, lifted_func_type, dispatcher_fun,
+                       {state, pc, mem}, pc};
+
+  db.entry = llvm::BasicBlock::Create(context, "entry", dispatcher_fun);
+  db.abort = llvm::BasicBlock::Create(context, "abort", dispatcher_fun);
+
+  for (auto& bb : traces) {
+    auto fun = module->getFunction(bb.second);
+    if (!fun) {
+      fun = llvm::Function::Create(lifted_func_type,
+                                   llvm::GlobalValue::ExternalLinkage,
+                                   bb.second, module);
+    }
+
+    // do not expose the sub_* functions
+    // TODO: do it only when compiling release?
+    // TODO: is Private any better than InternalLinkage? Does it give any optimization chances?
+    if (internalize_traces) {
+      fun->setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+
+    db.addrs.push_back(bb.first);
+    db.funs.push_back(fun);
+  }
+
+  std::unique_ptr<ProfileInstrumenter> instrumenter;
+  if (profile.instrument) {
+    instrumenter = std::make_unique<ProfileInstrumenter>(module);
+    db.instrumenter = instrumenter.get();
+    for (size_t i = 0; i < db.addrs.size(); ++i) {
+      auto counter = instrumenter->AddCounter(DispatchCounterName(db.addrs[i]));
+      if (!i) {
+        db.first_counter = counter;
+      }
+    }
+  }
+
+  {
+    llvm::IRBuilder<> builder(db.abort);
+
+    if (instrumenter) {
+      instrumenter->Increment(
+          builder, instrumenter->AddCounter(kUnknownDispatchCounterName));
+    }
+
+    auto unk = module->getOrInsertFunction(kUnknownDispatchTargetName,
+                                           lifted_func_type);
+
+    builder.CreateRet(builder.CreateCall(unk, db.args));
+  }
+
+  // Hottest first.
+  std::vector<size_t> hot;
+  for (size_t i = 0; i < db.addrs.size(); ++i) {
+    auto count_it = profile.counts.find(db.addrs[i]);
+    if (count_it != profile.counts.end() && count_it->second) {
+      hot.push_back(i);
+    }
+  }
+  std::stable_sort(hot.begin(), hot.end(), [&](size_t a, size_t b) {
+    return profile.counts.at(db.addrs[a]) > profile.counts.at(db.addrs[b]);
+  });
+  hot.resize(std::min<size_t>(hot.size(), profile.num_hot_targets));
+  db.EmitHotTargets(hot);
+
+  switch (kind) {
+    case DispatcherKind::kSwitch: db.EmitSwitch(profile); break;
+    case DispatcherKind::kBinarySearch: db.EmitBinarySearch(); break;
+    case DispatcherKind::kPageTable: db.EmitPageTable(); break;
+  }
+
+  if (instrumenter) {
+    instrumenter->Finish();
+  }
+
+  return dispatcher_fun;
+}
+
+unsigned EmitDirectCalls(llvm::Module *module,
+                         llvm::ArrayRef<llvm::Function *> dispatchers,
+                         std::map<uint64_t, std::string> const& traces) {
+  std::vector<llvm::CallInst*> calls;
+  for (auto dispatch : dispatchers) {
+    if (!dispatch) {
+      continue;
+    }
+    for (auto user : dispatch->users()) {
+      if (auto call = llvm::dyn_cast<llvm::CallInst>(user);
+          call && call->getCalledOperand() == dispatch) {
+        calls.push_back(call);
+      }
+    }
+  }
+
+  unsigned num_rewritten = 0;
+  for (auto call : calls) {
+
+    // All of them take `(State &, pc, Memory *)`, like lifted functions.
+    auto pc = llvm::dyn_cast<llvm::ConstantInt>(call->getArgOperand(1));
+    if (!pc) {
+      continue;
+    }
+
+    auto trace_it = traces.find(pc->getZExtValue());
+    if (trace_it == traces.end()) {
+      continue;
+    }
+
+    auto fun = module->getFunction(trace_it->second);
+    if (!fun) {
+      continue;
+    }
+
+    // The `State` type in the intrinsics and in the lifted code can be
+    // distinct (but identical) named structures.
+    auto func_type = call->getFunctionType();
+    if (fun->getFunctionType() == func_type) {
+      call->setCalledFunction(fun);
+    } else {
+      call->setCalledFunction(
+          func_type,
+          llvm::ConstantExpr::getBitCast(fun, func_type->getPointerTo()));
+    }
+    ++num_rewritten;
+  }
+
+  return num_rewritten;
+}
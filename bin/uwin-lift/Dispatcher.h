@@ -0,0 +1,80 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace llvm {
+class Function;
+class FunctionType;
+class Module;
+}  // namespace llvm
+
+// How `uwin_xcute_remill_dispatch_recompiled` finds the lifted function for a
+// given PC.
+enum class DispatcherKind {
+  // One `switch` case per lifted trace. Left to LLVM to lower.
+  kSwitch,
+
+  // Sorted table of trace addresses searched with a fixed number of
+  // branchless steps, plus a parallel table of function pointers.
+  kBinarySearch,
+
+  // Table of trace addresses bucketed by the high bits of the address. The
+  // bucket index picks a short run of the sorted table, which is then scanned.
+  kPageTable,
+};
+
+// Parses `switch`, `binary_search` or `page_table`.
+bool ParseDispatcherKind(std::string_view name, DispatcherKind &kind);
+
+// Name of the runtime dispatcher, used by `__remill_jump` and
+// `__remill_function_call` in the intrinsics.
+extern const char * const kRuntimeDispatcherName;
+
+// Name of the dispatcher we emit.
+extern const char * const kRecompiledDispatcherName;
+
+// Name of the runtime function called for PCs without a lifted trace.
+extern const char * const kUnknownDispatchTargetName;
+
+// Number of low address bits ignored when picking a bucket for
+// `DispatcherKind::kPageTable`.
+static constexpr unsigned kDispatchBucketShift = 8u;
+
+// What the dispatcher knows about how often it finds which trace.
+struct DispatchProfile {
+  // Count the dispatches to every trace, and of unknown PCs.
+  bool instrument{false};
+
+  // Dispatches by trace address, from a profile. The `num_hot_targets`
+  // hottest traces are checked for before looking up the PC, and the switch
+  // cases are weighted by them.
+  std::map<uint64_t, uint64_t> counts;
+  uint64_t num_unknown{0};
+  unsigned num_hot_targets{0};
+};
+
+// Builds `uwin_xcute_remill_dispatch_recompiled`, which calls the lifted
+// function for a given PC, or `uwin_xcute_remill_dispatch_unknown` if there is
+// none. Functions named in `traces` are declared if they aren't in `module`.
+llvm::Function *EmitDispatcher(llvm::Module *module,
+                               llvm::FunctionType *lifted_func_type,
+                               std::map<uint64_t, std::string> const& traces,
+                               DispatcherKind kind,
+                               bool internalize_traces,
+                               DispatchProfile const& profile = {});
+
+// Replaces calls to any of `dispatchers`, i.e. to `__remill_jump`,
+// `__remill_function_call` or the runtime dispatcher, whose PC argument is a
+// constant address in `traces` with direct calls to that trace. Traces that
+// aren't in `module` are left alone: they were inlined and removed, or they
+// were never referenced here, and declaring them would leave an undefined
+// symbol behind if they're internal elsewhere. Returns the number of calls
+// that were rewritten.
+unsigned EmitDirectCalls(llvm::Module *module,
+                         llvm::ArrayRef<llvm::Function *> dispatchers,
+                         std::map<uint64_t, std::string> const& traces);
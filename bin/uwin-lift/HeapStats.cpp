@@ -0,0 +1,39 @@
+#include "HeapStats.h"
+
+#include <cstdlib>
+#include <new>
+
+// Counted per thread, so that shards lifted in parallel don't count each
+// other's allocations, and so that counting doesn't need atomics.
+static thread_local uint64_t gNumHeapAllocations = 0;
+
+uint64_t NumHeapAllocations(void) {
+  return gNumHeapAllocations;
+}
+
+// The array and `nothrow` forms of `operator new` go through this one, and
+// the matching forms of `operator delete` through the ones below.
+void *operator new(std::size_t size) {
+  ++gNumHeapAllocations;
+  if (!size) {
+    size = 1;
+  }
+  while (true) {
+    if (auto ptr = std::malloc(size)) {
+      return ptr;
+    }
+    auto handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Returns the number of calls to the global `operator new` made so far by the
+// calling thread. uwin-lift replaces `operator new` to count these, so that
+// it can report how much the lifter touches the allocator.
+uint64_t NumHeapAllocations(void);
@@ -0,0 +1,323 @@
+#include "Imports.h"
+
+#include <glog/logging.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Arch.h>
+#include <remill/BC/IntrinsicTable.h>
+#include <remill/BC/Util.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+// Semantics of `call far ptr16:32`, see `DoCALL_FAR_PTRp_IMMw`.
+static const char * const kFarCallISelName = "ISEL_CALL_FAR_PTRp_IMMw_32";
+
+static bool ParseImportType(std::string const& name, ImportType &type) {
+  static const std::unordered_map<std::string, ImportType> kTypes = {
+      {"void", ImportType::kVoid}, {"i8", ImportType::kI8},
+      {"i16", ImportType::kI16},   {"i32", ImportType::kI32},
+      {"i64", ImportType::kI64},   {"f32", ImportType::kF32},
+      {"f64", ImportType::kF64},   {"ptr", ImportType::kPointer},
+  };
+  auto type_it = kTypes.find(name);
+  if (type_it == kTypes.end()) {
+    return false;
+  }
+  type = type_it->second;
+  return true;
+}
+
+// Number of bytes that a value of `type` takes up on the guest stack.
+static uint32_t StackSize(ImportType type) {
+  switch (type) {
+    case ImportType::kI64:
+    case ImportType::kF64: return 8;
+    default: return 4;
+  }
+}
+
+void ImportTable::Load(const std::string &filename) {
+  std::ifstream f(filename, std::ios_base::in);
+  if (!f.is_open()) {
+    throw std::runtime_error("Can't open import signatures file");
+  }
+
+  std::string line;
+  for (unsigned line_num = 1; std::getline(f, line); ++line_num) {
+    auto error = [&](std::string const& message) {
+      return std::runtime_error(filename + ":" + std::to_string(line_num) +
+                                ": " + message);
+    };
+
+    std::istringstream fields(line);
+    std::string first;
+    if (!(fields >> first)) {
+      continue;  // Blank line.
+    }
+
+    fields.clear();
+    fields.seekg(0);
+    ImportSignature sig;
+    std::string convention, type;
+    if (!(fields >> sig.offset >> sig.name >> convention >> type)) {
+      throw error("Expected `offset name stdcall|cdecl return_type`");
+    }
+
+    if (convention == "stdcall") {
+      sig.convention = ImportConvention::kStdcall;
+    } else if (convention == "cdecl") {
+      sig.convention = ImportConvention::kCdecl;
+    } else {
+      throw error("Unknown calling convention " + convention + " of import " +
+                  sig.name);
+    }
+
+    // Floating point values are returned on the x87 stack.
+    if (!ParseImportType(type, sig.return_type) ||
+        sig.return_type == ImportType::kF32 ||
+        sig.return_type == ImportType::kF64) {
+      throw error("Unsupported return type " + type + " of import " +
+                  sig.name);
+    }
+
+    while (fields >> type) {
+      ImportType arg_type;
+      if (type == "callback") {
+        sig.calls_back = true;
+      } else if (sig.calls_back || !ParseImportType(type, arg_type) ||
+                 arg_type == ImportType::kVoid) {
+        throw error("Unsupported argument type " + type + " of import " +
+                    sig.name);
+      } else {
+        sig.arg_types.push_back(arg_type);
+      }
+    }
+
+    signatures[sig.offset] = std::move(sig);
+  }
+}
+
+const ImportSignature *ImportTable::Find(uint32_t offset) const {
+  auto sig_it = signatures.find(offset);
+  return sig_it != signatures.end() ? &(sig_it->second) : nullptr;
+}
+
+namespace {
+
+// Builds the thunks of one module.
+class ThunkBuilder {
+ public:
+  ThunkBuilder(llvm::Module *module_, const remill::Arch *arch_,
+               const remill::IntrinsicTable &intrinsics_,
+               llvm::FunctionType *thunk_type_)
+      : module(module_),
+        context(module->getContext()),
+        arch(arch_),
+        intrinsics(intrinsics_),
+        thunk_type(thunk_type_),
+        i8_ptr_type(llvm::Type::getInt8PtrTy(context)) {}
+
+  llvm::Function *GetOrCreateThunk(const ImportSignature &sig);
+
+ private:
+  llvm::Type *NativeType(ImportType type) const;
+
+  llvm::Value *ReadArg(llvm::IRBuilder<> &ir, ImportType type,
+                       llvm::Value *addr);
+
+  llvm::Module *const module;
+  llvm::LLVMContext &context;
+  const remill::Arch *const arch;
+  const remill::IntrinsicTable &intrinsics;
+  llvm::FunctionType *const thunk_type;
+  llvm::Type *const i8_ptr_type;
+
+  llvm::Value *mem{nullptr};
+  std::unordered_map<uint32_t, llvm::Function *> thunks;
+};
+
+llvm::Type *ThunkBuilder::NativeType(ImportType type) const {
+  switch (type) {
+    case ImportType::kVoid: return llvm::Type::getVoidTy(context);
+    case ImportType::kI8: return llvm::Type::getInt8Ty(context);
+    case ImportType::kI16: return llvm::Type::getInt16Ty(context);
+    case ImportType::kI32: return llvm::Type::getInt32Ty(context);
+    case ImportType::kI64: return llvm::Type::getInt64Ty(context);
+    case ImportType::kF32: return llvm::Type::getFloatTy(context);
+    case ImportType::kF64: return llvm::Type::getDoubleTy(context);
+    case ImportType::kPointer: return i8_ptr_type;
+  }
+  return nullptr;
+}
+
+// Reads an argument of `type` from the guest stack at `addr`, and converts it
+// for the native function.
+llvm::Value *ThunkBuilder::ReadArg(llvm::IRBuilder<> &ir, ImportType type,
+                                   llvm::Value *addr) {
+  if (StackSize(type) == 8) {
+    llvm::Value *val = ir.CreateCall(intrinsics.read_memory_64, {mem, addr});
+    return ir.CreateBitCast(val, NativeType(type));
+  }
+
+  llvm::Value *val = ir.CreateCall(intrinsics.read_memory_32, {mem, addr});
+  switch (type) {
+    case ImportType::kI8:
+    case ImportType::kI16: return ir.CreateTrunc(val, NativeType(type));
+    case ImportType::kF32: return ir.CreateBitCast(val, NativeType(type));
+
+    // Guest null pointers stay null pointers, rather than pointing to the
+    // start of guest memory.
+    case ImportType::kPointer: {
+      auto host_ptr = ir.CreateGEP(ir.getInt8Ty(),
+                                   ir.CreateBitCast(mem, i8_ptr_type),
+                                   ir.CreateZExt(val, ir.getInt64Ty()));
+      return ir.CreateSelect(ir.CreateIsNull(val),
+                             llvm::ConstantPointerNull::get(
+                                 llvm::cast<llvm::PointerType>(i8_ptr_type)),
+                             host_ptr);
+    }
+    default: return val;
+  }
+}
+
+llvm::Function *ThunkBuilder::GetOrCreateThunk(const ImportSignature &sig) {
+  auto &thunk = thunks[sig.offset];
+  if (thunk) {
+    return thunk;
+  }
+
+  std::vector<llvm::Type *> native_arg_types;
+  for (auto type : sig.arg_types) {
+    native_arg_types.push_back(NativeType(type));
+  }
+  auto native_func = module->getOrInsertFunction(
+      sig.name, llvm::FunctionType::get(NativeType(sig.return_type),
+                                        native_arg_types, false));
+
+  thunk = llvm::Function::Create(thunk_type, llvm::GlobalValue::InternalLinkage,
+                                 "uwin_import_" + sig.name, module);
+  thunk->addFnAttr(llvm::Attribute::AlwaysInline);
+
+  llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", thunk));
+  mem = thunk->getArg(0);
+  auto state = thunk->getArg(1);
+
+  auto esp_ref = arch->RegisterByName("ESP")->AddressOf(state, ir);
+  auto esp = ir.CreateLoad(ir.getInt32Ty(), esp_ref);
+
+  // The arguments are right above the return address.
+  std::vector<llvm::Value *> args;
+  uint32_t offset = 4;
+  for (auto type : sig.arg_types) {
+    args.push_back(ReadArg(ir, type, ir.CreateAdd(esp, ir.getInt32(offset))));
+    offset += StackSize(type);
+  }
+
+  llvm::Value *ret = ir.CreateCall(native_func, args);
+
+  auto eax_ref = arch->RegisterByName("EAX")->AddressOf(state, ir);
+  switch (sig.return_type) {
+    case ImportType::kVoid: break;
+    case ImportType::kI8:
+    case ImportType::kI16:
+      ir.CreateStore(ir.CreateZExt(ret, ir.getInt32Ty()), eax_ref);
+      break;
+    case ImportType::kI32: ir.CreateStore(ret, eax_ref); break;
+    case ImportType::kI64: {
+      auto edx_ref = arch->RegisterByName("EDX")->AddressOf(state, ir);
+      ir.CreateStore(ir.CreateTrunc(ret, ir.getInt32Ty()), eax_ref);
+      ir.CreateStore(ir.CreateTrunc(ir.CreateLShr(ret, 32), ir.getInt32Ty()),
+                     edx_ref);
+      break;
+    }
+
+    // Back to a guest address. Native code may only return pointers into
+    // guest memory, or null.
+    case ImportType::kPointer: {
+      auto host_addr = ir.CreatePtrToInt(ret, ir.getInt64Ty());
+      auto base = ir.CreatePtrToInt(mem, ir.getInt64Ty());
+      auto guest_addr =
+          ir.CreateTrunc(ir.CreateSub(host_addr, base), ir.getInt32Ty());
+      ir.CreateStore(ir.CreateSelect(ir.CreateIsNull(ret), ir.getInt32(0),
+                                     guest_addr),
+                     eax_ref);
+      break;
+    }
+    default: LOG(FATAL) << "Unsupported return type of import " << sig.name;
+  }
+
+  // Pop the arguments of `stdcall` functions.
+  const auto args_size = offset - 4;
+  if (sig.convention == ImportConvention::kStdcall && args_size) {
+    auto ret_addr = ir.CreateCall(intrinsics.read_memory_32, {mem, esp});
+    auto new_esp = ir.CreateAdd(esp, ir.getInt32(args_size));
+    mem = ir.CreateCall(intrinsics.write_memory_32, {mem, new_esp, ret_addr});
+    ir.CreateStore(new_esp, esp_ref);
+  }
+
+  ir.CreateRet(mem);
+  return thunk;
+}
+
+}  // namespace
+
+unsigned EmitImportCalls(llvm::Module *module, const remill::Arch *arch,
+                         const remill::IntrinsicTable &intrinsics,
+                         const ImportTable &imports) {
+  auto isel = remill::FindGlobaVariable(module, kFarCallISelName);
+  if (imports.signatures.empty() || !isel || !isel->hasInitializer()) {
+    return 0;
+  }
+  auto sem = llvm::dyn_cast<llvm::Function>(
+      isel->getInitializer()->stripPointerCasts());
+  if (!sem) {
+    return 0;
+  }
+
+  // `Memory *DoCALL_FAR_PTRp_IMMw(Memory *, State &, I32 addr, I16 seg)`,
+  // called by lifted code with the immediates as constants.
+  std::vector<llvm::CallInst *> calls;
+  for (auto user : sem->users()) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(user);
+        call && call->getCalledFunction() == sem && call->arg_size() == 4) {
+      calls.push_back(call);
+    }
+  }
+  if (calls.empty()) {
+    return 0;
+  }
+
+  auto thunk_type = llvm::FunctionType::get(
+      sem->getReturnType(),
+      {sem->getFunctionType()->getParamType(0),
+       sem->getFunctionType()->getParamType(1)},
+      false);
+  ThunkBuilder builder(module, arch, intrinsics, thunk_type);
+
+  unsigned num_replaced = 0;
+  for (auto call : calls) {
+    auto offset = llvm::dyn_cast<llvm::ConstantInt>(call->getArgOperand(2));
+    auto seg = llvm::dyn_cast<llvm::ConstantInt>(call->getArgOperand(3));
+    if (!offset || !seg || seg->getZExtValue() != kNativeCallSegment) {
+      continue;
+    }
+    auto sig = imports.Find(static_cast<uint32_t>(offset->getZExtValue()));
+    if (!sig || sig->calls_back) {
+      continue;
+    }
+
+    auto thunk_call = llvm::CallInst::Create(
+        builder.GetOrCreateThunk(*sig),
+        {call->getArgOperand(0), call->getArgOperand(1)}, "", call);
+    call->replaceAllUsesWith(thunk_call);
+    call->eraseFromParent();
+    ++num_replaced;
+  }
+  return num_replaced;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+}  // namespace llvm
+
+namespace remill {
+class Arch;
+class IntrinsicTable;
+}  // namespace remill
+
+// Segment of the far calls through which uwin calls into native code. The
+// offset of the far call says which native function it is.
+constexpr uint16_t kNativeCallSegment = 0x7775;
+
+enum class ImportConvention { kStdcall, kCdecl };
+
+// Types of the arguments and return values of native functions. Pointers are
+// guest addresses on the guest side, and host pointers on the native side.
+enum class ImportType { kVoid, kI8, kI16, kI32, kI64, kF32, kF64, kPointer };
+
+struct ImportSignature {
+  // Offset of the far calls to this function.
+  uint32_t offset;
+
+  // Symbol of the native function.
+  std::string name;
+
+  ImportConvention convention;
+  ImportType return_type;
+  std::vector<ImportType> arg_types;
+
+  // The function may call back into lifted code, e.g. a window procedure or
+  // a comparison function, so far calls to it keep the generic path.
+  bool calls_back{false};
+};
+
+// Signatures of the native functions that lifted code calls directly.
+//
+// A direct call doesn't hand the `State` to the native function, so the
+// optimizer, e.g. the dead store elimination of `State` slots, treats it as
+// not reading guest registers, and may drop or delay their stores across it.
+// Native code that calls back into lifted code would see stale registers. Such functions
+// must be marked with `callback`, which leaves their far calls to go through
+// `__remill_uwin_external_call`.
+class ImportTable {
+ public:
+  // Load lines of `offset name stdcall|cdecl return_type [arg_type...]
+  // [callback]` from `filename`, where types are `void` (only as the return
+  // type), `i8`, `i16`, `i32`, `i64`, `f32`, `f64` (only as argument types)
+  // or `ptr`. Blank lines are skipped, and malformed ones throw with their
+  // file and line number.
+  void Load(const std::string &filename);
+
+  // Returns the signature of the native function at `offset`, or `nullptr`.
+  const ImportSignature *Find(uint32_t offset) const;
+
+  std::map<uint32_t, ImportSignature> signatures;
+};
+
+// Replaces the far calls of lifted code to the native functions in `imports`
+// with calls to typed thunks. The thunks read the arguments off the guest
+// stack, above the return address, call the native function, and put its
+// return value into `EAX`, or `EDX:EAX`. Like the callee would, they pop the
+// arguments of `stdcall` functions, by moving the return address up over
+// them, so that the `ret` that follows the far call returns past them. Other
+// far calls, including those to functions marked `callback`, keep going
+// through `__remill_uwin_external_call`. Returns the number of far calls that
+// were replaced.
+unsigned EmitImportCalls(llvm::Module *module, const remill::Arch *arch,
+                         const remill::IntrinsicTable &intrinsics,
+                         const ImportTable &imports);
@@ -2,21 +2,45 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Linker/Linker.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/IR/Verifier.h>
 #include <remill/Arch/Arch.h>
 #include <remill/Arch/Name.h>
+#include <remill/BC/CFGDiscoverer.h>
 #include <remill/BC/IntrinsicTable.h>
+#include <remill/BC/LiftStats.h>
 #include <remill/BC/Lifter.h>
 #include <remill/BC/Optimizer.h>
 #include <remill/BC/Util.h>
 #include <remill/OS/OS.h>
 
+#include "CodeImage.h"
+#include "Dispatcher.h"
+#include "HeapStats.h"
+#include "Imports.h"
+#include "NameMap.h"
+#include "ObjectFile.h"
+#include "PEImage.h"
+#include "Profile.h"
+#include "TraceCache.h"
+#include "TraceHeads.h"
+
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 // For gflags definitions
 #pragma clang diagnostic push
@@ -26,11 +50,31 @@ DEFINE_uint64(code_address, 0,
               "Start address of the code section");
 DEFINE_string(code_filename, "",
               "Filename of raw code section data");
+DEFINE_string(exe_filename, "",
+              "PE32 executable whose sections are mapped at their addresses, "
+              "instead of --code_filename at --code_address. Its entry point, "
+              "exports and relocations seed the discovery of trace heads.");
 
 DEFINE_string(ir_out, "", "Path to file where the LLVM IR should be saved.");
 DEFINE_string(bc_out, "",
               "Path to file where the LLVM bitcode should be "
               "saved.");
+DEFINE_string(obj_out, "",
+              "Path to file where the relocatable object should be saved.");
+DEFINE_string(obj_triple, "",
+              "Target triple of --obj_out. Defaults to the one of the "
+              "intrinsics.");
+DEFINE_string(obj_cpu, "", "Target CPU of --obj_out, e.g. haswell.");
+DEFINE_string(obj_features, "",
+              "Comma-separated target features of --obj_out, e.g. "
+              "+avx2,-sse4a.");
+DEFINE_string(obj_reloc_model, "pic",
+              "Relocation model of --obj_out: pic, static or "
+              "dynamic-no-pic.");
+DEFINE_uint32(codegen_threads, 1,
+              "Number of parts that --obj_out is split into, each compiled "
+              "on a thread of its own. The parts are saved with .partN "
+              "inserted before the file extension.");
 
 DEFINE_string(intrinsics_filename, INTRINSICS_BC, "Llvm bitcode containing "
               "the intrinsics. "
@@ -39,74 +83,314 @@ DEFINE_string(basic_blocks_filename, "",
               "Filename of a file containing basic block addresses.");
 DEFINE_string(name_map_filename, "",
               "Filename of a file containing name map.");
+DEFINE_string(entry_points_filename, "",
+              "Filename of a file containing function entry addresses, e.g. "
+              "the entry point and debug symbols. Without "
+              "--basic_blocks_filename, the trace heads are discovered by "
+              "decoding everything reachable from them.");
+DEFINE_string(trace_heads, "blocks",
+              "Which blocks get a lifted function of their own: `blocks`, "
+              "i.e. all of them, or `functions`, i.e. function entries and "
+              "blocks that no function reaches. With `functions`, the other "
+              "blocks are lifted into their function, which is entered there "
+              "through a switch on the PC. Needs --entry_points_filename or "
+              "--exe_filename.");
+DEFINE_bool(jump_tables, true,
+            "Recover the jump tables of indirect jumps while discovering "
+            "trace heads, and lift those jumps to a switch over the table "
+            "targets, falling back to the dispatcher. Needs "
+            "--entry_points_filename or --exe_filename.");
+DEFINE_string(basic_blocks_out, "",
+              "Path where the discovered trace heads should be saved, in the "
+              "format of --basic_blocks_filename.");
+
+DEFINE_string(import_signatures_filename, "",
+              "Filename of a file containing the signatures of native "
+              "functions, one `offset name stdcall|cdecl return_type "
+              "[arg_type...] [callback]` per line. Far calls into them read "
+              "their arguments off the guest stack and call them directly, "
+              "instead of going through __remill_uwin_external_call. "
+              "Functions that may call back into guest code must be marked "
+              "`callback`, and keep the generic path.");
+
+DEFINE_uint32(num_shards, 1,
+              "Number of shards to split the trace heads into. Each shard is "
+              "lifted and optimized independently, and is saved next to "
+              "--ir_out/--bc_out with a `.shardN` suffix. A `.dispatch` module "
+              "holds the dispatcher referencing all the shards.");
+DEFINE_string(dispatcher, "switch",
+              "How uwin_xcute_remill_dispatch_recompiled looks up lifted "
+              "traces: `switch`, `binary_search` (sorted table, branchless "
+              "search) or `page_table` (bucketed sorted table).");
+DEFINE_bool(dispatcher_direct_calls, false,
+            "Replace calls to uwin_xcute_remill_dispatch with a constant "
+            "target that is a lifted trace by direct calls to that trace.");
+DEFINE_uint32(num_threads, 0,
+              "Number of worker threads used to discover trace heads and lift "
+              "shards. Defaults to the number of hardware threads.");
+DEFINE_bool(lazy_semantics, true,
+            "Only deserialize the semantics functions that lifted code "
+            "actually uses.");
+DEFINE_bool(verify_semantics, true,
+            "Run the LLVM verifier on the semantics module. Can be turned off "
+            "for the trusted, embedded semantics.");
+DEFINE_string(trace_cache_dir, "",
+              "Directory holding optimized traces from previous runs. Traces "
+              "whose instruction bytes didn't change are taken from it rather "
+              "than being optimized again. When it is used, traces aren't "
+              "inlined into each other until the final module is optimized.");
+DEFINE_bool(promote_state, true,
+            "Keep the State fields that a lifted trace accesses in locals, "
+            "and only write them back around calls that are passed State.");
+DEFINE_string(optimization_profile, "max-speed",
+              "How hard to optimize the lifted code: max-speed, balanced, "
+              "fast-compile or size.");
+DEFINE_uint32(inline_threshold, 0,
+              "Inline threshold of the optimizer. Zero means the one of "
+              "--optimization_profile.");
+DEFINE_string(optimization_report, "",
+              "Path prefix of JSON reports of the time spent in, and the "
+              "instructions removed by, each optimization pass. The traces "
+              "and the final module get one each, with the shard number "
+              "and `.traces.json` or `.final.json` appended.");
+DEFINE_string(lift_stats, "",
+              "Path of a JSON file with the instructions decoded, lifted and "
+              "unsupported, the time spent decoding and lifting them, and the "
+              "IR size before and after optimization, of every trace.");
+DEFINE_bool(profile_instrument, false,
+            "Count how often every trace, conditional branch, call between "
+            "traces and dispatcher target is executed. The counts are "
+            "appended to $UWIN_LIFT_PROFILE, or else uwin-lift.profile, when "
+            "the program exits.");
+DEFINE_string(profile_use, "",
+              "Profile written by code built with --profile_instrument, to "
+              "weight branches, check the hottest dispatcher targets first, "
+              "hint the inlining of hot calls and move never executed traces "
+              "out of the way.");
+DEFINE_uint32(profile_hot_percent, 1,
+              "With --profile_use, calls between traces that are executed at "
+              "least this percent as often as the hottest one are hot.");
+DEFINE_uint32(profile_hot_dispatch_targets, 8,
+              "With --profile_use, number of the most dispatched to traces "
+              "that the dispatcher checks for before looking up the PC.");
+
+DECLARE_uint32(optimizer_num_threads);
+DECLARE_string(dse_calling_convention);
 
 #pragma clang diagnostic pop
 
-using Memory = std::unordered_map<uint64_t, uint8_t>;
+// Maps --exe_filename into `pe`, which must outlive the image, or else
+// --code_filename.
+static CodeImage LoadCode(PEImage &pe) {
+  CodeImage image;
+  if (FLAGS_exe_filename.empty()) {
+    image.AddSection(FLAGS_code_address, FLAGS_code_filename);
+    return image;
+  }
 
-static Memory LoadCode() {
-  // mock code
-  Memory mem;
-  // C7053713000028020000C3
-  // 31C064A300000000C3
-  std::ifstream f(FLAGS_code_filename, std::ios_base::in | std::ios_base::binary);
-  if (!f.is_open()) {
-    std::cerr << "Cannot open code file" << std::endl;
-    exit(1);
-  }
-  f.seekg(0, std::ios_base::end);
-  auto size = f.tellg();
-  f.seekg(0);
-  mem.reserve(size);
-  for (std::uint64_t i = FLAGS_code_address; i < FLAGS_code_address + size; i++) {
-    char b;
-    f.read(&b, 1);
-    mem.insert(std::make_pair(i, b));
-  }
-
-  //mem.insert(std::make_pair(9, 0x00));
-  //mem.insert(std::make_pair(10, 0xc3));
-  return mem;
+  pe.Load(FLAGS_exe_filename);
+  for (auto const& section : pe.sections) {
+    image.AddSection(section.address, section.data, section.is_executable);
+  }
+  LOG(INFO) << "Loaded " << pe.sections.size() << " sections, "
+            << pe.imports.size() << " imports, " << pe.exports.size()
+            << " exports and " << pe.relocations.size() << " relocations";
+  return image;
 }
 
-static std::vector<uint64_t> LoadTraceHeadAddresses() {
-  // mock code
+// Whether there is anything to discover trace heads from.
+static bool HaveEntryPoints() {
+  return !FLAGS_entry_points_filename.empty() || !FLAGS_exe_filename.empty();
+}
+
+static std::vector<uint64_t> LoadAddresses(std::string const& filename) {
   std::vector<uint64_t> res;
-  std::ifstream f(FLAGS_basic_blocks_filename, std::ios_base::in);
+  std::ifstream f(filename, std::ios_base::in);
   if (!f.is_open()) {
-    throw std::runtime_error("Can't open basic blocks file");
+    throw std::runtime_error("Can't open " + filename);
   }
 
-  while (true) {
-    std::uint64_t r;
-    f >> r;
-    if (f.eof()) break;
+  std::uint64_t r;
+  while (f >> r) {
     res.push_back(r);
   }
+  if (!f.eof()) {
+    throw std::runtime_error("Malformed address in " + filename);
+  }
   return res;
 }
 
-static std::unordered_map<uint64_t, std::string> LoadNameMap() {
-  if (FLAGS_name_map_filename.empty())
-    return {};
+// Decodes everything reachable from the entries in
+// `FLAGS_entry_points_filename`, and from the entry point, exports and
+// relocated code pointers of `pe`.
+static remill::DiscoveredCFG DiscoverCFG(CodeImage const& image,
+                                         PEImage const& pe) {
+  llvm::LLVMContext context;
+  auto arch = remill::Arch::Build(&context, remill::OSName::kOSWindows,
+                                  remill::ArchName::kArchX86);
 
-  std::unordered_map<uint64_t, std::string> res;
-  std::ifstream f(FLAGS_name_map_filename, std::ios_base::in);
-  if (!f.is_open()) {
-    throw std::runtime_error("Can't open name map file");
+  std::vector<uint64_t> entries;
+  if (!FLAGS_entry_points_filename.empty()) {
+    entries = LoadAddresses(FLAGS_entry_points_filename);
+  }
+  if (pe.entry_point) {
+    entries.push_back(pe.entry_point);
+  }
+  for (auto const& exp : pe.exports) {
+    entries.push_back(exp.address);
   }
 
-  while (true) {
-    std::uint64_t addr_lo, addr_hi;
-    std::string name;
-    f >> addr_lo >> addr_hi >> name;
-    if (f.eof()) break;
-    // TODO: this is dumb as fuck, replace by a more smart (but more complex) data structure
-    // probably smth with std::upper_bound would work
-    for (std::uint64_t addr = addr_lo; addr < addr_hi; addr++)
-      res.emplace(addr, name);
+  // Sections that aren't executable are still searched for code if there is
+  // an entry in them, as some programs keep code with their data.
+  remill::CFGDiscoverer discoverer(arch.get());
+  for (auto const& section : image.Sections()) {
+    const bool has_entry = std::any_of(
+        entries.begin(), entries.end(), [&](uint64_t addr) {
+          return addr >= section.address && addr < section.EndAddress();
+        });
+    discoverer.AddRegion(
+        section.address,
+        {reinterpret_cast<const char *>(section.data.data()),
+         section.data.size()},
+        section.is_executable || has_entry);
   }
-  return res;
+  for (auto addr : entries) {
+    discoverer.AddFunctionEntry(addr);
+  }
+  for (auto addr : pe.relocations) {
+    discoverer.AddRelocation(addr);
+  }
+
+  auto cfg = discoverer.Discover(FLAGS_num_threads);
+  for (auto const& [addr, block] : cfg.blocks) {
+    if (block.is_incomplete) {
+      LOG(WARNING) << "Not all successors of block " << std::hex << addr
+                   << std::dec << " are known";
+    }
+  }
+  return cfg;
+}
+
+// Recovered jump tables, by the address of the jump through them.
+using JumpTables = std::map<uint64_t, remill::DiscoveredJumpTable>;
+
+// Returns the trace heads, and fills `secondary_entries` with the blocks that
+// are lifted into the function of another trace head, see --trace_heads, and
+// `jump_tables` with the tables found by discovery, see --jump_tables.
+static std::vector<uint64_t> LoadTraceHeadAddresses(
+    CodeImage const& image, PEImage const& pe,
+    SecondaryEntries &secondary_entries, JumpTables &jump_tables) {
+  const bool function_traces = FLAGS_trace_heads == "functions";
+
+  std::vector<uint64_t> blocks;
+  remill::DiscoveredCFG cfg;
+  if (!FLAGS_basic_blocks_filename.empty() || !HaveEntryPoints()) {
+    blocks = LoadAddresses(FLAGS_basic_blocks_filename);
+  }
+
+  // With a basic blocks file, discovery only contributes the jump tables.
+  const bool use_discovered = blocks.empty() || function_traces;
+  if (HaveEntryPoints() && (use_discovered || FLAGS_jump_tables)) {
+    cfg = DiscoverCFG(image, pe);
+    if (use_discovered) {
+      auto discovered = cfg.TraceHeads();
+      blocks.insert(blocks.end(), discovered.begin(), discovered.end());
+    }
+    if (FLAGS_jump_tables) {
+      jump_tables = std::move(cfg.jump_tables);
+      LOG(INFO) << "Recovered " << jump_tables.size() << " jump tables";
+    }
+  }
+  std::sort(blocks.begin(), blocks.end());
+  blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+
+  if (!FLAGS_basic_blocks_out.empty()) {
+    std::ofstream f(FLAGS_basic_blocks_out, std::ios_base::out);
+    if (!f.is_open()) {
+      throw std::runtime_error("Can't open " + FLAGS_basic_blocks_out);
+    }
+    for (auto addr : blocks) {
+      f << addr << "\n";
+    }
+  }
+
+  if (!function_traces) {
+    return blocks;
+  }
+
+  auto heads = FunctionTraceHeads(cfg, blocks, secondary_entries);
+  LOG(INFO) << heads.size() << " of " << blocks.size()
+            << " blocks are trace heads";
+  return heads;
+}
+
+// Hashes the contents of `filename` into `hash`.
+static void HashFile(llvm::MD5 &hash, std::string const& filename) {
+  auto buffer = llvm::MemoryBuffer::getFile(filename);
+  if (!buffer) {
+    throw std::runtime_error("Can't read " + filename);
+  }
+  hash.update((*buffer)->getBuffer());
+}
+
+// Returns the cache of optimized traces, if there should be one. Its version
+// covers this executable, i.e. the lifter and optimizer along with the
+// embedded semantics, the semantics that are actually used, and the name map,
+// which affects the names of the traces called by every trace, and the
+// optimizer flags. The intrinsics only get linked in after the traces are
+// cached, so they don't matter.
+static std::unique_ptr<TraceCache> OpenTraceCache(const char *argv0) {
+  if (FLAGS_trace_cache_dir.empty()) {
+    return nullptr;
+  }
+
+  // The counters are private to the module that the traces were lifted into.
+  if (FLAGS_profile_instrument) {
+    LOG(WARNING) << "Not using --trace_cache_dir with --profile_instrument";
+    return nullptr;
+  }
+
+  llvm::MD5 version;
+  HashFile(version, llvm::sys::fs::getMainExecutable(
+                        argv0, reinterpret_cast<void *>(&OpenTraceCache)));
+  version.update(remill::FindSemanticsBitcodeBuffer(
+                     remill::GetArchName(remill::ArchName::kArchX86))
+                     ->getBuffer());
+  if (!FLAGS_name_map_filename.empty()) {
+    HashFile(version, FLAGS_name_map_filename);
+  }
+  if (!FLAGS_import_signatures_filename.empty()) {
+    HashFile(version, FLAGS_import_signatures_filename);
+  }
+  version.update(FLAGS_promote_state ? "promote_state" : "");
+  version.update(FLAGS_dse_calling_convention);
+  version.update(FLAGS_optimization_profile);
+  version.update(std::to_string(FLAGS_inline_threshold));
+  if (!FLAGS_profile_use.empty()) {
+    HashFile(version, FLAGS_profile_use);
+    version.update(std::to_string(FLAGS_profile_hot_percent));
+  }
+
+  llvm::MD5::MD5Result result;
+  version.final(result);
+  return std::make_unique<TraceCache>(FLAGS_trace_cache_dir,
+                                      result.digest().str().str());
+}
+
+static ImportTable LoadImportTable() {
+  ImportTable imports;
+  if (!FLAGS_import_signatures_filename.empty()) {
+    imports.Load(FLAGS_import_signatures_filename);
+  }
+  return imports;
+}
+
+static NameMap LoadNameMap() {
+  NameMap name_map;
+  if (!FLAGS_name_map_filename.empty()) {
+    name_map.Load(FLAGS_name_map_filename);
+  }
+  return name_map;
 }
 
 class SimpleTraceManager : public remill::TraceManager {
@@ -118,28 +402,50 @@ class SimpleTraceManager : public remill::TraceManager {
   template<typename Generator>
   explicit SimpleTraceManager(
       llvm::Module *module,
-      Memory &memory_,
+      CodeImage const& image_,
       Generator const& trace_heads_generator,
-      std::unordered_map<std::uint64_t, std::string> const& name_map_)
-      : memory(memory_), name_map(name_map_) {
+      NameMap const& name_map_)
+      : image(image_), name_map(name_map_) {
     for (auto const& addr : trace_heads_generator)
     {
-      traces[addr].function = remill::DeclareLiftedFunction(module, TraceName(addr));
+      auto &trace = traces[addr];
+      trace.name = name_map.TraceName(addr);
+      trace.function = remill::DeclareLiftedFunction(module, trace.name);
+      trace.known = true;
+
+      // Only a definition can be internal. Traces that end up not being
+      // lifted here (e.g. because another shard owns them) stay declarations
+      // and must be resolved externally.
+      trace.function->setLinkage(llvm::GlobalValue::ExternalLinkage);
     }
   }
 #pragma clang diagnostic pop
 
-  std::string TraceName(uint64_t addr) override {
-    auto it = name_map.find(addr);
-    std::stringstream ss;
-    ss << "lifted_";
-
-    if (it != name_map.end()) {
-      ss << it->second << "_";
+  // Makes all of `entries` secondary entries of their trace heads.
+  void AddSecondaryEntries(SecondaryEntries const& entries) {
+    for (auto const& head : entries) {
+      auto trace_it = traces.find(head.first);
+      if (trace_it == traces.end()) {
+        continue;
+      }
+      trace_it->second.secondary_entries = head.second;
+      for (auto addr : head.second) {
+        entry_heads.emplace(addr, head.first);
+      }
     }
-    ss << std::hex << addr << "_func";
+  }
+
+  // Lifts jumps through `tables` to switches over their targets.
+  void AddJumpTables(JumpTables const& tables) {
+    jump_tables = &tables;
+  }
 
-    return ss.str();
+  std::string TraceName(uint64_t addr) override {
+    auto trace_it = traces.find(addr);
+    if (trace_it != traces.end() && !trace_it->second.name.empty()) {
+      return trace_it->second.name;
+    }
+    return name_map.TraceName(addr);
   }
 
  protected:
@@ -149,8 +455,19 @@ class SimpleTraceManager : public remill::TraceManager {
                                 llvm::Function *lifted_func) override {
     auto& trace = traces[addr];
     assert(trace.function == lifted_func || trace.function == nullptr);
+    if (trace.name.empty()) {
+      trace.name = name_map.TraceName(addr);
+    }
     trace.function = lifted_func;
     trace.lifted = true;
+
+    // Everything read since the last trace was finished belongs to this one.
+    if (hash_reads) {
+      llvm::MD5::MD5Result result;
+      read_hash.final(result);
+      trace.content_hash = result.digest().str().str();
+      read_hash = llvm::MD5();
+    }
   }
 
   // Get a declaration for a lifted trace. The idea here is that a derived
@@ -176,30 +493,101 @@ class SimpleTraceManager : public remill::TraceManager {
   // NOTE: This is permitted to return a function from an arbitrary module.
   llvm::Function *GetLiftedTraceDefinition(uint64_t addr) override {
     auto trace_it = traces.find(addr);
-    if (trace_it != traces.end() && trace_it->second.lifted) {
+    if (trace_it != traces.end() &&
+        (trace_it->second.lifted || trace_it->second.foreign)) {
       return trace_it->second.function;
     } else {
       return nullptr;
     }
   }
 
+  void ForEachSecondaryEntry(uint64_t trace_addr,
+                             std::function<void(uint64_t)> func) override {
+    auto trace_it = traces.find(trace_addr);
+    if (trace_it == traces.end()) {
+      return;
+    }
+    for (auto addr : trace_it->second.secondary_entries) {
+
+      // The entries are part of the trace as much as its code is.
+      if (hash_reads) {
+        read_hash.update(llvm::ArrayRef<uint8_t>(
+            reinterpret_cast<const uint8_t *>(&addr), sizeof(addr)));
+      }
+      func(addr);
+    }
+  }
+
+  // `__remill_function_call` dispatches to the target, so the marker of
+  // conditional direct calls would run it twice.
+  bool MarkConditionalDirectCalls(void) override {
+    return false;
+  }
+
+  // Targets that are trace heads are tail-called, all others are lifted into
+  // the trace that jumps to them.
+  void ForEachDevirtualizedTarget(
+      const remill::Instruction &inst,
+      std::function<void(uint64_t, remill::DevirtualizedTargetKind)> func)
+      override {
+    if (!jump_tables || !inst.IsIndirectControlFlow()) {
+      return;
+    }
+    auto table_it = jump_tables->find(inst.pc);
+    if (table_it == jump_tables->end()) {
+      return;
+    }
+    for (auto addr : table_it->second.targets) {
+
+      // The table is data, so it isn't covered by the instruction bytes.
+      if (hash_reads) {
+        read_hash.update(llvm::ArrayRef<uint8_t>(
+            reinterpret_cast<const uint8_t *>(&addr), sizeof(addr)));
+      }
+      func(addr, traces.count(addr)
+                     ? remill::DevirtualizedTargetKind::kTraceHead
+                     : remill::DevirtualizedTargetKind::kTraceLocal);
+    }
+  }
+
   // Try to read an executable byte of memory. Returns `true` of the byte
   // at address `addr` is executable and readable, and updates the byte
   // pointed to by `byte` with the read value.
   bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
-    auto byte_it = memory.find(addr);
-    if (byte_it != memory.end()) {
-      *byte = byte_it->second;
-      return true;
-    } else {
-      return false;
+    return TryReadExecutableBytes(addr, byte, 1) == 1;
+  }
+
+  // Read a whole instruction window at once.
+  size_t TryReadExecutableBytes(uint64_t addr, uint8_t *bytes,
+                                size_t num_bytes) override {
+    const auto num_read = image.Read(addr, bytes, num_bytes);
+    if (hash_reads) {
+      read_hash.update(llvm::ArrayRef<uint8_t>(
+          reinterpret_cast<const uint8_t *>(&addr), sizeof(addr)));
+      read_hash.update(llvm::ArrayRef<uint8_t>(bytes, num_read));
     }
+    return num_read;
   }
 
+  // Hash of the bytes read while lifting the current trace.
+  llvm::MD5 read_hash;
+
  public:
   struct Trace {
+    std::string name;
     llvm::Function* function{nullptr};
     bool lifted{false};
+    // Whether this trace head came from the basic blocks file, as opposed to
+    // being discovered while lifting.
+    bool known{false};
+    // Whether this trace is lifted into some other module, and so must only
+    // ever be referenced, never lifted, here.
+    bool foreign{false};
+    // Hash of the addresses and bytes of the instructions that were decoded
+    // while lifting this trace. Only set if `hash_reads` is.
+    std::string content_hash;
+    // Blocks inside of this trace where it can be entered, too.
+    std::vector<uint64_t> secondary_entries;
   };
 
   std::unordered_map<std::uint64_t, llvm::Function*> GetDeclaredTraces() {
@@ -212,62 +600,468 @@ class SimpleTraceManager : public remill::TraceManager {
       return res;
   }
 
-  Memory &memory;
+  CodeImage const& image;
   std::unordered_map<uint64_t, Trace> traces;
-  std::unordered_map<std::uint64_t, std::string> const& name_map;
+  // Trace heads of the secondary entries.
+  std::unordered_map<uint64_t, uint64_t> entry_heads;
+  JumpTables const* jump_tables{nullptr};
+  NameMap const& name_map;
+
+  // Whether to compute `Trace::content_hash` for lifted traces.
+  bool hash_reads{false};
 };
 
-int main(int argc, char** argv) {
-  google::SetVersionString(":shrug:");
-  google::ParseCommandLineFlags(&argc, &argv, true);
-  google::InitGoogleLogging(argv[0]);
+// Call sites in lifted traces that transfer control to other traces. `direct`
+// ones call the lifted function of the target trace, `indirect` ones go
+// through `__remill_function_call` or `__remill_jump`, i.e. the dispatcher.
+struct CallSiteCounts {
+  unsigned direct{0};
+  unsigned indirect{0};
+};
 
-  FLAGS_stderrthreshold = 0;
+static CallSiteCounts CountCallSites(SimpleTraceManager const& manager,
+                                     remill::IntrinsicTable const& intrinsics) {
+  std::unordered_set<llvm::Function*> trace_funcs;
+  for (auto &trace : manager.traces) {
+    trace_funcs.insert(trace.second.function);
+  }
 
-  google::SetCommandLineOption("arch", "x86");
+  CallSiteCounts counts;
+  for (auto &trace : manager.traces) {
+    if (!trace.second.lifted) {
+      continue;
+    }
+    for (auto &inst : llvm::instructions(trace.second.function)) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (!call) {
+        continue;
+      }
+      auto callee = call->getCalledFunction();
+      if (trace_funcs.count(callee)) {
+        counts.direct++;
+      } else if (callee == intrinsics.function_call ||
+                 callee == intrinsics.jump) {
+        counts.indirect++;
+      }
+    }
+  }
+  return counts;
+}
 
-  //addOccurrence
+// Addresses of the traces known to `manager`, and of their secondary entries,
+// which are called through the function of their trace head, by the names of
+// the functions to call.
+static std::map<uint64_t, std::string> TraceNames(
+    SimpleTraceManager const& manager) {
+  std::map<uint64_t, std::string> names;
+  for (auto const& trace : manager.traces) {
+    if (trace.second.function) {
+      names.emplace(trace.first, trace.second.function->getName().str());
+    }
+  }
+  for (auto const& entry : manager.entry_heads) {
+    if (auto name_it = names.find(entry.second); name_it != names.end()) {
+      names.emplace(entry.first, name_it->second);
+    }
+  }
+  return names;
+}
 
-  auto& opts = llvm::cl::getRegisteredOptions();
-  opts["opt-bisect-limit"]->addOccurrence(0, "opt-bisect-limit", "-1");
-  llvm::cl::PrintOptionValues();
+// Returns the hash of the contents of every lifted trace, and of all of the
+// traces that it calls, directly or not. The optimized code of a trace
+// depends on its callees, as the dead store eliminator uses what they read,
+// so it must only be taken from the cache if they didn't change either.
+// Traces that call each other share one hash.
+static std::unordered_map<uint64_t, std::string> DeepContentHashes(
+    SimpleTraceManager const& manager, llvm::Module *module) {
+  std::unordered_map<const llvm::Function *, llvm::StringRef> content_hashes;
+  for (auto const& trace : manager.traces) {
+    if (trace.second.lifted) {
+      content_hashes.emplace(trace.second.function, trace.second.content_hash);
+    }
+  }
 
-  //llvm::cl::
+  // Callees come before their callers.
+  llvm::CallGraph call_graph(*module);
+  std::unordered_map<const llvm::Function *, std::string> deep_hashes;
+  for (auto scc = llvm::scc_begin(&call_graph); !scc.isAtEnd(); ++scc) {
+    std::unordered_set<const llvm::Function *> members;
+    for (auto node : *scc) {
+      members.insert(node->getFunction());
+    }
 
-  if (FLAGS_intrinsics_filename.empty()) {
-    std::cerr << "Please, specify --intrinsics_filename" << std::endl;
-    return EXIT_FAILURE;
+    std::vector<std::string> parts;
+    for (auto node : *scc) {
+      if (auto hash_it = content_hashes.find(node->getFunction());
+          hash_it != content_hashes.end()) {
+        parts.push_back(hash_it->second.str());
+      }
+      for (auto const& callee : *node) {
+        auto callee_func = callee.second->getFunction();
+        if (!members.count(callee_func)) {
+          if (auto hash_it = deep_hashes.find(callee_func);
+              hash_it != deep_hashes.end()) {
+            parts.push_back(hash_it->second);
+          }
+        }
+      }
+    }
+    if (parts.empty()) {
+      continue;
+    }
+
+    std::sort(parts.begin(), parts.end());
+    parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+    llvm::MD5 hash;
+    for (auto const& part : parts) {
+      hash.update(part);
+    }
+    llvm::MD5::MD5Result result;
+    hash.final(result);
+    const auto deep_hash = result.digest().str().str();
+    for (auto func : members) {
+      if (func) {
+        deep_hashes.emplace(func, deep_hash);
+      }
+    }
   }
 
-  llvm::LLVMContext context;
-  auto arch = remill::Arch::Build(&context, remill::OSName::kOSWindows,
-                                  remill::ArchName::kArchX86);
+  std::unordered_map<uint64_t, std::string> hashes;
+  for (auto const& trace : manager.traces) {
+    if (trace.second.lifted) {
+      hashes.emplace(trace.first, deep_hashes[trace.second.function]);
+    }
+  }
+  return hashes;
+}
 
-  std::unique_ptr<llvm::Module> module(remill::LoadArchSemantics(arch));
+// Returns `path` with `suffix` inserted before the file extension.
+static std::string WithSuffix(std::string const& path, std::string const& suffix) {
+  if (suffix.empty()) {
+    return path;
+  }
+  auto dot = path.rfind('.');
+  auto sep = path.find_last_of("/\\");
+  if (dot == std::string::npos || (sep != std::string::npos && dot < sep)) {
+    return path + suffix;
+  }
+  return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+// Saves `module` to --ir_out/--bc_out/--obj_out, with `suffix` inserted
+// before the file extension. The object comes last, as it may change the
+// data layout of `module`.
+static bool StoreOutputModule(llvm::Module *module, std::string const& suffix) {
+  bool ok = true;
+  if (!FLAGS_ir_out.empty()) {
+    auto path = WithSuffix(FLAGS_ir_out, suffix);
+    if (!remill::StoreModuleIRToFile(module, path, true)) {
+      LOG(ERROR) << "Could not save LLVM IR to " << path;
+      ok = false;
+    }
+  }
+  if (!FLAGS_bc_out.empty()) {
+    auto path = WithSuffix(FLAGS_bc_out, suffix);
+    if (!remill::StoreModuleToFile(module, path, true)) {
+      LOG(ERROR) << "Could not save LLVM bitcode to " << path;
+      ok = false;
+    }
+  }
+  if (!FLAGS_obj_out.empty()) {
+    ObjectFileOptions options;
+    options.triple = FLAGS_obj_triple;
+    options.cpu = FLAGS_obj_cpu;
+    options.features = FLAGS_obj_features;
+    CHECK(ParseRelocModel(FLAGS_obj_reloc_model, options.reloc_model));
+
+    std::vector<std::string> paths;
+    auto path = WithSuffix(FLAGS_obj_out, suffix);
+    if (FLAGS_codegen_threads <= 1) {
+      paths.push_back(path);
+    } else {
+      for (auto i = 0u; i < FLAGS_codegen_threads; ++i) {
+        paths.push_back(WithSuffix(path, ".part" + std::to_string(i)));
+      }
+    }
+    if (!EmitObjectFiles(module, options, paths)) {
+      LOG(ERROR) << "Could not save relocatable object to " << path;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Returns the optimization guide of --optimization_profile, whose reports go
+// to --optimization_report with `suffix` appended.
+static remill::OptimizationGuide MakeOptimizationGuide(std::string const& suffix) {
+  auto guide = remill::GetOptimizationGuide(
+      remill::GetOptimizationProfile(FLAGS_optimization_profile));
+  guide.inline_threshold = FLAGS_inline_threshold;
+  if (!FLAGS_optimization_report.empty()) {
+    guide.report_filename = FLAGS_optimization_report + suffix;
+  }
+  return guide;
+}
+
+// Returns `guide` with the report going to a file of its own for `stage`.
+static remill::OptimizationGuide ForStage(remill::OptimizationGuide guide,
+                                          char const* stage) {
+  if (!guide.report_filename.empty()) {
+    guide.report_filename += stage;
+  }
+  return guide;
+}
+
+// Links the intrinsics into `module`, optimizes the result and checks that
+// every used intrinsic has an implementation. Returns the linked module.
+static std::unique_ptr<llvm::Module> FinalizeModule(
+    llvm::LLVMContext &context,
+    std::unique_ptr<llvm::Module> module,
+    remill::OptimizationGuide guide,
+    bool internalize_intrinsics,
+    bool &ok) {
+  auto intrinsics_module
+      = remill::LoadModuleFromFile(&context, FLAGS_intrinsics_filename);
+
+  // Here we do some voodoo magic. We link modules with different target
+  // triples and data layouts. But this is okay, as there are no pointers
+  // inside remill-generated code besides State& and Memory*. They are fine,
+  // as they are using fixed-size types, ensuring no padding in-between
+  // structure elements, and avoiding arch-specific types like long double.
+  module->setDataLayout(intrinsics_module->getDataLayout());
+  module->setTargetTriple(intrinsics_module->getTargetTriple());
+  llvm::Linker::linkModules(*intrinsics_module, std::move(module));
+
+  if (!FLAGS_profile_use.empty()) {
+    LOG(INFO) << "Moved " << PlaceColdTraces(intrinsics_module.get())
+              << " cold functions out of the way";
+  }
+
+  // Every shard gets its own copy of the intrinsics, so they must not clash
+  // when the shards are linked together.
+  if (internalize_intrinsics) {
+    for (auto &fun : intrinsics_module->functions()) {
+      if (!fun.isDeclaration() && fun.getName().startswith("__remill_")) {
+        fun.setLinkage(llvm::GlobalValue::InternalLinkage);
+      }
+    }
+  }
+
+  guide.slp_vectorize = false;
+  guide.loop_vectorize = false;
+  guide.eliminate_dead_stores = false;
+  guide.promote_state_to_locals = false;
+  guide.verify_input = false;
+
+  remill::OptimizeBareModule(intrinsics_module, ForStage(guide, ".final.json"));
+
+  // remove the (now inlined) intrinsics and trace functions, not to pollute the global namespace
+  // also mark all functions with uwtable attribute to allow C++ exceptions to pass through
+  {
+    std::vector<std::string> rmnames;
+    for (auto &fun : intrinsics_module->functions()) {
+      auto nm = fun.getName().str();
+      if (nm.rfind("__remill_", 0) == 0) {
+        rmnames.emplace_back(std::move(nm));
+      }
+
+      fun.addFnAttr(llvm::Attribute::UWTable);
+    }
+    for (auto& nm : rmnames) {
+      auto fun = intrinsics_module->getFunction(nm);
+      if (!fun || fun->uses().empty())
+      {}//fun->eraseFromParent();
+      else {
+        if (!fun->isDeclaration())
+          LOG(WARNING) << "Can't remove " << nm << ", as it has some uses";
+        else {
+          LOG(ERROR) << "Intrinsic " << nm << " does not have implementation";
+          ok = false;
+        }
+      }
+    }
+  }
+
+  return intrinsics_module;
+}
+
+// Lifts and optimizes the traces at `trace_heads` in a semantics module of its
+// own. All of `known_trace_heads` are pre-declared, so that control flow into
+// traces that belong to other shards turns into calls to external functions
+// rather than being lifted again. The `secondary_entries` of the trace heads
+// are lifted into their traces, and entered through them. Jumps through
+// `jump_tables` become switches over the table targets. Far calls to the
+// native functions in `imports` become direct calls. Returns the module
+// holding only the lifted code, and fills `lifted` with the names of all of the defined traces. If
+// `cache` is given, then unchanged traces are taken from it, and all others
+// are added to it. The traces are instrumented with --profile_instrument, or
+// else annotated with the counts of `profile`, if given.
+static std::unique_ptr<llvm::Module> LiftTraces(
+    llvm::LLVMContext &context,
+    bool sharded,
+    TraceCache const* cache,
+    Profile const* profile,
+    CodeImage const& image,
+    std::vector<uint64_t> const& trace_heads,
+    std::vector<uint64_t> const& known_trace_heads,
+    SecondaryEntries const& secondary_entries,
+    JumpTables const& jump_tables,
+    ImportTable const& imports,
+    NameMap const& name_map,
+    std::map<uint64_t, std::string> &lifted,
+    remill::OptimizationGuide const& guide,
+    std::unique_ptr<const remill::Arch> &arch) {
+
+  arch = remill::Arch::Build(&context, remill::OSName::kOSWindows,
+                             remill::ArchName::kArchX86);
+
+  remill::SemanticsLoadGuide semantics_guide;
+  semantics_guide.lazy = FLAGS_lazy_semantics;
+  semantics_guide.verify = FLAGS_verify_semantics;
+  std::unique_ptr<llvm::Module> module(
+      remill::LoadArchSemantics(arch, semantics_guide));
 
   //const auto state_ptr_type = remill::StatePointerType(module.get());
   //const auto mem_ptr_type = remill::MemoryPointerType(module.get());
 
-  Memory memory = LoadCode();
-
-  auto trace_heads = LoadTraceHeadAddresses();
-  auto name_map = LoadNameMap();
+  SimpleTraceManager manager(module.get(), image, known_trace_heads, name_map);
+  manager.AddSecondaryEntries(secondary_entries);
+  manager.AddJumpTables(jump_tables);
+  manager.hash_reads = cache != nullptr;
+  if (sharded) {
+    for (auto &trace : manager.traces) {
+      trace.second.foreign = true;
+    }
+    for (auto addr : trace_heads) {
+      manager.traces[addr].foreign = false;
+    }
+  }
 
-  SimpleTraceManager manager(module.get(), memory, trace_heads, name_map);
   remill::IntrinsicTable intrinsics(module);
-  remill::InstructionLifter inst_lifter(arch, intrinsics);
-  remill::TraceLifter trace_lifter(inst_lifter, manager);
+  remill::InstructionLifter inst_lifter(arch, intrinsics, guide.stats);
+  remill::TraceLifter trace_lifter(inst_lifter, manager, guide.stats);
 
   // Lift all discoverable traces with addresses taken from file
+  const auto num_allocs_before = NumHeapAllocations();
   for (auto addr : trace_heads) {
     trace_lifter.Lift(addr);
   }
 
+  // This includes the allocations of the lifted IR itself.
+  const auto num_allocs = NumHeapAllocations() - num_allocs_before;
+  const auto num_insts = trace_lifter.NumLiftedInstructions();
+  LOG(INFO) << "Lifted " << num_insts << " instructions with " << num_allocs
+            << " heap allocations ("
+            << (num_insts ? static_cast<double>(num_allocs) / num_insts : 0.0)
+            << " per instruction)";
+
+  if (auto num_imports = EmitImportCalls(module.get(), arch.get(), intrinsics,
+                                         imports)) {
+    LOG(INFO) << "Made " << num_imports << " direct calls to native functions";
+  }
+
+  // Before anything else changes the lifted code, so that the branches are
+  // numbered the same way when the profile is used.
+  if (FLAGS_profile_instrument || profile) {
+    std::map<uint64_t, llvm::Function*> lifted_traces;
+    for (auto &trace : manager.traces) {
+      if (trace.second.lifted) {
+        lifted_traces.emplace(trace.first, trace.second.function);
+      }
+    }
+    std::vector<llvm::Function*> funcs;
+    for (auto &trace : lifted_traces) {
+      funcs.push_back(trace.second);
+    }
+
+    if (FLAGS_profile_instrument) {
+      ProfileInstrumenter instrumenter(module.get());
+      for (auto func : funcs) {
+        instrumenter.InstrumentTrace(func);
+      }
+      instrumenter.Finish();
+    } else {
+      ApplyProfile(*profile, funcs, FLAGS_profile_hot_percent);
+    }
+  }
+
+  // Traces that were cached before don't need to be optimized; throw away
+  // their lifted code, and swap in the cached code afterwards. The others
+  // mustn't be inlined into each other, so that each one can be cached on
+  // its own.
+  auto to_optimize = manager.GetDeclaredTraces();
+  std::map<uint64_t, std::unique_ptr<llvm::Module>> cached;
+  std::map<uint64_t, std::string> to_cache;
+  if (cache) {
+    const auto content_hashes = DeepContentHashes(manager, module.get());
+    for (auto &trace : manager.traces) {
+      if (!trace.second.lifted) {
+        continue;
+      }
+      auto key = cache->Key(trace.first, trace.second.name,
+                            content_hashes.at(trace.first));
+      auto cached_module = cache->Load(key, context);
+      auto cached_func = cached_module
+                             ? cached_module->getFunction(trace.second.name)
+                             : nullptr;
+      if (cached_func && !cached_func->isDeclaration()) {
+        trace.second.function->deleteBody();
+        to_optimize.erase(trace.first);
+        cached.emplace(trace.first, std::move(cached_module));
+      } else {
+        trace.second.function->addFnAttr(llvm::Attribute::NoInline);
+        to_cache.emplace(trace.first, std::move(key));
+      }
+    }
+  }
+
+  // Pull in the bodies of the semantics that the lifted code calls before
+  // the optimizer gets to inline them.
+  remill::MaterializeUsedFunctions(module.get(), FLAGS_verify_semantics);
+
   // Optimize the module, but with a particular focus on only the functions
   // that we actually lifted.
-  remill::OptimizationGuide guide = {};
-  guide.eliminate_dead_stores = true;
-  remill::OptimizeModule(arch, module, manager.GetDeclaredTraces(), guide);
+  auto traces_guide = ForStage(guide, ".traces.json");
+  traces_guide.promote_state_to_locals = FLAGS_promote_state;
+  // Traces are cached one by one, so they must not depend on each other. They
+  // are inlined into each other when the final module is optimized.
+  traces_guide.isolate_functions = true;
+  remill::OptimizeModule(arch, module, to_optimize, traces_guide);
+
+  if (cache) {
+    for (auto &entry : to_cache) {
+      auto func = manager.traces[entry.first].function;
+      func->removeFnAttr(llvm::Attribute::NoInline);
+      cache->Store(entry.second, func);
+    }
+
+    // The declarations of cached traces that nothing calls may have been
+    // optimized away.
+    for (auto &entry : cached) {
+      auto &trace = manager.traces[entry.first];
+      auto func = module->getFunction(trace.name);
+      if (!func) {
+        func = llvm::Function::Create(arch->LiftedFunctionType(),
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      trace.name, module.get());
+      }
+      remill::CloneFunctionInto(entry.second->getFunction(trace.name), func);
+      trace.function = func;
+    }
+
+    LOG(INFO) << "Took " << cached.size() << " traces from the cache, "
+              << "optimized " << to_cache.size();
+  }
+
+  // Only now do some of the indirect targets become known.
+  const auto num_devirtualized =
+      EmitDirectCalls(module.get(), {intrinsics.function_call, intrinsics.jump},
+                      TraceNames(manager));
+  const auto call_sites = CountCallSites(manager, intrinsics);
+
+  LOG(INFO) << "Devirtualized " << call_sites.direct << " call sites ("
+            << num_devirtualized << " after optimization); "
+            << call_sites.indirect << " go through the dispatcher";
 
 
   // Create a new module in which we will move all the lifted functions. Prepare
@@ -283,133 +1077,322 @@ int main(int argc, char** argv) {
   // This is a good JITing strategy: optimize the lifted code in the semantics
   // module, move it to a new module, instrument it there, then JIT compile it.
   for (auto &lifted_entry : manager.traces) {
+    if (!lifted_entry.second.lifted) {
+      continue;  // Lifted by another shard.
+    }
     remill::MoveFunctionIntoModule(lifted_entry.second.function, intermediate_module.get());
+    lifted.emplace(lifted_entry.first, manager.TraceName(lifted_entry.first));
+    for (auto addr : lifted_entry.second.secondary_entries) {
+      lifted.emplace(addr, manager.TraceName(lifted_entry.first));
+    }
   }
 
-  auto dispatcher_fun = llvm::Function::Create(arch->LiftedFunctionType(),
-                                                 llvm::GlobalValue::LinkageTypes::ExternalLinkage,
-                                               "uwin_xcute_remill_dispatch_recompiled",
-                                               *intermediate_module);
- {
+  // Traces that weren't trace heads in the basic blocks file may have been
+  // discovered (and lifted) by several shards at once. Their definitions are
+  // identical, so let the linker pick any one of them.
+  if (sharded) {
+    for (auto &lifted_entry : manager.traces) {
+      auto fun = intermediate_module->getFunction(manager.TraceName(lifted_entry.first));
+      if (!fun) {
+        continue;
+      }
+      if (!lifted_entry.second.known) {
+        fun->setLinkage(llvm::GlobalValue::WeakODRLinkage);
+      }
+      fun->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
+  }
 
-    auto args_ptr = dispatcher_fun->arg_begin();
-    auto state = args_ptr++;
-    auto pc = args_ptr++;
-    auto mem = args_ptr++;
+  return intermediate_module;
+}
+
+// Returns what the dispatcher of `traces` gets to know about its targets.
+static DispatchProfile MakeDispatchProfile(
+    Profile const* profile, std::map<uint64_t, std::string> const& traces) {
+  DispatchProfile dispatch_profile;
+  dispatch_profile.instrument = FLAGS_profile_instrument;
+  if (profile) {
+    for (auto const& trace : traces) {
+      if (auto count = profile->Find(DispatchCounterName(trace.first))) {
+        dispatch_profile.counts.emplace(trace.first, *count);
+      }
+    }
+    if (auto count = profile->Find(kUnknownDispatchCounterName)) {
+      dispatch_profile.num_unknown = *count;
+    }
+    dispatch_profile.num_hot_targets = FLAGS_profile_hot_dispatch_targets;
+  }
+  return dispatch_profile;
+}
 
-    std::vector<llvm::Value*> args;
-    args.push_back(state);
-    args.push_back(pc);
-    args.push_back(mem);
+// Lifts all of `trace_heads` in `FLAGS_num_shards` independent modules, each on
+// its own LLVM context, and emits a separate dispatcher module that references
+// all of them.
+static int LiftSharded(
+    DispatcherKind dispatcher_kind,
+    TraceCache const* cache,
+    Profile const* profile,
+    CodeImage const& image,
+    std::vector<uint64_t> const& trace_heads,
+    SecondaryEntries const& secondary_entries,
+    JumpTables const& jump_tables,
+    ImportTable const& imports,
+    NameMap const& name_map) {
+
+  // Keep neighbouring trace heads together; they are likely to call each
+  // other, and traces discovered while lifting will be shared less often.
+  auto sorted_heads = trace_heads;
+  std::sort(sorted_heads.begin(), sorted_heads.end());
+  sorted_heads.erase(std::unique(sorted_heads.begin(), sorted_heads.end()),
+                     sorted_heads.end());
+
+  const size_t num_shards = std::max<size_t>(
+      1u, std::min<size_t>(FLAGS_num_shards, sorted_heads.size()));
+  const size_t shard_size = (sorted_heads.size() + num_shards - 1) / num_shards;
+
+  size_t num_threads = FLAGS_num_threads;
+  if (!num_threads) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min(num_threads, num_shards);
 
-    llvm::IRBuilder<> builder(context);
+  // The shards are optimized in parallel already, so split the hardware
+  // threads between them.
+  if (!FLAGS_optimizer_num_threads) {
+    FLAGS_optimizer_num_threads = static_cast<uint32_t>(std::max<size_t>(
+        1u, std::thread::hardware_concurrency() / num_threads));
+  }
 
-    auto block = llvm::BasicBlock::Create(context, "entry", dispatcher_fun);
+  // Every shard can call into the known trace heads of the other shards.
+  std::map<uint64_t, std::string> known_traces;
+  for (auto addr : sorted_heads) {
+    known_traces.emplace(addr, name_map.TraceName(addr));
+  }
+  for (auto const& head : secondary_entries) {
+    for (auto addr : head.second) {
+      known_traces.emplace(addr, name_map.TraceName(head.first));
+    }
+  }
 
+  std::mutex lifted_lock;
+  std::map<uint64_t, std::string> all_lifted;
+  remill::LiftStats all_stats;
+  std::atomic<size_t> next_shard{0};
+  std::atomic<bool> all_ok{true};
+
+  auto worker = [&] (void) {
+    for (size_t shard = next_shard++; shard < num_shards; shard = next_shard++) {
+      auto begin = sorted_heads.begin() + std::min(shard * shard_size, sorted_heads.size());
+      auto end = sorted_heads.begin() + std::min((shard + 1) * shard_size, sorted_heads.size());
+      std::vector<uint64_t> shard_heads(begin, end);
+
+      LOG(INFO) << "Lifting shard " << shard << " with " << shard_heads.size()
+                << " trace heads";
+
+      llvm::LLVMContext context;
+      std::unique_ptr<const remill::Arch> arch;
+      std::map<uint64_t, std::string> lifted;
+      auto guide = MakeOptimizationGuide(".shard" + std::to_string(shard));
+      remill::LiftStats stats;
+      if (!FLAGS_lift_stats.empty()) {
+        guide.stats = &stats;
+      }
 
-    auto abort = llvm::BasicBlock::Create(context, "abort");
-    {
-      builder.SetInsertPoint(abort);
+      auto module = LiftTraces(context, true /* sharded */, cache, profile, image, shard_heads,
+                               sorted_heads, secondary_entries, jump_tables,
+                               imports, name_map, lifted, guide, arch);
+
+      bool ok = true;
+      auto final_module = FinalizeModule(context, std::move(module), guide,
+                                         true /* internalize_intrinsics */, ok);
+      if (FLAGS_dispatcher_direct_calls) {
+        auto targets = known_traces;
+        targets.insert(lifted.begin(), lifted.end());
+        auto num_direct = EmitDirectCalls(
+            final_module.get(),
+            {final_module->getFunction(kRuntimeDispatcherName)}, targets);
+        LOG(INFO) << "Shard " << shard << ": made " << num_direct
+                  << " direct calls to lifted traces";
+      }
 
-      auto unk = intermediate_module->getOrInsertFunction("uwin_xcute_remill_dispatch_unknown", arch->LiftedFunctionType());
+      ok = StoreOutputModule(final_module.get(), ".shard" + std::to_string(shard)) && ok;
+      if (!ok) {
+        all_ok = false;
+      }
 
-      builder.CreateRet(builder.CreateCall(unk, args));
+      std::lock_guard<std::mutex> locker(lifted_lock);
+      all_lifted.insert(lifted.begin(), lifted.end());
+      all_stats.Merge(stats);
     }
+  };
 
-    {
-      builder.SetInsertPoint(block);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
 
-      auto sw = builder.CreateSwitch(pc, abort, manager.traces.size());
-      for (auto bb : manager.traces) {
-        std::stringstream hexbbss;
-        hexbbss << std::hex << bb.first;
-        std::string hexbb = hexbbss.str();
+  // The dispatcher only references the shards, so it doesn't need any of the
+  // semantics or intrinsics.
+  llvm::LLVMContext context;
+  auto arch = remill::Arch::Build(&context, remill::OSName::kOSWindows,
+                                  remill::ArchName::kArchX86);
+  auto dispatch_module = std::make_unique<llvm::Module>("lifted_dispatch", context);
+  auto intrinsics_module
+      = remill::LoadModuleFromFile(&context, FLAGS_intrinsics_filename);
 
-        auto call = llvm::BasicBlock
-        ::Create(context,
-                 "call_" + hexbb);
+  EmitDispatcher(dispatch_module.get(), arch->LiftedFunctionType(),
+                 all_lifted, dispatcher_kind, false /* internalize_traces */,
+                 MakeDispatchProfile(profile, all_lifted));
+  for (auto &fun : dispatch_module->functions()) {
+    if (fun.getName().startswith("lifted_")) {
+      fun.setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
+    fun.addFnAttr(llvm::Attribute::UWTable);
+  }
+  dispatch_module->setDataLayout(intrinsics_module->getDataLayout());
+  dispatch_module->setTargetTriple(intrinsics_module->getTargetTriple());
 
-        builder.SetInsertPoint(call);
+  if (!StoreOutputModule(dispatch_module.get(), ".dispatch")) {
+    all_ok = false;
+  }
 
-        auto fun = intermediate_module->getFunction(manager.TraceName(bb.first));
-                          //arch->LiftedFunctionType());
-        auto newmem = builder.CreateCall(fun, args);
+  if (!FLAGS_lift_stats.empty() && !all_stats.WriteJSON(FLAGS_lift_stats)) {
+    all_ok = false;
+  }
 
-        // do not expose the sub_* functions
-        // TODO: do it only when compiling release?
-        // TODO: is Private any better than InternalLinkage? Does it give any optimization chances?
-        fun->setLinkage(llvm::GlobalValue::InternalLinkage);
+  return all_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        builder.CreateRet(newmem);
+int main(int argc, char** argv) {
+  google::SetVersionString(":shrug:");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
 
-        call->insertInto(dispatcher_fun);
+  FLAGS_stderrthreshold = 0;
 
-        sw->addCase(builder.getInt32(bb.first), call);
-      }
-    }
-    abort->insertInto(dispatcher_fun);
+  google::SetCommandLineOption("arch", "x86");
+
+  //addOccurrence
+
+  auto& opts = llvm::cl::getRegisteredOptions();
+  opts["opt-bisect-limit"]->addOccurrence(0, "opt-bisect-limit", "-1");
+  llvm::cl::PrintOptionValues();
+
+  //llvm::cl::
+
+  if (FLAGS_intrinsics_filename.empty()) {
+    std::cerr << "Please, specify --intrinsics_filename" << std::endl;
+    return EXIT_FAILURE;
   }
 
-  auto intrinsics_module
-      = remill::LoadModuleFromFile(&context, FLAGS_intrinsics_filename);
+  DispatcherKind dispatcher_kind;
+  if (!ParseDispatcherKind(FLAGS_dispatcher, dispatcher_kind)) {
+    std::cerr << "Unknown --dispatcher " << FLAGS_dispatcher << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  // Here we do some voodoo magic. We link modules with different target
-  // triples and data layouts. But this is okay, as there are no pointers
-  // inside remill-generated code besides State& and Memory*. They are fine,
-  // as they are using fixed-size types, ensuring no padding in-between
-  // structure elements, and avoiding arch-specific types like long double.
-  intermediate_module->setDataLayout(intrinsics_module->getDataLayout());
-  intermediate_module->setTargetTriple(intrinsics_module->getTargetTriple());
-  llvm::Linker::linkModules(*intrinsics_module, std::move(intermediate_module));
+  llvm::Reloc::Model reloc_model;
+  if (!ParseRelocModel(FLAGS_obj_reloc_model, reloc_model)) {
+    std::cerr << "Unknown --obj_reloc_model " << FLAGS_obj_reloc_model
+              << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  guide.slp_vectorize = false;
-  guide.loop_vectorize = false;
-  guide.eliminate_dead_stores = false;
-  guide.verify_input = false;
+  if (remill::GetOptimizationProfile(FLAGS_optimization_profile) ==
+      remill::kOptimizationInvalid) {
+    std::cerr << "Unknown --optimization_profile "
+              << FLAGS_optimization_profile << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  remill::OptimizeBareModule(intrinsics_module, guide);
+  if (FLAGS_trace_heads != "blocks" && FLAGS_trace_heads != "functions") {
+    std::cerr << "Unknown --trace_heads " << FLAGS_trace_heads << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  int ret = EXIT_SUCCESS;
+  if (FLAGS_trace_heads == "functions" && !HaveEntryPoints()) {
+    std::cerr << "--trace_heads=functions needs --entry_points_filename or "
+              << "--exe_filename" << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  // remove the (now inlined) intrinsics and trace functions, not to pollute the global namespace
-  // also mark all functions with uwtable attribute to allow C++ exceptions to pass through
-  {
-    std::vector<std::string> rmnames;
-    for (auto &fun : intrinsics_module->functions()) {
-      auto nm = fun.getName().str();
-      if (nm.rfind("__remill_", 0) == 0) {
-        rmnames.emplace_back(std::move(nm));
-      }
+  if (FLAGS_profile_instrument && !FLAGS_profile_use.empty()) {
+    std::cerr << "--profile_instrument and --profile_use are mutually exclusive"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
 
-      fun.addFnAttr(llvm::Attribute::UWTable);
-    }
-    for (auto& nm : rmnames) {
-      auto fun = intrinsics_module->getFunction(nm);
-      if (fun->uses().empty())
-      {}//fun->eraseFromParent();
-      else {
-        if (!fun->isDeclaration())
-          LOG(WARNING) << "Can't remove " << nm << ", as it has some uses";
-        else {
-          LOG(ERROR) << "Intrinsic " << nm << " does not have implementation";
-          ret = EXIT_FAILURE;
-        }
-      }
-    }
+  Profile profile;
+  Profile const* profile_ptr = nullptr;
+  if (!FLAGS_profile_use.empty()) {
+    profile.Load(FLAGS_profile_use);
+    profile_ptr = &profile;
   }
 
+  PEImage pe;
+  CodeImage image = LoadCode(pe);
 
-  if (!FLAGS_ir_out.empty()) {
-    if (!remill::StoreModuleIRToFile(intrinsics_module.get(), FLAGS_ir_out, true)) {
-      LOG(ERROR) << "Could not save LLVM IR to " << FLAGS_ir_out;
-      ret = EXIT_FAILURE;
-    }
+  SecondaryEntries secondary_entries;
+  JumpTables jump_tables;
+  auto trace_heads =
+      LoadTraceHeadAddresses(image, pe, secondary_entries, jump_tables);
+  auto imports = LoadImportTable();
+  auto name_map = LoadNameMap();
+  auto trace_cache = OpenTraceCache(argv[0]);
+
+  if (FLAGS_num_shards > 1) {
+    return LiftSharded(dispatcher_kind, trace_cache.get(), profile_ptr, image,
+                       trace_heads, secondary_entries, jump_tables, imports,
+                       name_map);
   }
-  if (!FLAGS_bc_out.empty()) {
-    if (!remill::StoreModuleToFile(intrinsics_module.get(), FLAGS_bc_out, true)) {
-      LOG(ERROR) << "Could not save LLVM bitcode to " << FLAGS_bc_out;
-      ret = EXIT_FAILURE;
-    }
+
+  llvm::LLVMContext context;
+  std::unique_ptr<const remill::Arch> arch;
+  std::map<uint64_t, std::string> lifted;
+  auto guide = MakeOptimizationGuide("");
+  remill::LiftStats stats;
+  if (!FLAGS_lift_stats.empty()) {
+    guide.stats = &stats;
+  }
+
+  auto intermediate_module = LiftTraces(context, false /* sharded */,
+                                        trace_cache.get(), profile_ptr, image,
+                                        trace_heads, trace_heads,
+                                        secondary_entries, jump_tables,
+                                        imports, name_map, lifted, guide,
+                                        arch);
+
+  EmitDispatcher(intermediate_module.get(), arch->LiftedFunctionType(),
+                 lifted, dispatcher_kind, true /* internalize_traces */,
+                 MakeDispatchProfile(profile_ptr, lifted));
+
+  int ret = EXIT_SUCCESS;
+  bool ok = true;
+
+  auto final_module = FinalizeModule(context, std::move(intermediate_module),
+                                     guide, false /* internalize_intrinsics */,
+                                     ok);
+  if (!ok) {
+    ret = EXIT_FAILURE;
+  }
+
+  if (FLAGS_dispatcher_direct_calls) {
+    auto num_direct = EmitDirectCalls(
+        final_module.get(), {final_module->getFunction(kRuntimeDispatcherName)},
+        lifted);
+    LOG(INFO) << "Made " << num_direct << " direct calls to lifted traces";
+  }
+
+  if (!StoreOutputModule(final_module.get(), "")) {
+    ret = EXIT_FAILURE;
+  }
+
+  if (!FLAGS_lift_stats.empty() && !stats.WriteJSON(FLAGS_lift_stats)) {
+    ret = EXIT_FAILURE;
   }
 
   return ret;
@@ -0,0 +1,73 @@
+#include "NameMap.h"
+
+#include <llvm/ADT/StringExtras.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+void NameMap::Load(const std::string &filename) {
+  std::ifstream f(filename, std::ios_base::in);
+  if (!f.is_open()) {
+    throw std::runtime_error("Can't open name map file");
+  }
+
+  std::uint64_t addr_lo, addr_hi;
+  std::string name;
+  while (f >> addr_lo >> addr_hi >> name) {
+    Add(addr_lo, addr_hi, name);
+  }
+}
+
+void NameMap::Add(uint64_t addr_lo, uint64_t addr_hi, const std::string &name) {
+  if (addr_lo >= addr_hi) {
+    return;
+  }
+
+  // Name maps are usually sorted already, so this tends to append.
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), addr_lo,
+      [](uint64_t addr, const Range &range) { return addr < range.addr_lo; });
+  it = ranges.insert(it, {addr_lo, addr_hi, name, "lifted_" + name + "_",
+                          ranges.size(), 0});
+
+  uint64_t max_addr_hi = it == ranges.begin() ? 0 : std::prev(it)->max_addr_hi;
+  for (; it != ranges.end(); ++it) {
+    max_addr_hi = std::max(max_addr_hi, it->addr_hi);
+    it->max_addr_hi = max_addr_hi;
+  }
+}
+
+// Like the map from every byte to the first function covering it that this
+// replaces, the range added first wins. Walks back from the last range
+// starting at or before `addr` until no earlier range reaches `addr`.
+const NameMap::Range *NameMap::FindRange(uint64_t addr) const {
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), addr,
+      [](uint64_t addr, const Range &range) { return addr < range.addr_lo; });
+
+  const Range *found = nullptr;
+  while (it != ranges.begin()) {
+    --it;
+    if (it->max_addr_hi <= addr) {
+      break;
+    }
+    if (addr < it->addr_hi && (!found || it->order < found->order)) {
+      found = &*it;
+    }
+  }
+  return found;
+}
+
+const std::string *NameMap::Find(uint64_t addr) const {
+  auto range = FindRange(addr);
+  return range ? &(range->name) : nullptr;
+}
+
+std::string NameMap::TraceName(uint64_t addr) const {
+  auto range = FindRange(addr);
+  std::string name = range ? range->trace_prefix : "lifted_";
+  name += llvm::utohexstr(addr, true /* LowerCase */);
+  name += "_func";
+  return name;
+}
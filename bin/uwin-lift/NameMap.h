@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Maps address ranges of guest functions to their names, and formats the
+// names of lifted traces. Takes memory proportional to the number of ranges,
+// not to the number of bytes they cover.
+class NameMap {
+ public:
+  // Load `addr_lo addr_hi name` triples from `filename`.
+  void Load(const std::string &filename);
+
+  // Add the function `name` covering `[addr_lo, addr_hi)`.
+  void Add(uint64_t addr_lo, uint64_t addr_hi, const std::string &name);
+
+  // Returns the name of the function containing `addr`, or `nullptr`. If
+  // several functions contain it, e.g. because they are nested, then the one
+  // that was added first wins.
+  const std::string *Find(uint64_t addr) const;
+
+  // Returns the name of the lifted function for the trace at `addr`, i.e.
+  // `lifted_<function>_<hex addr>_func`, or `lifted_<hex addr>_func` if `addr`
+  // isn't within any known function.
+  std::string TraceName(uint64_t addr) const;
+
+ private:
+  struct Range {
+    uint64_t addr_lo;
+    uint64_t addr_hi;
+    std::string name;
+
+    // Pre-formatted `lifted_<name>_` prefix of trace names.
+    std::string trace_prefix;
+
+    // Position in the order that the ranges were added in.
+    size_t order;
+
+    // Largest `addr_hi` of this range and of all ranges before it, which
+    // bounds the search for ranges containing an address.
+    uint64_t max_addr_hi;
+  };
+
+  const Range *FindRange(uint64_t addr) const;
+
+  // Sorted by `addr_lo`, then by `order`. Ranges may overlap.
+  std::vector<Range> ranges;
+};
@@ -0,0 +1,125 @@
+#include "ObjectFile.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetOptions.h>
+#include <remill/BC/Compat/TargetMachine.h>
+#include <remill/BC/Compat/ToolOutputFile.h>
+
+#include <memory>
+#include <mutex>
+
+bool ParseRelocModel(std::string_view name, llvm::Reloc::Model &model) {
+  if (name == "pic") {
+    model = llvm::Reloc::PIC_;
+  } else if (name == "static") {
+    model = llvm::Reloc::Static;
+  } else if (name == "dynamic-no-pic") {
+    model = llvm::Reloc::DynamicNoPIC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// Shards emit their objects at the same time.
+static void InitializeTargets(void) {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargets();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmPrinters();
+  });
+}
+
+}  // namespace
+
+bool EmitObjectFiles(llvm::Module *module, const ObjectFileOptions &options,
+                     const std::vector<std::string> &paths) {
+  CHECK(!paths.empty());
+  InitializeTargets();
+
+  auto triple = options.triple;
+  if (triple.empty()) {
+    triple = module->getTargetTriple();
+  }
+  if (triple.empty()) {
+    triple = llvm::sys::getDefaultTargetTriple();
+  }
+  triple = llvm::Triple::normalize(triple);
+  std::string error;
+  auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    LOG(ERROR) << "Unknown target " << triple << ": " << error;
+    return false;
+  }
+
+  // The module is already optimized, so this only needs to pick good
+  // instructions.
+  auto create_target_machine = [&](void) {
+    return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+        triple, options.cpu, options.features, llvm::TargetOptions(),
+        options.reloc_model, llvm::None, llvm::CodeGenOpt::Aggressive));
+  };
+  auto target_machine = create_target_machine();
+  if (!target_machine) {
+    LOG(ERROR) << "Could not create a target machine for " << triple;
+    return false;
+  }
+
+  module->setTargetTriple(triple);
+  module->setDataLayout(target_machine->createDataLayout());
+  if (options.reloc_model == llvm::Reloc::PIC_ &&
+      module->getPICLevel() == llvm::PICLevel::NotPIC) {
+    module->setPICLevel(llvm::PICLevel::BigPIC);
+  }
+
+  std::vector<std::unique_ptr<llvm::ToolOutputFile>> files;
+  std::vector<llvm::raw_pwrite_stream *> outs;
+  for (const auto &path : paths) {
+    std::error_code ec;
+    files.emplace_back(std::make_unique<llvm::ToolOutputFile>(
+        path, ec, llvm::sys::fs::OF_None));
+    if (ec) {
+      LOG(ERROR) << "Could not open object file " << path << ": "
+                 << ec.message();
+      return false;
+    }
+    outs.push_back(&files.back()->os());
+  }
+
+  if (outs.size() == 1) {
+    llvm::legacy::PassManager pass_manager;
+    if (target_machine->addPassesToEmitFile(pass_manager, *outs.front(),
+                                            nullptr, llvm::CGFT_ObjectFile)) {
+      LOG(ERROR) << "Target " << triple << " can't emit object files";
+      return false;
+    }
+    pass_manager.run(*module);
+  } else {
+    remill::compat::llvm::SplitCodeGen(*module, outs, create_target_machine);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < files.size(); ++i) {
+    auto &os = files[i]->os();
+    os.close();
+    if (os.has_error()) {
+      LOG(ERROR) << "Could not save object file " << paths[i] << ": "
+                 << os.error().message();
+      os.clear_error();
+      ok = false;
+    } else {
+      files[i]->keep();
+    }
+  }
+  return ok;
+}
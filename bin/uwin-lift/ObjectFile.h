@@ -0,0 +1,37 @@
+#pragma once
+
+#include <llvm/Support/CodeGen.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llvm {
+class Module;
+}  // namespace llvm
+
+// How `EmitObjectFiles` compiles a module.
+struct ObjectFileOptions {
+  // An empty triple means the one of the module, i.e. of the intrinsics, or
+  // else the host, and an empty CPU the generic one of the target. Functions that name their own
+  // CPU and features, e.g. the intrinsics, keep them.
+  std::string triple;
+  std::string cpu;
+
+  // Comma-separated, e.g. `+avx2,-sse4a`.
+  std::string features;
+
+  llvm::Reloc::Model reloc_model = llvm::Reloc::PIC_;
+};
+
+// Parses `pic`, `static` or `dynamic-no-pic`.
+bool ParseRelocModel(std::string_view name, llvm::Reloc::Model &model);
+
+// Compiles the already optimized `module` into relocatable object files. If
+// there is more than one of `paths`, the module is split into that many
+// parts, which are compiled on threads of their own. Returns `false` if
+// anything went wrong, after logging why.
+//
+// The module gets the triple and data layout of the target.
+bool EmitObjectFiles(llvm::Module *module, const ObjectFileOptions &options,
+                     const std::vector<std::string> &paths);
@@ -0,0 +1,260 @@
+#include "PEImage.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+namespace {
+
+static constexpr uint16_t kDOSMagic = 0x5a4d;  // `MZ`.
+static constexpr uint32_t kPESignature = 0x4550;  // `PE\0\0`.
+static constexpr uint16_t kPE32Magic = 0x10b;
+static constexpr uint16_t kMachineI386 = 0x14c;
+
+static constexpr uint32_t kExportDirectory = 0;
+static constexpr uint32_t kImportDirectory = 1;
+static constexpr uint32_t kBaseRelocationDirectory = 5;
+
+static constexpr uint32_t kSectionMemExecute = 0x20000000;
+static constexpr uint32_t kSectionMemRead = 0x40000000;
+static constexpr uint32_t kSectionMemWrite = 0x80000000;
+
+static constexpr uint16_t kRelocationAbsolute = 0;  // Padding.
+static constexpr uint16_t kRelocationHighLow = 3;
+
+static constexpr uint32_t kImportByOrdinal = 0x80000000;
+
+}  // namespace
+
+void PEImage::Load(const std::string &filename) {
+  auto fd_or_err = llvm::sys::fs::openNativeFileForRead(filename);
+  if (!fd_or_err) {
+    llvm::consumeError(fd_or_err.takeError());
+    throw std::runtime_error("Can't open executable " + filename);
+  }
+  auto fd = *fd_or_err;
+
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(fd, status) || !status.getSize()) {
+    llvm::sys::fs::closeFile(fd);
+    throw std::runtime_error("Can't stat executable " + filename);
+  }
+
+  std::error_code ec;
+  region = std::make_unique<llvm::sys::fs::mapped_file_region>(
+      fd, llvm::sys::fs::mapped_file_region::readonly, status.getSize(), 0, ec);
+  llvm::sys::fs::closeFile(fd);
+  if (ec) {
+    throw std::runtime_error("Can't map executable " + filename + ": " +
+                             ec.message());
+  }
+  file = llvm::ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(region->const_data()), region->size());
+
+  if (ReadU16(0) != kDOSMagic) {
+    throw std::runtime_error(filename + " is not an executable");
+  }
+  const uint64_t pe_offset = ReadU32(0x3c);
+  if (ReadU32(pe_offset) != kPESignature) {
+    throw std::runtime_error(filename + " is not a PE executable");
+  }
+
+  // COFF file header.
+  const auto coff_offset = pe_offset + 4;
+  const auto machine = ReadU16(coff_offset);
+  const auto num_sections = ReadU16(coff_offset + 2);
+  const auto optional_header_size = ReadU16(coff_offset + 16);
+
+  // Optional header.
+  const auto opt_offset = coff_offset + 20;
+  if (machine != kMachineI386 || ReadU16(opt_offset) != kPE32Magic) {
+    throw std::runtime_error(filename + " is not a PE32 executable");
+  }
+  image_base = ReadU32(opt_offset + 28);
+  const auto entry_rva = ReadU32(opt_offset + 16);
+  const auto num_directories = ReadU32(opt_offset + 92);
+  auto directory = [&](uint32_t index, uint32_t &rva, uint32_t &size) {
+    rva = size = 0;
+    if (index < num_directories &&
+        96u + (index + 1u) * 8u <= optional_header_size) {
+      rva = ReadU32(opt_offset + 96 + index * 8);
+      size = ReadU32(opt_offset + 96 + index * 8 + 4);
+    }
+    return rva != 0 && size != 0;
+  };
+
+  // Section table.
+  const auto sections_offset = opt_offset + optional_header_size;
+  for (uint16_t i = 0; i < num_sections; ++i) {
+    const auto header_offset = sections_offset + i * 40u;
+    SectionHeader header;
+    header.virtual_size = ReadU32(header_offset + 8);
+    header.virtual_address = ReadU32(header_offset + 12);
+    header.raw_size = ReadU32(header_offset + 16);
+    header.raw_offset = ReadU32(header_offset + 20);
+    const auto characteristics = ReadU32(header_offset + 36);
+
+    // Some linkers leave the virtual size at zero.
+    if (!header.virtual_size) {
+      header.virtual_size = header.raw_size;
+    }
+    if (uint64_t(header.raw_offset) + header.raw_size > file.size()) {
+      throw std::runtime_error("Section " + std::to_string(i) + " of " +
+                               filename + " is truncated");
+    }
+    headers.push_back(header);
+
+    Section section;
+    auto name = file.slice(header_offset, 8);
+    section.name.assign(name.begin(),
+                        std::find(name.begin(), name.end(), uint8_t(0)));
+    section.address = image_base + header.virtual_address;
+    section.virtual_size = header.virtual_size;
+    section.data = file.slice(header.raw_offset,
+                              std::min(header.raw_size, header.virtual_size));
+    section.is_readable = characteristics & kSectionMemRead;
+    section.is_writable = characteristics & kSectionMemWrite;
+    section.is_executable = characteristics & kSectionMemExecute;
+    sections.push_back(std::move(section));
+  }
+  std::sort(sections.begin(), sections.end(),
+            [](const Section &a, const Section &b) {
+              return a.address < b.address;
+            });
+
+  entry_point = entry_rva ? image_base + entry_rva : 0;
+
+  uint32_t rva, size;
+  if (directory(kExportDirectory, rva, size)) {
+    LoadExports(rva, size);
+  }
+  if (directory(kImportDirectory, rva, size)) {
+    LoadImports(rva);
+  }
+  if (directory(kBaseRelocationDirectory, rva, size)) {
+    LoadRelocations(rva, size);
+  }
+}
+
+uint16_t PEImage::ReadU16(uint64_t offset) const {
+  if (offset + 2 > file.size()) {
+    throw std::runtime_error("Truncated executable");
+  }
+  return uint16_t(file[offset]) | (uint16_t(file[offset + 1]) << 8);
+}
+
+uint32_t PEImage::ReadU32(uint64_t offset) const {
+  return uint32_t(ReadU16(offset)) | (uint32_t(ReadU16(offset + 2)) << 16);
+}
+
+uint64_t PEImage::RVAToOffset(uint32_t rva) const {
+  for (const auto &header : headers) {
+    if (rva >= header.virtual_address &&
+        rva - header.virtual_address < header.raw_size) {
+      return header.raw_offset + (rva - header.virtual_address);
+    }
+  }
+  throw std::runtime_error("Address " + std::to_string(image_base + rva) +
+                           " isn't stored in the executable");
+}
+
+std::string PEImage::ReadString(uint32_t rva) const {
+  const auto offset = RVAToOffset(rva);
+  auto bytes = file.drop_front(offset);
+  return std::string(bytes.begin(),
+                     std::find(bytes.begin(), bytes.end(), uint8_t(0)));
+}
+
+void PEImage::LoadExports(uint32_t rva, uint32_t size) {
+  const auto offset = RVAToOffset(rva);
+  const auto ordinal_base = ReadU32(offset + 16);
+  const auto num_functions = ReadU32(offset + 20);
+  const auto num_names = ReadU32(offset + 24);
+  const auto functions_rva = ReadU32(offset + 28);
+  const auto names_rva = ReadU32(offset + 32);
+  const auto ordinals_rva = ReadU32(offset + 36);
+
+  std::vector<std::string> names(num_functions);
+  for (uint32_t i = 0; i < num_names; ++i) {
+    const auto index = ReadU16(RVAToOffset(ordinals_rva + i * 2));
+    if (index < num_functions) {
+      names[index] = ReadString(ReadU32(RVAToOffset(names_rva + i * 4)));
+    }
+  }
+
+  for (uint32_t i = 0; i < num_functions; ++i) {
+    const auto func_rva = ReadU32(RVAToOffset(functions_rva + i * 4));
+
+    // Unused slots, and forwarders to other DLLs, whose "addresses" are the
+    // names of what they forward to.
+    if (!func_rva || (func_rva >= rva && func_rva - rva < size)) {
+      continue;
+    }
+    exports.push_back({std::move(names[i]), ordinal_base + i,
+                       image_base + func_rva});
+  }
+}
+
+void PEImage::LoadImports(uint32_t rva) {
+  for (auto desc_offset = RVAToOffset(rva);; desc_offset += 20) {
+    const auto lookup_rva = ReadU32(desc_offset);
+    const auto name_rva = ReadU32(desc_offset + 12);
+    const auto iat_rva = ReadU32(desc_offset + 16);
+    if (!name_rva && !iat_rva) {
+      break;
+    }
+
+    // The import lookup table is optional; the address table has the same
+    // contents in the file.
+    const auto dll = ReadString(name_rva);
+    const auto table_rva = lookup_rva ? lookup_rva : iat_rva;
+    for (uint32_t i = 0;; ++i) {
+      const auto entry = ReadU32(RVAToOffset(table_rva + i * 4));
+      if (!entry) {
+        break;
+      }
+      Import import;
+      import.dll = dll;
+      import.iat_address = image_base + iat_rva + i * 4;
+      if (entry & kImportByOrdinal) {
+        import.ordinal = entry & 0xffff;
+      } else {
+        import.ordinal = ReadU16(RVAToOffset(entry));  // The hint.
+        import.name = ReadString(entry + 2);
+      }
+      imports.push_back(std::move(import));
+    }
+  }
+}
+
+void PEImage::LoadRelocations(uint32_t rva, uint32_t size) {
+  const auto offset = RVAToOffset(rva);
+  std::map<unsigned, uint64_t> num_skipped;
+  for (uint64_t block = 0; block + 8 <= size;) {
+    const auto page_rva = ReadU32(offset + block);
+    const auto block_size = ReadU32(offset + block + 4);
+    if (block_size < 8) {
+      break;
+    }
+    for (uint64_t i = 8; i + 2 <= block_size; i += 2) {
+      const auto entry = ReadU16(offset + block + i);
+      const auto type = entry >> 12;
+      if (type == kRelocationHighLow) {
+        relocations.push_back(image_base + page_rva + (entry & 0xfff));
+      } else if (type != kRelocationAbsolute) {
+        ++num_skipped[type];
+      }
+    }
+    block += block_size;
+  }
+  std::sort(relocations.begin(), relocations.end());
+
+  // Relocations only seed discovery, so the others, e.g. of halves of
+  // addresses, are left out rather than failing the whole lift.
+  for (auto [type, count] : num_skipped) {
+    LOG(WARNING) << "Skipped " << count << " relocations of unsupported type "
+                 << type;
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Memory-mapped PE32 executable. Exposes its sections at the addresses they
+// are loaded at, with their protections, and its imports, exports and base
+// relocations. The sections point into the mapping, so nothing is copied.
+class PEImage {
+ public:
+  struct Section {
+    std::string name;
+    uint64_t address;
+    uint64_t virtual_size;
+
+    // The initialized part of the section, i.e. the bytes stored in the file.
+    // The rest of `virtual_size` is zeroed when loading.
+    llvm::ArrayRef<uint8_t> data;
+
+    bool is_readable;
+    bool is_writable;
+    bool is_executable;
+  };
+
+  struct Export {
+    // Empty if the function is only exported by ordinal.
+    std::string name;
+    uint32_t ordinal;
+    uint64_t address;
+  };
+
+  struct Import {
+    std::string dll;
+
+    // Empty if the function is imported by ordinal.
+    std::string name;
+    uint32_t ordinal;
+
+    // Address of the import address table entry that the loader fills in.
+    uint64_t iat_address;
+  };
+
+  // Map the file `filename` and parse its headers and tables.
+  void Load(const std::string &filename);
+
+  uint64_t image_base{0};
+  uint64_t entry_point{0};
+
+  // Sorted by address.
+  std::vector<Section> sections;
+  std::vector<Export> exports;
+  std::vector<Import> imports;
+
+  // Sorted addresses of the absolute 32-bit pointers that the loader relocates
+  // if the image isn't loaded at `image_base`. Other types of relocations are
+  // skipped with a warning.
+  std::vector<uint64_t> relocations;
+
+ private:
+  uint16_t ReadU16(uint64_t offset) const;
+  uint32_t ReadU32(uint64_t offset) const;
+
+  // Returns the file offset of `rva`, or throws if it isn't stored in the file.
+  uint64_t RVAToOffset(uint32_t rva) const;
+
+  std::string ReadString(uint32_t rva) const;
+
+  void LoadExports(uint32_t rva, uint32_t size);
+  void LoadImports(uint32_t rva);
+  void LoadRelocations(uint32_t rva, uint32_t size);
+
+  struct SectionHeader {
+    uint32_t virtual_address;
+    uint32_t virtual_size;
+    uint32_t raw_offset;
+    uint32_t raw_size;
+  };
+  std::vector<SectionHeader> headers;
+
+  std::unique_ptr<llvm::sys::fs::mapped_file_region> region;
+  llvm::ArrayRef<uint8_t> file;
+};
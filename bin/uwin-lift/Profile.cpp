@@ -0,0 +1,356 @@
+#include "Profile.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+const char * const kProfileEnvVarName = "UWIN_LIFT_PROFILE";
+const char * const kDefaultProfileFilename = "uwin-lift.profile";
+const char * const kUnknownDispatchCounterName = "dispatch:unknown";
+
+std::string TraceCounterName(std::string_view trace) {
+  return "trace:" + std::string(trace);
+}
+
+std::string BranchCounterName(std::string_view trace, unsigned branch,
+                              bool taken) {
+  return "branch:" + std::string(trace) + ":" + std::to_string(branch) +
+         (taken ? ":t" : ":f");
+}
+
+std::string CallCounterName(std::string_view caller, std::string_view callee) {
+  return "call:" + std::string(caller) + ":" + std::string(callee);
+}
+
+std::string DispatchCounterName(uint64_t addr) {
+  return "dispatch:" + llvm::utohexstr(addr, true /* LowerCase */);
+}
+
+void Profile::Load(const std::string &filename) {
+  std::ifstream f(filename, std::ios_base::in);
+  if (!f.is_open()) {
+    throw std::runtime_error("Can't open profile file");
+  }
+
+  std::string name;
+  std::uint64_t count;
+  while (f >> name >> count) {
+    counts[name] += count;
+  }
+}
+
+const uint64_t *Profile::Find(std::string_view name) const {
+  auto it = counts.find(name);
+  return it == counts.end() ? nullptr : &(it->second);
+}
+
+namespace {
+
+// Lifted traces hand over to each other with calls of the lifted function
+// type, like the control-flow intrinsics.
+static llvm::Function *CalledTrace(llvm::Instruction &inst,
+                                   llvm::Function *func) {
+  auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+  if (!call) {
+    return nullptr;
+  }
+  auto callee = call->getCalledFunction();
+  if (!callee || callee->getFunctionType() != func->getFunctionType() ||
+      callee->getName().startswith("__remill_")) {
+    return nullptr;
+  }
+  return callee;
+}
+
+}  // namespace
+
+uint32_t ScaleBranchWeight(uint64_t count, uint64_t max_count) {
+  constexpr uint64_t kMaxWeight = std::numeric_limits<uint32_t>::max();
+  if (max_count <= kMaxWeight) {
+    return static_cast<uint32_t>(count);
+  }
+  return static_cast<uint32_t>(count / (max_count / kMaxWeight + 1u));
+}
+
+ProfileInstrumenter::ProfileInstrumenter(llvm::Module *module_)
+    : module(module_),
+      counters(new llvm::GlobalVariable(
+          *module, llvm::Type::getInt64Ty(module->getContext()), false,
+          llvm::GlobalValue::PrivateLinkage, nullptr,
+          "uwin_profile_counters")) {}
+
+uint64_t ProfileInstrumenter::AddCounter(std::string name) {
+  names.push_back(std::move(name));
+  return names.size() - 1u;
+}
+
+void ProfileInstrumenter::Increment(llvm::IRBuilderBase &ir, uint64_t index,
+                                    llvm::Value *offset) {
+  CHECK(counters != nullptr);
+  llvm::Value *counter_index = ir.getInt64(index);
+  if (offset) {
+    counter_index = ir.CreateAdd(
+        counter_index, ir.CreateZExtOrTrunc(offset, ir.getInt64Ty()));
+  }
+  auto ptr = ir.CreateGEP(ir.getInt64Ty(), counters, counter_index);
+  ir.CreateStore(
+      ir.CreateAdd(ir.CreateLoad(ir.getInt64Ty(), ptr), ir.getInt64(1)), ptr);
+}
+
+void ProfileInstrumenter::InstrumentTrace(llvm::Function *func) {
+  const auto name = func->getName().str();
+  auto &entry = func->getEntryBlock();
+  llvm::IRBuilder<> ir(&entry, entry.getFirstInsertionPt());
+  Increment(ir, AddCounter(TraceCounterName(name)));
+
+  // Collect first, the increments add instructions.
+  std::vector<llvm::BranchInst *> branches;
+  std::vector<std::pair<llvm::CallInst *, llvm::Function *>> calls;
+  for (auto &block : *func) {
+    for (auto &inst : block) {
+      if (auto br = llvm::dyn_cast<llvm::BranchInst>(&inst);
+          br && br->isConditional()) {
+        branches.push_back(br);
+      } else if (auto callee = CalledTrace(inst, func)) {
+        calls.emplace_back(llvm::cast<llvm::CallInst>(&inst), callee);
+      }
+    }
+  }
+
+  // Counter `taken + 1` is the one of the not-taken side.
+  for (unsigned i = 0; i < branches.size(); ++i) {
+    auto br = branches[i];
+    const auto taken = AddCounter(BranchCounterName(name, i, true));
+    AddCounter(BranchCounterName(name, i, false));
+    ir.SetInsertPoint(br);
+    Increment(ir, taken, ir.CreateNot(br->getCondition()));
+  }
+
+  for (auto [call, callee] : calls) {
+    ir.SetInsertPoint(call);
+    Increment(ir, AddCounter(CallCounterName(name, callee->getName())));
+  }
+}
+
+// The counters are written out by:
+//
+//    static void uwin_profile_dump(void) {
+//      const char *path = getenv(kProfileEnvVarName);
+//      FILE *f = fopen(path ? path : kDefaultProfileFilename, "a");
+//      if (f) {
+//        for (i = 0; i < n; ++i)
+//          fprintf(f, "%s %llu\n", names[i], counters[i]);
+//        fclose(f);
+//      }
+//    }
+//
+// which a global constructor registers with `atexit`.
+void ProfileInstrumenter::Finish(void) {
+  CHECK(counters != nullptr);
+  if (names.empty()) {
+    counters->eraseFromParent();
+    counters = nullptr;
+    return;
+  }
+
+  auto &context = module->getContext();
+  auto i64_type = llvm::Type::getInt64Ty(context);
+  auto i8_ptr_type = llvm::Type::getInt8PtrTy(context);
+  auto i32_type = llvm::Type::getInt32Ty(context);
+  auto void_type = llvm::Type::getVoidTy(context);
+  const auto num_counters = names.size();
+
+  auto counters_type = llvm::ArrayType::get(i64_type, num_counters);
+  auto counters_array = new llvm::GlobalVariable(
+      *module, counters_type, false, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantAggregateZero::get(counters_type), "");
+  counters_array->takeName(counters);
+  counters->replaceAllUsesWith(
+      llvm::ConstantExpr::getBitCast(counters_array, counters->getType()));
+  counters->eraseFromParent();
+  counters = nullptr;
+
+  // Counter names are stored back to back, each terminated by a NUL, with a
+  // table of pointers into them.
+  std::string all_names;
+  std::vector<uint64_t> offsets;
+  for (const auto &name : names) {
+    offsets.push_back(all_names.size());
+    all_names += name;
+    all_names.push_back('\0');
+  }
+  auto names_data = llvm::ConstantDataArray::getString(context, all_names,
+                                                       false /* AddNull */);
+  auto names_var = new llvm::GlobalVariable(
+      *module, names_data->getType(), true, llvm::GlobalValue::PrivateLinkage,
+      names_data, "uwin_profile_names");
+  std::vector<llvm::Constant *> name_ptrs;
+  for (auto offset : offsets) {
+    llvm::Constant *indices[] = {llvm::ConstantInt::get(i64_type, 0),
+                                 llvm::ConstantInt::get(i64_type, offset)};
+    name_ptrs.push_back(llvm::ConstantExpr::getInBoundsGetElementPtr(
+        names_data->getType(), names_var, indices));
+  }
+  auto name_table_type = llvm::ArrayType::get(i8_ptr_type, num_counters);
+  auto name_table = new llvm::GlobalVariable(
+      *module, name_table_type, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(name_table_type, name_ptrs),
+      "uwin_profile_name_table");
+
+  auto getenv_func = module->getOrInsertFunction(
+      "getenv", llvm::FunctionType::get(i8_ptr_type, {i8_ptr_type}, false));
+  auto fopen_func = module->getOrInsertFunction(
+      "fopen", llvm::FunctionType::get(i8_ptr_type,
+                                       {i8_ptr_type, i8_ptr_type}, false));
+  auto fprintf_func = module->getOrInsertFunction(
+      "fprintf", llvm::FunctionType::get(i32_type,
+                                         {i8_ptr_type, i8_ptr_type}, true));
+  auto fclose_func = module->getOrInsertFunction(
+      "fclose", llvm::FunctionType::get(i32_type, {i8_ptr_type}, false));
+  auto atexit_func = module->getOrInsertFunction(
+      "atexit", llvm::FunctionType::get(
+                    i32_type,
+                    {llvm::FunctionType::get(void_type, false)->getPointerTo()},
+                    false));
+
+  auto dump = llvm::Function::Create(
+      llvm::FunctionType::get(void_type, false),
+      llvm::GlobalValue::PrivateLinkage, "uwin_profile_dump", module);
+  auto entry = llvm::BasicBlock::Create(context, "entry", dump);
+  auto loop = llvm::BasicBlock::Create(context, "loop", dump);
+  auto done = llvm::BasicBlock::Create(context, "done", dump);
+  auto exit = llvm::BasicBlock::Create(context, "exit", dump);
+
+  llvm::IRBuilder<> ir(entry);
+  auto env_path = ir.CreateCall(
+      getenv_func, {ir.CreateGlobalStringPtr(kProfileEnvVarName)});
+  auto path = ir.CreateSelect(
+      ir.CreateIsNull(env_path),
+      ir.CreateGlobalStringPtr(kDefaultProfileFilename), env_path);
+  auto file = ir.CreateCall(fopen_func, {path, ir.CreateGlobalStringPtr("a")});
+  auto format = ir.CreateGlobalStringPtr("%s %llu\n");
+  ir.CreateCondBr(ir.CreateIsNull(file), exit, loop);
+
+  ir.SetInsertPoint(loop);
+  auto index = ir.CreatePHI(i64_type, 2);
+  index->addIncoming(ir.getInt64(0), entry);
+  llvm::Value *name_indices[] = {ir.getInt64(0), index};
+  auto name = ir.CreateLoad(
+      i8_ptr_type,
+      ir.CreateInBoundsGEP(name_table_type, name_table, name_indices));
+  auto count = ir.CreateLoad(
+      i64_type,
+      ir.CreateInBoundsGEP(counters_type, counters_array, name_indices));
+  ir.CreateCall(fprintf_func, {file, format, name, count});
+  auto next_index = ir.CreateAdd(index, ir.getInt64(1));
+  index->addIncoming(next_index, loop);
+  ir.CreateCondBr(ir.CreateICmpULT(next_index, ir.getInt64(num_counters)),
+                  loop, done);
+
+  ir.SetInsertPoint(done);
+  ir.CreateCall(fclose_func, {file});
+  ir.CreateBr(exit);
+
+  ir.SetInsertPoint(exit);
+  ir.CreateRetVoid();
+
+  auto init = llvm::Function::Create(
+      llvm::FunctionType::get(void_type, false),
+      llvm::GlobalValue::PrivateLinkage, "uwin_profile_init", module);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", init));
+  ir.CreateCall(atexit_func, {dump});
+  ir.CreateRetVoid();
+
+  llvm::appendToGlobalCtors(*module, init, 0);
+}
+
+void ApplyProfile(const Profile &profile,
+                  const std::vector<llvm::Function *> &funcs,
+                  unsigned hot_percent) {
+  std::unordered_map<llvm::Function *, uint64_t> call_counts;
+  uint64_t max_call_count = 0;
+
+  for (auto func : funcs) {
+    const auto name = func->getName().str();
+    auto entry_count = profile.Find(TraceCounterName(name));
+    if (!entry_count) {
+      continue;
+    }
+
+    func->setEntryCount(*entry_count);
+    if (!*entry_count) {
+      func->addFnAttr(llvm::Attribute::Cold);
+    }
+
+    unsigned num_branches = 0;
+    for (auto &block : *func) {
+      for (auto &inst : block) {
+        if (auto br = llvm::dyn_cast<llvm::BranchInst>(&inst);
+            br && br->isConditional()) {
+          const auto taken =
+              profile.Find(BranchCounterName(name, num_branches, true));
+          const auto not_taken =
+              profile.Find(BranchCounterName(name, num_branches, false));
+          ++num_branches;
+          if (!taken || !not_taken) {
+            continue;
+          }
+          const auto max_count = std::max(*taken, *not_taken);
+          br->setMetadata(
+              llvm::LLVMContext::MD_prof,
+              llvm::MDBuilder(func->getContext())
+                  .createBranchWeights(ScaleBranchWeight(*taken, max_count),
+                                       ScaleBranchWeight(*not_taken,
+                                                         max_count)));
+
+        } else if (auto callee = CalledTrace(inst, func)) {
+          if (auto count = profile.Find(
+                  CallCounterName(name, callee->getName()))) {
+            auto &callee_count = call_counts[callee];
+            callee_count = std::max(callee_count, *count);
+            max_call_count = std::max(max_call_count, *count);
+          }
+        }
+      }
+    }
+  }
+
+  // Lifted traces are only inlined into each other when the final module is
+  // optimized, which is when the hint matters.
+  for (auto [callee, count] : call_counts) {
+    if (count && count * 100u >= max_call_count * hot_percent &&
+        !callee->hasFnAttribute(llvm::Attribute::Cold)) {
+      callee->addFnAttr(llvm::Attribute::InlineHint);
+    }
+  }
+}
+
+unsigned PlaceColdTraces(llvm::Module *module) {
+  if (!llvm::Triple(module->getTargetTriple()).isOSBinFormatELF()) {
+    return 0;
+  }
+
+  unsigned num_placed = 0;
+  for (auto &func : *module) {
+    if (!func.isDeclaration() && !func.hasSection() &&
+        func.hasFnAttribute(llvm::Attribute::Cold)) {
+      func.setSection(".text.unlikely");
+      ++num_placed;
+    }
+  }
+  return num_placed;
+}
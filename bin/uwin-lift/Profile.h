@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llvm {
+class Function;
+class GlobalVariable;
+class IRBuilderBase;
+class Module;
+class Value;
+}  // namespace llvm
+
+// Name of the environment variable with the path of the file that
+// instrumented code appends its counters to.
+extern const char * const kProfileEnvVarName;
+
+// File that instrumented code appends its counters to if `kProfileEnvVarName`
+// isn't set.
+extern const char * const kDefaultProfileFilename;
+
+// Names of the counters of instrumented code. The branches of a trace are
+// numbered in the order of its blocks, right after lifting.
+std::string TraceCounterName(std::string_view trace);
+std::string BranchCounterName(std::string_view trace, unsigned branch,
+                              bool taken);
+std::string CallCounterName(std::string_view caller, std::string_view callee);
+std::string DispatchCounterName(uint64_t addr);
+extern const char * const kUnknownDispatchCounterName;
+
+// Branch weights are 32 bits wide. Returns `count` scaled down as much as
+// `max_count` has to be to fit.
+uint32_t ScaleBranchWeight(uint64_t count, uint64_t max_count);
+
+// Counts written by instrumented code. Every line is the name of a counter and
+// its count. Runs append to the same file, and the counts of a counter are
+// summed up.
+class Profile {
+ public:
+  // Adds the counts in `filename` to this profile.
+  void Load(const std::string &filename);
+
+  // Returns the count of counter `name`, or `nullptr` if the profile doesn't
+  // have it, e.g. because the code changed since.
+  const uint64_t *Find(std::string_view name) const;
+
+  std::map<std::string, uint64_t, std::less<>> counts;
+};
+
+// Adds counters to a module, and a global constructor that makes the module
+// append them to the profile on exit. Counters are plain, non-atomic
+// increments of a private array, as uwin is single-threaded.
+class ProfileInstrumenter {
+ public:
+  explicit ProfileInstrumenter(llvm::Module *module_);
+
+  // Returns the index of a new counter.
+  uint64_t AddCounter(std::string name);
+
+  // Increments counter `index`, plus `offset` if given, at the insertion
+  // point of `ir`.
+  void Increment(llvm::IRBuilderBase &ir, uint64_t index,
+                 llvm::Value *offset = nullptr);
+
+  // Counts the entries into the freshly lifted trace `func`, which way its
+  // conditional branches go, and its calls to other traces.
+  void InstrumentTrace(llvm::Function *func);
+
+  // Defines the counters and the code that writes them out. Nothing can be
+  // counted afterwards.
+  void Finish(void);
+
+ private:
+  llvm::Module *const module;
+
+  // Stands in for the array of counters until we know how big it is.
+  llvm::GlobalVariable *counters;
+  std::vector<std::string> names;
+};
+
+// Annotates the freshly lifted traces `funcs` with the counts of `profile`:
+// their entry counts, and the weights of their conditional branches. Traces
+// whose callers call them at least `hot_percent` percent as often as the
+// hottest call between traces get an inline hint. Traces that were never
+// entered are cold, see `PlaceColdTraces`.
+void ApplyProfile(const Profile &profile,
+                  const std::vector<llvm::Function *> &funcs,
+                  unsigned hot_percent);
+
+// Moves the cold functions of `module` into a section of their own, away from
+// the hot code. Only ELF targets have such a section. Returns the number of
+// functions that were moved.
+unsigned PlaceColdTraces(llvm::Module *module);
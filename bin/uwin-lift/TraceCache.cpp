@@ -0,0 +1,98 @@
+#include "TraceCache.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/BC/Util.h>
+
+TraceCache::TraceCache(std::string dir_, std::string version_)
+    : dir(std::move(dir_)), version(std::move(version_)) {}
+
+std::string TraceCache::Key(uint64_t addr, const std::string &name,
+                            llvm::StringRef content_hash) const {
+  llvm::MD5 hash;
+  hash.update(version);
+  hash.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&addr),
+                                      sizeof(addr)));
+  hash.update(name);
+  hash.update(content_hash);
+
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  return result.digest().str().str();
+}
+
+std::string TraceCache::PathOf(const std::string &key) const {
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, key.substr(0, 2), key + ".bc");
+  return path.str().str();
+}
+
+std::unique_ptr<llvm::Module> TraceCache::Load(
+    const std::string &key, llvm::LLVMContext &context) const {
+  const auto path = PathOf(key);
+  if (!llvm::sys::fs::exists(path)) {
+    return nullptr;
+  }
+  return remill::LoadModuleFromFile(&context, path, true /* allow_failure */);
+}
+
+void TraceCache::Store(const std::string &key, llvm::Function *func) const {
+  const auto path = PathOf(key);
+  if (auto ec = llvm::sys::fs::create_directories(
+          llvm::sys::path::parent_path(path))) {
+    LOG(ERROR) << "Can't create trace cache directory for " << path << ": "
+               << ec.message();
+    return;
+  }
+
+  auto source_module = func->getParent();
+  llvm::Module module(func->getName(), func->getContext());
+  module.setDataLayout(source_module->getDataLayout());
+  module.setTargetTriple(source_module->getTargetTriple());
+
+  auto cached_func = llvm::Function::Create(
+      func->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+      func->getName(), &module);
+  remill::CloneFunctionInto(func, cached_func);
+
+  // Shards store traces concurrently, possibly even the same ones, so write
+  // to a file of our own and then move it into place.
+  int fd = -1;
+  llvm::SmallString<128> tmp_path;
+  if (auto ec = llvm::sys::fs::createUniqueFile(path + ".tmp-%%%%%%%%", fd,
+                                                tmp_path)) {
+    LOG(ERROR) << "Can't create temporary file for " << path << ": "
+               << ec.message();
+    return;
+  }
+
+  bool ok = true;
+  {
+    llvm::raw_fd_ostream os(fd, true /* shouldClose */);
+    llvm::WriteBitcodeToFile(module, os);
+    os.close();
+    ok = !os.has_error();
+    os.clear_error();
+  }
+
+  if (ok) {
+    if (auto ec = llvm::sys::fs::rename(tmp_path, path)) {
+      LOG(ERROR) << "Can't move " << tmp_path.str().str() << " to " << path
+                 << ": " << ec.message();
+      ok = false;
+    }
+  } else {
+    LOG(ERROR) << "Can't write cached trace " << path;
+  }
+
+  if (!ok) {
+    llvm::sys::fs::remove(tmp_path);
+  }
+}
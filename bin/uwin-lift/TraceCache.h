@@ -0,0 +1,45 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace llvm {
+class Function;
+class LLVMContext;
+class Module;
+}  // namespace llvm
+
+// On-disk, content-addressed store of optimized lifted traces. Every trace is
+// kept in a bitcode file of its own, named after a hash of everything that
+// went into it, so that traces whose code didn't change since the previous
+// run don't need to be optimized again.
+class TraceCache {
+ public:
+  // `version` is mixed into every key. It should identify everything besides
+  // the bytes of a trace that its optimized code depends on, e.g. the lifter
+  // and the semantics.
+  TraceCache(std::string dir, std::string version);
+
+  // Returns the key of the trace `name` at `addr`, whose instruction bytes,
+  // and those of all of the traces that it calls, hash to `content_hash`.
+  std::string Key(uint64_t addr, const std::string &name,
+                  llvm::StringRef content_hash) const;
+
+  // Loads the module stored under `key` into `context`, or returns `nullptr`
+  // if there is none.
+  std::unique_ptr<llvm::Module> Load(const std::string &key,
+                                     llvm::LLVMContext &context) const;
+
+  // Stores a copy of the optimized `func` under `key`. Failures are only
+  // logged; the trace will just be optimized again on the next run.
+  void Store(const std::string &key, llvm::Function *func) const;
+
+ private:
+  std::string PathOf(const std::string &key) const;
+
+  const std::string dir;
+  const std::string version;
+};
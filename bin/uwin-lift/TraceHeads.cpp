@@ -0,0 +1,30 @@
+#include "TraceHeads.h"
+
+#include <remill/BC/CFGDiscoverer.h>
+
+#include <unordered_map>
+
+std::vector<uint64_t> FunctionTraceHeads(remill::DiscoveredCFG const& cfg,
+                                         std::vector<uint64_t> const& blocks,
+                                         SecondaryEntries &secondary_entries) {
+  std::unordered_map<uint64_t, uint64_t> owners;
+  for (auto const& [entry, func] : cfg.functions) {
+    owners[entry] = entry;
+  }
+  for (auto const& [entry, func] : cfg.functions) {
+    for (auto addr : func.blocks) {
+      owners.emplace(addr, entry);
+    }
+  }
+
+  std::vector<uint64_t> heads;
+  for (auto addr : blocks) {
+    auto owner_it = owners.find(addr);
+    if (owner_it == owners.end() || owner_it->second == addr) {
+      heads.push_back(addr);
+    } else {
+      secondary_entries[owner_it->second].push_back(addr);
+    }
+  }
+  return heads;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace remill {
+struct DiscoveredCFG;
+}  // namespace remill
+
+// Secondary entries of lifted functions, by the trace heads they belong to.
+using SecondaryEntries = std::map<uint64_t, std::vector<uint64_t>>;
+
+// Returns the trace heads among `blocks` when every discovered function is
+// lifted as one trace, see --trace_heads, and fills `secondary_entries` with
+// the rest. Function entries always head their own trace, even if another
+// function tail-calls them. Other blocks that several functions reach, e.g.
+// shared epilogues, belong to the function with the lowest entry, and blocks
+// that no function reaches head their own trace.
+std::vector<uint64_t> FunctionTraceHeads(remill::DiscoveredCFG const& cfg,
+                                         std::vector<uint64_t> const& blocks,
+                                         SecondaryEntries &secondary_entries);
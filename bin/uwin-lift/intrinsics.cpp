@@ -10,6 +10,16 @@ typedef struct Memory Memory;
 #define HAS_FEATURE_AVX512 0
 #define ADDRESS_SIZE_BITS 32
 #include <remill/Arch/X86/Runtime/State.h>
+#include <remill/Arch/X86/Runtime/LazyFlags.h>
+
+// The runtime looks at `aflag` directly, so the flags recorded by the lifted
+// code are computed before handing it the state, including on calls and jumps
+// that go through the dispatcher, and on returns.
+#ifdef REMILL_X86_LAZY_FLAGS
+# define MATERIALIZE_FLAGS(st) MaterializeLazyFlags(st)
+#else
+# define MATERIALIZE_FLAGS(st)
+#endif
 
 struct Memory;
 
@@ -28,31 +38,37 @@ Memory *uwin_xcute_remill_missing_block(State &st, uint32_t pc, Memory *mem);
 
 [[gnu::always_inline]]
 Memory *__remill_function_call(State &st, uint32_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return uwin_xcute_remill_dispatch(st, pc, mem);
 }
 
 [[gnu::always_inline]]
 Memory *__remill_jump(State &st, uint32_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return uwin_xcute_remill_dispatch(st, pc, mem);
 }
 
 [[gnu::always_inline]]
 Memory *__remill_missing_block(State &st, uint32_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return uwin_xcute_remill_missing_block(st, pc, mem);
 }
 
 [[gnu::always_inline]]
 Memory *__remill_function_return(State &st, uint32_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return mem;
 }
 
 [[gnu::always_inline]]
 Memory *__remill_async_hyper_call(State &st, uint32_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return uwin_xcute_remill_async_hyper_call(st, pc, mem);
 }
 
 [[gnu::always_inline]]
 Memory *__remill_sync_hyper_call(State &st, uint32_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return uwin_xcute_remill_sync_hyper_call(st, pc, mem);
 }
 
@@ -187,6 +203,7 @@ uint8_t __remill_undefined_8() {
 }
 
 [[gnu::always_inline]] Memory *__remill_error(State &st, addr_t pc, Memory *mem) {
+  MATERIALIZE_FLAGS(st);
   return uwin_xcute_remill_error(st, pc, mem);
 }
 
@@ -169,6 +169,18 @@ class Arch {
   // Return information about a register, given its name.
   const Register *RegisterByName(std::string_view name) const;
 
+  // Returns the ID of the semantics function `function` in the ISEL index, or
+  // `kInvalidISelId` if the semantics have no `ISEL_<function>`. IDs are
+  // assigned in name order by `InitFromSemanticsModule`, and so are stable
+  // for a given semantics module.
+  uint32_t ISelId(std::string_view function) const;
+
+  // Returns the name of the semantics function with ID `id`.
+  std::string_view ISelName(uint32_t id) const;
+
+  // Returns the number of semantics functions in the ISEL index.
+  size_t NumISels(void) const;
+
   // Returns the name of the stack pointer register.
   virtual std::string_view StackPointerRegisterName(void) const = 0;
 
@@ -220,6 +232,18 @@ class Arch {
     return this->DecodeInstruction(address, instr_bytes, inst);
   }
 
+  // Linearly decode consecutive instructions from `instr_bytes`, the first of
+  // which is at `address`, into `insts[0]` through `insts[max_insts - 1]`.
+  // Decoding stops at the first undecodable instruction, or at the end of
+  // `instr_bytes`. Returns the number of decoded instructions.
+  //
+  // The instructions in `insts` are reset and refilled in place, so callers
+  // that keep reusing the same ones (e.g. a linear sweep over a section)
+  // avoid reallocating their operands and strings for every instruction.
+  virtual size_t DecodeInstructions(uint64_t address,
+                                    std::string_view instr_bytes,
+                                    Instruction *insts, size_t max_insts) const;
+
   // Minimum alignment of an instruction for this particular architecture.
   virtual uint64_t MinInstructionAlign(void) const = 0;
 
@@ -297,6 +321,10 @@ class Arch {
   virtual void PopulateBasicBlockFunction(llvm::Module *module,
                                           llvm::Function *bb_func) const = 0;
 
+  // Called once the ISEL index is built, so that decoders can precompute the
+  // ISEL IDs that they hand back in `Instruction::isel_id`.
+  virtual void PopulateISelIds(void) const {}
+
   llvm::Triple BasicTriple(void) const;
 
   // Add a register into this
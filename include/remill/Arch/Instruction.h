@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <variant>
 #include <vector>
@@ -33,6 +34,10 @@ class OperandExpression;
 
 enum ArchName : unsigned;
 
+// ID of an instruction whose semantics function isn't in the ISEL index of its
+// architecture. See `Arch::ISelId`.
+inline constexpr uint32_t kInvalidISelId = ~0u;
+
 struct LLVMOpExpr {
   unsigned llvm_opcode;
   OperandExpression *op1;
@@ -183,6 +188,10 @@ class Instruction {
   // Name of semantics function that implements this instruction.
   std::string function;
 
+  // ID of `function` in the ISEL index of `arch`, or `kInvalidISelId` if the
+  // decoder didn't resolve it, in which case the lifter looks it up by name.
+  uint32_t isel_id;
+
   // The decoded bytes of the instruction.
   std::string bytes;
 
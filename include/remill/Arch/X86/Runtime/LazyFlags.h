@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "remill/Arch/X86/Runtime/State.h"
+
+#ifdef REMILL_X86_LAZY_FLAGS
+
+// With lazy flags, the ALU instructions that set all the arithmetic flags
+// (ADD, SUB, CMP, NEG, AND, OR, XOR, TEST) only record their operands and
+// result in `State::lazy_flags`. The flags are computed into `State::aflag`
+// the first time anything reads or partially writes them. Within a trace, the
+// recorded operation is a constant, and the optimizer keeps only the flags
+// that are read. Code outside of the lifted code that looks at `aflag`, e.g.
+// a runtime's hyper call or exception handlers, must call
+// `MaterializeLazyFlags` first.
+
+enum : uint64_t {
+  kLazyFlagsNone = 0,
+  kLazyFlagsAdd = 1,
+  kLazyFlagsSub = 2,
+  kLazyFlagsLogical = 3
+};
+
+// Records the flags of the operation `kind` on `T`-sized operands.
+template <typename T>
+[[gnu::always_inline]] inline static void
+RecordLazyFlags(X86State &state, uint64_t kind, T lhs, T rhs, T res) {
+  state.lazy_flags.op = (kind << 4u) | sizeof(T);
+  state.lazy_flags.lhs = static_cast<uint64_t>(lhs);
+  state.lazy_flags.rhs = static_cast<uint64_t>(rhs);
+  state.lazy_flags.res = static_cast<uint64_t>(res);
+}
+
+// Same as `WriteFlagsAddSub` and `SetFlagsLogical` in the semantics.
+template <typename T>
+[[gnu::always_inline]] inline static void
+ComputeLazyFlags(ArithFlags &flags, uint64_t kind, const LazyFlags &lazy) {
+  enum : unsigned { kSignShift = sizeof(T) * 8u - 1u };
+  const auto lhs = static_cast<T>(lazy.lhs);
+  const auto rhs = static_cast<T>(lazy.rhs);
+  const auto res = static_cast<T>(lazy.res);
+  const T sign_lhs = lhs >> kSignShift;
+  const T sign_rhs = rhs >> kSignShift;
+  const T sign_res = res >> kSignShift;
+
+  flags.pf = !__builtin_parity(static_cast<unsigned>(uint8_t(res)));
+  flags.zf = T(0) == res;
+  flags.sf = T(0) != sign_res;
+
+  switch (kind) {
+    case kLazyFlagsAdd:
+      flags.cf = res < lhs || res < rhs;
+      flags.af = T(0) != ((res ^ lhs ^ rhs) & T(0x10));
+      flags.of = 2 == ((sign_lhs ^ sign_res) + (sign_rhs ^ sign_res));
+      break;
+    case kLazyFlagsSub:
+      flags.cf = lhs < rhs;
+      flags.af = T(0) != ((res ^ lhs ^ rhs) & T(0x10));
+      flags.of = 2 == ((sign_lhs ^ sign_rhs) + (sign_lhs ^ sign_res));
+      break;
+    default:
+      flags.cf = false;
+      flags.af = false;
+      flags.of = false;
+      break;
+  }
+}
+
+// Computes the flags of the recorded operation, if any, and returns the
+// up-to-date flags.
+[[gnu::always_inline]] inline static ArithFlags &
+MaterializeLazyFlags(X86State &state) {
+  const auto op = state.lazy_flags.op;
+  if (kLazyFlagsNone != op) {
+    const auto kind = op >> 4u;
+    switch (op & 0xfu) {
+      case 1:
+        ComputeLazyFlags<uint8_t>(state.aflag, kind, state.lazy_flags);
+        break;
+      case 2:
+        ComputeLazyFlags<uint16_t>(state.aflag, kind, state.lazy_flags);
+        break;
+      case 4:
+        ComputeLazyFlags<uint32_t>(state.aflag, kind, state.lazy_flags);
+        break;
+      default:
+        ComputeLazyFlags<uint64_t>(state.aflag, kind, state.lazy_flags);
+        break;
+    }
+    state.lazy_flags.op = kLazyFlagsNone;
+  }
+  return state.aflag;
+}
+
+#endif  // REMILL_X86_LAZY_FLAGS
@@ -432,6 +432,24 @@ struct alignas(8) ArithFlags final {
 
 static_assert(16 == sizeof(ArithFlags), "Invalid packing of `ArithFlags`.");
 
+#ifdef REMILL_X86_LAZY_FLAGS
+
+// The last ALU operation whose arithmetic flags haven't been computed into
+// `ArithFlags` yet. See `remill/Arch/X86/Runtime/LazyFlags.h`.
+struct alignas(8) LazyFlags final {
+  uint64_t op;  // Zero if `ArithFlags` is up-to-date.
+  uint64_t lhs;
+  uint64_t rhs;
+  uint64_t res;
+} __attribute__((packed));
+
+static_assert(32 == sizeof(LazyFlags), "Invalid packing of `LazyFlags`.");
+
+#  define IF_LAZY_FLAGS_ELSE(a, b) a
+#else
+#  define IF_LAZY_FLAGS_ELSE(a, b) b
+#endif  // REMILL_X86_LAZY_FLAGS
+
 union XCR0 {
   uint64_t flat;
 
@@ -779,9 +797,12 @@ struct alignas(16) X86State : public ArchState {
   XCR0 xcr0;  // 8 bytes.
   FPU x87;  // 512 bytes
   SegmentCaches seg_caches;  // 96 bytes
+#ifdef REMILL_X86_LAZY_FLAGS
+  LazyFlags lazy_flags;  // 32 bytes.
+#endif
 } __attribute__((packed));
 
-static_assert((96 + 3264 + 16) == sizeof(X86State),
+static_assert((96 + 3264 + 16 + IF_LAZY_FLAGS_ELSE(32, 0)) == sizeof(X86State),
               "Invalid packing of `struct State`");
 
 struct State : public X86State {};
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace remill {
+
+class Arch;
+
+// A run of instructions that is only entered at `addr`. It ends in control
+// flow, or right before the start of another block. Calls don't end blocks,
+// just like they don't end traces.
+struct DiscoveredBlock {
+  uint64_t addr{0};
+
+  // Address right after the last instruction.
+  uint64_t end_addr{0};
+
+  uint64_t num_instructions{0};
+
+  // Blocks that this one branches or falls through to. Called functions
+  // aren't successors.
+  std::vector<uint64_t> successors;
+
+  // The block ends in an indirect jump whose targets weren't all found, or in
+  // something that couldn't be decoded.
+  bool is_incomplete{false};
+};
+
+// A function entry, i.e. a seed or the target of a direct call, and the
+// blocks reachable from it without calls. Reachability stops at the entries
+// of other functions, which are tail calls. Other blocks that are jumped to
+// from more than one function, e.g. shared epilogues, belong to all of them.
+struct DiscoveredFunction {
+  uint64_t entry{0};
+  std::vector<uint64_t> blocks;
+
+  // Entries of the functions that this one jumps to.
+  std::vector<uint64_t> tail_calls;
+};
+
+// `jmp [table + index * scale]`, and the targets read from the table.
+struct DiscoveredJumpTable {
+  uint64_t inst_addr{0};
+  uint64_t table_addr{0};
+  uint64_t entry_size{0};
+  std::vector<uint64_t> targets;
+
+  // Whether the number of entries came from a bounds check on the index, as
+  // opposed to reading entries until one isn't a (relocated) code address.
+  bool is_bounded{false};
+};
+
+struct DiscoveredCFG {
+  std::map<uint64_t, DiscoveredBlock> blocks;
+  std::map<uint64_t, DiscoveredFunction> functions;
+  std::map<uint64_t, DiscoveredJumpTable> jump_tables;
+
+  // Returns the addresses of all blocks, in order, i.e. the trace heads of
+  // every block that a `TraceLifter` could ever be asked for.
+  std::vector<uint64_t> TraceHeads(void) const;
+};
+
+// Recursive-descent disassembler. Starting from the seeds, it follows direct
+// jumps, branches and calls, and the targets of jump tables, and recovers
+// basic blocks and functions.
+//
+// The image is a set of regions of guest memory, e.g. the memory-mapped
+// sections of an executable. Code is only decoded from executable regions,
+// but jump tables can be read from any region.
+//
+// Decoding is spread across threads that each have a queue of block addresses
+// and steal from each other's queues when theirs run dry.
+class CFGDiscoverer {
+ public:
+  explicit CFGDiscoverer(const Arch *arch_);
+  ~CFGDiscoverer(void);
+
+  // Exposes `bytes` at `addr`. The memory is not owned by the discoverer, and
+  // must outlive it.
+  void AddRegion(uint64_t addr, std::string_view bytes, bool is_executable);
+
+  // Adds a known function entry, e.g. the entry point, an export or a debug
+  // symbol.
+  void AddFunctionEntry(uint64_t addr);
+
+  // Marks `addr` as holding an absolute pointer, e.g. because the executable
+  // has a base relocation there. Pointers into executable regions are
+  // decoded as blocks if the code there decodes and isn't itself within a
+  // relocated pointer, though not as functions unless something calls them.
+  // Tables of pointers without a bounds check end at the first entry that
+  // isn't one.
+  void AddRelocation(uint64_t addr);
+
+  // Decodes everything reachable from the function entries on `num_threads`
+  // threads, or on one per hardware thread if it is zero.
+  DiscoveredCFG Discover(unsigned num_threads = 0);
+
+ private:
+  CFGDiscoverer(void) = delete;
+
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+}  // namespace remill
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include <memory>
+#include <string>
+
+#include "remill/BC/Version.h"
+
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(13, 0)
+
+namespace llvm {
+
+using OptimizationLevel = PassBuilder::OptimizationLevel;
+
+}  // namespace llvm
+
+#endif
+
+namespace remill::compat::llvm {
+
+// LLVM 13 dropped the `DebugLogging` argument of `PassBuilder`.
+inline static std::unique_ptr<::llvm::PassBuilder>
+CreatePassBuilder(::llvm::PipelineTuningOptions tuning,
+                  ::llvm::PassInstrumentationCallbacks *callbacks = nullptr) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(13, 0)
+  return std::make_unique<::llvm::PassBuilder>(false, nullptr, tuning,
+                                               ::llvm::None, callbacks);
+#else
+  return std::make_unique<::llvm::PassBuilder>(nullptr, tuning, ::llvm::None,
+                                               callbacks);
+#endif
+}
+
+// Up to LLVM 12, the threshold of the inliner in the default pipelines is a
+// tuning option. Since LLVM 14, it is the `function-inline-threshold`
+// attribute of the callee. LLVM 13 has neither, and returns `false`.
+inline static bool SetInlineThreshold(::llvm::PipelineTuningOptions &tuning,
+                                      ::llvm::Module &module,
+                                      unsigned threshold) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(13, 0)
+  tuning.InlinerThreshold = static_cast<int>(threshold);
+  return true;
+#elif LLVM_VERSION_NUMBER < LLVM_VERSION(14, 0)
+  return false;
+#else
+  const auto value = std::to_string(threshold);
+  for (auto &func : module) {
+    if (!func.isDeclaration()) {
+      func.addFnAttr("function-inline-threshold", value);
+    }
+  }
+  return true;
+#endif
+}
+
+// Removes what `SetInlineThreshold` added to `func`.
+inline static void ClearInlineThreshold(::llvm::Function &func) {
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(14, 0)
+  func.removeFnAttr("function-inline-threshold");
+#endif
+}
+
+}  // namespace remill::compat::llvm
@@ -23,3 +23,15 @@
 #if LLVM_VERSION_NUMBER >= LLVM_VERSION(7, 0)
 #  include <llvm/Transforms/Utils.h>
 #endif
+
+#include <llvm/Transforms/Scalar/GVN.h>
+
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(14, 0)
+
+namespace llvm {
+
+using GVNPass = GVN;
+
+}  // namespace llvm
+
+#endif
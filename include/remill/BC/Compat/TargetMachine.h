@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/CodeGen/ParallelCG.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <functional>
+#include <memory>
+
+#include "remill/BC/Version.h"
+
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(14, 0)
+#  include <llvm/Support/TargetRegistry.h>
+#else
+#  include <llvm/MC/TargetRegistry.h>
+#endif
+
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(13, 0)
+#  include <llvm/Transforms/Utils/Cloning.h>
+#endif
+
+namespace remill::compat::llvm {
+
+// Splits `module` into as many parts as there are `outs`, and compiles each
+// of them into an object file on a thread of its own.
+//
+// Up to LLVM 12, `splitCodeGen` takes ownership of the module, so it gets a
+// copy.
+inline static void
+SplitCodeGen(::llvm::Module &module,
+             ::llvm::ArrayRef<::llvm::raw_pwrite_stream *> outs,
+             const std::function<std::unique_ptr<::llvm::TargetMachine>()>
+                 &create_target_machine) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(13, 0)
+  ::llvm::splitCodeGen(::llvm::CloneModule(module), outs, {},
+                       create_target_machine, ::llvm::CGFT_ObjectFile);
+#else
+  ::llvm::splitCodeGen(module, outs, {}, create_target_machine,
+                       ::llvm::CGFT_ObjectFile);
+#endif
+}
+
+}  // namespace remill::compat::llvm
@@ -26,6 +26,7 @@ class Module;
 namespace remill {
 
 class Arch;
+class LiftStats;
 
 // A field or region of the state structure at a particular offset from
 // the top of the state structure (offset 0) with a given size. You can think
@@ -55,10 +56,12 @@ std::vector<StateSlot> StateSlots(const remill::Arch *arch,
                                   llvm::Module *module);
 
 // Analyze a module, discover aliasing loads and stores, and remove dead
-// stores into the `State` structure.
+// stores into the `State` structure. The dead stores of the traces in
+// `lift_stats`, if given, are added to their `num_dead_stores`.
 void RemoveDeadStores(const remill::Arch *arch, llvm::Module *module,
                       llvm::Function *bb_func,
                       const std::vector<StateSlot> &slots,
-                      llvm::Function *ds_func = nullptr);
+                      llvm::Function *ds_func = nullptr,
+                      LiftStats *lift_stats = nullptr);
 
 }  // namespace remill
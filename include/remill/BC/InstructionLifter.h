@@ -37,6 +37,7 @@ namespace remill {
 class Arch;
 class Instruction;
 class IntrinsicTable;
+class LiftStats;
 class Operand;
 class OperandExpression;
 class TraceLifter;
@@ -58,13 +59,17 @@ class InstructionLifter {
   virtual ~InstructionLifter(void);
 
   inline InstructionLifter(const std::unique_ptr<const Arch> &arch_,
-                           const IntrinsicTable &intrinsics_)
-      : InstructionLifter(arch_.get(), &intrinsics_) {}
+                           const IntrinsicTable &intrinsics_,
+                           LiftStats *stats_ = nullptr)
+      : InstructionLifter(arch_.get(), &intrinsics_, stats_) {}
 
-  inline InstructionLifter(const Arch *arch_, const IntrinsicTable &intrinsics_)
-      : InstructionLifter(arch_, &intrinsics_) {}
+  inline InstructionLifter(const Arch *arch_, const IntrinsicTable &intrinsics_,
+                           LiftStats *stats_ = nullptr)
+      : InstructionLifter(arch_, &intrinsics_, stats_) {}
 
-  InstructionLifter(const Arch *arch_, const IntrinsicTable *intrinsics_);
+  // Instructions without semantics are counted in `stats_`, if given.
+  InstructionLifter(const Arch *arch_, const IntrinsicTable *intrinsics_,
+                    LiftStats *stats_ = nullptr);
 
   // Lift a single instruction into a basic block. `is_delayed` signifies that
   // this instruction will execute within the delay slot of another instruction.
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace remill {
+
+// What lifting and optimizing one trace took, and what came out of it.
+struct TraceStats {
+  uint64_t addr{0};
+
+  // Instructions that were decoded, and how many of them were lifted into
+  // calls to their semantics or into calls to the semantics of invalid or
+  // unsupported instructions. Delayed instructions are counted too.
+  uint64_t num_decoded{0};
+  uint64_t num_lifted{0};
+  uint64_t num_unsupported{0};
+
+  // Time spent reading and decoding the bytes of instructions, and lifting
+  // the decoded instructions.
+  uint64_t decode_ns{0};
+  uint64_t lift_ns{0};
+
+  // Size of the lifted function right after lifting, and after optimization,
+  // i.e. with the semantics inlined.
+  uint64_t num_ir_insts{0};
+  uint64_t num_optimized_ir_insts{0};
+
+  // Stores into `State` removed by the dead store eliminator.
+  uint64_t num_dead_stores{0};
+
+  void Merge(const TraceStats &that);
+};
+
+// Statistics about lifting a module, by trace, to find the traces that blow
+// up compile time and code size. `TraceLifter` and `InstructionLifter` fill
+// them in as they lift, and `OptimizeModule` after optimizing, if they are
+// given one.
+//
+// This isn't thread-safe. Threads that lift modules of their own should each
+// have one, and `Merge` them.
+class LiftStats {
+ public:
+  // Returns the stats of the trace lifted into the function `name`.
+  TraceStats &Trace(std::string_view name);
+
+  // Returns the stats of the trace lifted into the function `name`, or
+  // `nullptr` if it wasn't lifted with these stats.
+  TraceStats *FindTrace(std::string_view name);
+
+  // Counts an instruction whose semantics `isel_name` don't exist.
+  void AddUnsupportedInstruction(std::string_view isel_name);
+
+  void Merge(const LiftStats &that);
+
+  // Returns the sums over all traces.
+  TraceStats Total(void) const;
+
+  // Writes the totals, the unsupported instructions and the traces, in order
+  // of their addresses, to `path` as JSON. Returns `false` if the file can't
+  // be written.
+  bool WriteJSON(const std::string &path) const;
+
+  std::map<std::string, TraceStats, std::less<>> traces;
+  std::map<std::string, uint64_t, std::less<>> unsupported_isels;
+};
+
+}  // namespace remill
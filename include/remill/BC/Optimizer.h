@@ -25,11 +25,14 @@
 #include <llvm/IR/Module.h>
 #pragma clang diagnostic pop
 
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -40,6 +43,22 @@ class Function;
 namespace remill {
 
 class Arch;
+class LiftStats;
+
+// Named starting points for an `OptimizationGuide`. A zero-initialized guide
+// is `kOptimizationMaxSpeed`.
+enum OptimizationProfile : uint32_t {
+  kOptimizationMaxSpeed,     // `-O3`.
+  kOptimizationBalanced,     // `-O2`.
+  kOptimizationFastCompile,  // `-O1`.
+  kOptimizationSize,         // `-Os`.
+  kOptimizationInvalid,
+};
+
+// Profiles are named `max-speed`, `balanced`, `fast-compile` and `size`.
+OptimizationProfile GetOptimizationProfile(std::string_view name);
+
+std::string_view GetOptimizationProfileName(OptimizationProfile profile);
 
 struct OptimizationGuide {
   bool slp_vectorize;
@@ -47,8 +66,40 @@ struct OptimizationGuide {
   bool verify_input;
   bool verify_output;
   bool eliminate_dead_stores;
+
+  // The level of the LLVM pipeline.
+  OptimizationProfile profile;
+
+  // Overrides the inline threshold of the `profile` if non-zero.
+  unsigned inline_threshold;
+
+  bool disable_loop_unrolling;
+
+  // Cache the `State` fields that lifted functions access in locals, and only
+  // write them back around calls that are passed `State`. See
+  // `PromoteStateToLocals`.
+  bool promote_state_to_locals;
+
+  // Don't let `OptimizeModule` inline the lifted functions into each other,
+  // so that each one comes out the same no matter what else is lifted with
+  // it, or how the functions are split between threads.
+  bool isolate_functions;
+
+  // If non-empty, the time spent in, and the change in instruction count made
+  // by, each pass are written to this file as JSON.
+  std::string report_filename;
+
+  // If non-null, the size of every optimized trace in `stats`, and the dead
+  // stores removed from it, are recorded there.
+  LiftStats *stats;
 };
 
+// Returns the guide of `profile`, whose fields can then be changed one by one.
+// `kOptimizationFastCompile` doesn't unroll loops, vectorize or eliminate dead
+// stores, and `kOptimizationSize` doesn't unroll or vectorize. The others
+// eliminate dead stores, which has to be turned off for `OptimizeBareModule`.
+OptimizationGuide GetOptimizationGuide(OptimizationProfile profile);
+
 template <typename T>
 inline static void
 OptimizeModule(const std::unique_ptr<const remill::Arch> &arch,
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+namespace remill {
+
+// Caches the fields of the `State` structure that the lifted function `func`
+// loads and stores in `alloca`s, so that `mem2reg` can keep them in virtual
+// registers for the whole function.
+//
+// LLVM can't do this by itself, because the `State` pointer is passed to
+// control-flow intrinsics and other lifted functions, after which any opaque
+// call (e.g. a memory intrinsic) might access `State`. Here, like in the dead
+// store eliminator, only the things that are passed a pointer into `State`
+// are assumed to access it. The cached values are written back into `State`
+// before each of those, and before returning, and are reloaded after them.
+//
+// Returns the number of fields promoted, which is zero if `func` was left
+// alone.
+uint64_t PromoteStateToLocals(llvm::Function *func);
+
+}  // namespace remill
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <remill/BC/LiftStats.h>
 #include <remill/BC/Lifter.h>
 
 #include <functional>
@@ -71,14 +72,41 @@ class TraceManager {
   // lifter to support devirtualization, e.g. handling jump tables as
   // `switch` statements, or handling indirect calls through the PLT as
   // direct jumps.
+  //
+  // The targets of indirect jumps become the cases of a `switch` on the next
+  // program counter, whose default still goes to `__remill_jump`. Trace-local
+  // targets are lifted into the current trace, trace heads are tail-called.
   virtual void ForEachDevirtualizedTarget(
       const Instruction &inst,
       std::function<void(uint64_t, DevirtualizedTargetKind)> func);
 
+  // Apply a callback to every secondary entry of the trace at `trace_addr`,
+  // i.e. to the addresses of blocks inside of the trace where it can be
+  // entered, too. They are lifted into the trace even if nothing in it goes
+  // there, and the trace starts with a `switch` on its PC argument that
+  // branches to the block of the PC. By default, traces are only entered at
+  // their head.
+  virtual void ForEachSecondaryEntry(uint64_t trace_addr,
+                                     std::function<void(uint64_t)> func);
+
+  // Whether the taken side of a conditional direct call calls
+  // `__remill_function_call` before it calls the lifted target, as a marker of
+  // the call. Runtimes whose `__remill_function_call` dispatches to the
+  // target would run it twice, and should return `false`. Defaults to `true`.
+  virtual bool MarkConditionalDirectCalls(void);
+
   // Try to read an executable byte of memory. Returns `true` of the byte
   // at address `addr` is executable and readable, and updates the byte
   // pointed to by `byte` with the read value.
   virtual bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) = 0;
+
+  // Try to read up to `num_bytes` executable bytes starting at `addr` into
+  // `bytes`. Returns the number of bytes read, stopping at the first byte that
+  // isn't executable or readable. The default implementation falls back on
+  // `TryReadExecutableByte`; managers backed by flat memory should override
+  // this to fetch a whole instruction window at once.
+  virtual size_t TryReadExecutableBytes(uint64_t addr, uint8_t *bytes,
+                                        size_t num_bytes);
 };
 
 // Implements a recursive decoder that lifts a trace of instructions to bitcode.
@@ -86,13 +114,21 @@ class TraceLifter {
  public:
   ~TraceLifter(void);
 
-  inline TraceLifter(InstructionLifter &inst_lifter_, TraceManager &manager_)
-      : TraceLifter(&inst_lifter_, &manager_) {}
+  inline TraceLifter(InstructionLifter &inst_lifter_, TraceManager &manager_,
+                     LiftStats *stats_ = nullptr)
+      : TraceLifter(&inst_lifter_, &manager_, stats_) {}
 
-  TraceLifter(InstructionLifter *inst_lifter_, TraceManager *manager_);
+  // What it takes to decode and lift every trace is recorded in `stats_`, if
+  // given.
+  TraceLifter(InstructionLifter *inst_lifter_, TraceManager *manager_,
+              LiftStats *stats_ = nullptr);
 
   static void NullCallback(uint64_t, llvm::Function *);
 
+  // Returns the number of instructions lifted by this lifter so far, including
+  // those in delay slots.
+  uint64_t NumLiftedInstructions(void) const;
+
   // Lift one or more traces starting from `addr`. Calls `callback` with each
   // lifted trace.
   bool
@@ -56,6 +56,7 @@ class PointerType;
 class Type;
 class Value;
 class LLVMContext;
+class MemoryBuffer;
 }  // namespace llvm
 
 namespace remill {
@@ -150,17 +151,39 @@ std::unique_ptr<llvm::Module> LoadModuleFromFile(llvm::LLVMContext *context,
 // Parses bitcode from memory
 std::unique_ptr<llvm::Module> LoadModuleFromMemory(llvm::LLVMContext *context,
                                                  std::string_view module_data,
-                                                 bool allow_failure = false);
+                                                 bool allow_failure = false,
+                                                 bool verify = true);
+
+// How `LoadArchSemantics` should load the semantics module.
+struct SemanticsLoadGuide {
+
+  // Only deserialize the bodies of semantics functions when
+  // `MaterializeUsedFunctions` asks for them, rather than all of them up front.
+  bool lazy{false};
+
+  // Run the verifier on the loaded functions. The embedded semantics are built
+  // alongside remill, so this can be skipped when they are trusted.
+  bool verify{true};
+};
 
 // Loads the semantics for the `arch`-specific machine, i.e. the machine of the
 // code that we want to lift.
-std::unique_ptr<llvm::Module> LoadArchSemantics(const Arch *arch);
+std::unique_ptr<llvm::Module> LoadArchSemantics(const Arch *arch,
+                                                SemanticsLoadGuide guide = {});
 
 inline std::unique_ptr<llvm::Module>
-LoadArchSemantics(const std::unique_ptr<const Arch> &arch) {
-  return LoadArchSemantics(arch.get());
+LoadArchSemantics(const std::unique_ptr<const Arch> &arch,
+                  SemanticsLoadGuide guide = {}) {
+  return LoadArchSemantics(arch.get(), guide);
 }
 
+// Deserializes the bodies of all functions in a lazily loaded `module` that
+// are reachable from functions that already have bodies (e.g. lifted code),
+// and turns the remaining, unused semantics functions into declarations. This
+// must be called before optimizing a module loaded with `guide.lazy` set, and
+// does nothing for modules that were fully loaded.
+void MaterializeUsedFunctions(llvm::Module *module, bool verify = true);
+
 // Store an LLVM module into a file.
 bool StoreModuleToFile(llvm::Module *module, std::string_view file_name,
                        bool allow_failure = false);
@@ -179,6 +202,12 @@ std::string FindHostSemanticsBitcodeFile(void) __attribute__((deprecated));
 // Find a semantics bitcode file for the architecture `arch`.
 std::string FindSemanticsBitcode(std::string_view arch);
 
+// Find the semantics bitcode for the architecture `arch`, without copying it.
+// The returned buffer refers to the embedded semantics, or to a mapping of the
+// file found in `--semantics_search_paths`.
+std::unique_ptr<llvm::MemoryBuffer>
+FindSemanticsBitcodeBuffer(std::string_view arch);
+
 // Return a pointer to the Nth argument (N=0 is the first argument).
 llvm::Argument *NthArgument(llvm::Function *func, size_t index);
 
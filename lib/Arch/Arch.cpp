@@ -85,6 +85,26 @@ bool Arch::MemoryAccessIsLittleEndian(void) const {
   return true;
 }
 
+// Linearly decode a run of consecutive instructions.
+size_t Arch::DecodeInstructions(uint64_t address, std::string_view instr_bytes,
+                                Instruction *insts, size_t max_insts) const {
+  const auto max_inst_size = MaxInstructionSize();
+  size_t num_insts = 0;
+  size_t offset = 0;
+  while (num_insts < max_insts && offset < instr_bytes.size()) {
+    auto &inst = insts[num_insts];
+    inst.Reset();
+    if (!DecodeInstruction(address + offset,
+                           instr_bytes.substr(offset, max_inst_size), inst) ||
+        inst.bytes.empty()) {
+      break;
+    }
+    offset += inst.bytes.size();
+    ++num_insts;
+  }
+  return num_insts;
+}
+
 // Returns `true` if a given instruction might have a delay slot.
 bool Arch::MayHaveDelaySlot(const Instruction &) const {
   return false;
@@ -276,16 +296,39 @@ void Arch::ForEachRegister(std::function<void(const Register *)> cb) const {
 
 // Return information about a register, given its name.
 const Register *Arch::RegisterByName(std::string_view name_) const {
-  std::string name(name_.data(), name_.size());
-  auto [curr_val_it, added] =
-      impl->reg_by_name.emplace(std::move(name), nullptr);
-  if (added) {
+
+  // NOTE: Looked up with `find`, as `emplace` would allocate a node for every
+  //       lookup, even of known registers.
+  auto curr_val_it = impl->reg_by_name.find(std::string(name_));
+  if (curr_val_it == impl->reg_by_name.end()) {
     return nullptr;
   } else {
     return curr_val_it->second;
   }
 }
 
+// Return the ID of a semantics function in the ISEL index, given its name.
+uint32_t Arch::ISelId(std::string_view function) const {
+  if (!impl) {
+    return kInvalidISelId;
+  }
+  auto it = impl->isel_ids.find(function);
+  if (it == impl->isel_ids.end()) {
+    return kInvalidISelId;
+  }
+  return it->second;
+}
+
+// Return the name of a semantics function, given its ISEL ID.
+std::string_view Arch::ISelName(uint32_t id) const {
+  CHECK_LT(id, NumISels());
+  return impl->isel_names[id];
+}
+
+size_t Arch::NumISels(void) const {
+  return impl ? impl->isel_names.size() : 0u;
+}
+
 namespace {
 
 // NOTE(lukas): Structure that allows global caching of `Arch` objects,
@@ -784,6 +827,27 @@ void Arch::InitFromSemanticsModule(llvm::Module *module) const {
 
   CHECK(BlockHasSpecialVars(basic_block))
       << "Unable to locate required variables in `__remill_basic_block`.";
+
+  // Index the semantics functions once, so that lifting an instruction doesn't
+  // need to format and look up the name of its `ISEL_` variable. Every module
+  // of semantics has the same ones, and the keys of `isel_ids` point into
+  // `isel_names`, so it must not change on later calls.
+  if (!impl->isel_names.empty()) {
+    return;
+  }
+  for (auto &var : module->globals()) {
+    auto name = var.getName();
+    if (name.startswith("ISEL_")) {
+      impl->isel_names.emplace_back(name.drop_front(5).str());
+    }
+  }
+  std::sort(impl->isel_names.begin(), impl->isel_names.end());
+  impl->isel_ids.reserve(impl->isel_names.size());
+  for (uint32_t id = 0; id < impl->isel_names.size(); ++id) {
+    impl->isel_ids.emplace(impl->isel_names[id], id);
+  }
+
+  PopulateISelIds();
 }
 
 }  // namespace remill
@@ -20,6 +20,8 @@
 #include <remill/Arch/Arch.h>
 
 #include <memory>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -49,6 +51,11 @@ class ArchImpl {
   std::vector<std::unique_ptr<Register>> registers;
   std::vector<const Register *> reg_by_offset;
   std::unordered_map<std::string, const Register *> reg_by_name;
+
+  // Names of the semantics functions with an `ISEL_` variable, sorted, and
+  // their index into `isel_names`.
+  std::vector<std::string> isel_names;
+  std::unordered_map<std::string_view, uint32_t> isel_ids;
 };
 
 }  // namespace remill
@@ -303,7 +303,8 @@ std::string Condition::Serialize(void) const {
 
 
 Instruction::Instruction(void)
-    : pc(0),
+    : isel_id(kInvalidISelId),
+      pc(0),
       next_pc(0),
       delayed_pc(0),
       branch_taken_pc(0),
@@ -323,14 +324,17 @@ void Instruction::Reset(void) {
   branch_taken_pc = 0;
   branch_not_taken_pc = 0;
   arch_name = kArchInvalid;
+  sub_arch_name = kArchInvalid;
   is_atomic_read_modify_write = false;
   has_branch_taken_delay_slot = false;
   has_branch_not_taken_delay_slot = false;
   in_delay_slot = false;
   category = Instruction::kCategoryInvalid;
   arch = nullptr;
+  segment_override = nullptr;
   operands.clear();
   function.clear();
+  isel_id = kInvalidISelId;
   bytes.clear();
   next_expr_index = 0;
 }
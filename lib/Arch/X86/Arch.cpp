@@ -25,10 +25,12 @@
 #include <llvm/IR/Module.h>
 
 #include <iomanip>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "XED.h"
 #include "remill/Arch/Instruction.h"
@@ -337,8 +339,47 @@ std::map<xed_iform_enum_t, xed_iform_enum_t> kUnlockedIform = {
     {XED_IFORM_XCHG_MEMb_GPR8, XED_IFORM_XCHG_MEMb_GPR8},
 };
 
-// Name of this instruction function.
-static std::string InstructionFunctionName(const xed_decoded_inst_t *xedd) {
+// Interned names of the semantics functions of every iform, unsuffixed and
+// suffixed with each of the operand widths of scalable instructions.
+static constexpr unsigned kScalableWidths[] = {8, 16, 32, 64};
+static constexpr unsigned kNumNamesPerIform = 1 + std::size(kScalableWidths);
+
+static const std::vector<std::string> &IformFunctionNames(void) {
+  static const auto kNames = [] {
+    std::vector<std::string> names(XED_IFORM_LAST * kNumNamesPerIform);
+    for (unsigned i = 0; i < XED_IFORM_LAST; ++i) {
+      std::string name = xed_iform_enum_t2str(static_cast<xed_iform_enum_t>(i));
+      for (unsigned w = 0; w < std::size(kScalableWidths); ++w) {
+        names[i * kNumNamesPerIform + w + 1] =
+            name + "_" + std::to_string(kScalableWidths[w]);
+      }
+      names[i * kNumNamesPerIform] = std::move(name);
+    }
+    return names;
+  }();
+  return kNames;
+}
+
+// Returns the index into `IformFunctionNames`, or `-1` for unusual widths.
+static int IformFunctionNameIndex(xed_iform_enum_t iform, unsigned width) {
+  const int base = static_cast<int>(iform * kNumNamesPerIform);
+  if (!width) {
+    return base;
+  }
+  for (unsigned w = 0; w < std::size(kScalableWidths); ++w) {
+    if (kScalableWidths[w] == width) {
+      return base + static_cast<int>(w + 1);
+    }
+  }
+  return -1;
+}
+
+// Sets `name` to the name of the semantics function of the instruction. This
+// reuses the storage of `name`, and doesn't format anything for all but a
+// handful of iforms. Returns the index of `name` in `IformFunctionNames`, or
+// `-1` if it isn't one of them.
+static int InstructionFunctionName(const xed_decoded_inst_t *xedd,
+                                   std::string &name) {
 
   // If this instuction is marked as atomic via the `LOCK` prefix then we want
   // to remove it because we will already be surrounding the call to the
@@ -350,17 +391,22 @@ static std::string InstructionFunctionName(const xed_decoded_inst_t *xedd) {
     iform = kUnlockedIform[iform];
   }
 
-  std::stringstream ss;
-  std::string iform_name = xed_iform_enum_t2str(iform);
-  ss << iform_name;
-
   // Some instructions are "scalable", i.e. there are variants of the
   // instruction for each effective operand size. We represent these in
   // the semantics files with `_<size>`, so we need to look up the correct
   // selection.
+  unsigned width = 0;
   if (xed_decoded_inst_get_attribute(xedd, XED_ATTRIBUTE_SCALABLE)) {
-    ss << "_";
-    ss << xed_decoded_inst_get_operand_width(xedd);
+    width = xed_decoded_inst_get_operand_width(xedd);
+  }
+
+  auto index = IformFunctionNameIndex(iform, width);
+  if (0 <= index) {
+    name = IformFunctionNames()[static_cast<unsigned>(index)];
+  } else {
+    name = xed_iform_enum_t2str(iform);
+    name += "_";
+    name += std::to_string(width);
   }
 
   // Suffix the ISEL function name with the segment or control register names,
@@ -369,11 +415,12 @@ static std::string InstructionFunctionName(const xed_decoded_inst_t *xedd) {
   if (XED_IFORM_MOV_SEG_MEMw == iform || XED_IFORM_MOV_SEG_GPR16 == iform ||
       XED_IFORM_MOV_CR_CR_GPR32 == iform ||
       XED_IFORM_MOV_CR_CR_GPR64 == iform) {
-    ss << "_";
-    ss << xed_reg_enum_t2str(xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0));
+    name += "_";
+    name += xed_reg_enum_t2str(xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0));
+    index = -1;
   }
 
-  return ss.str();
+  return index;
 }
 
 // Decode an instruction into the XED instuction format.
@@ -836,8 +883,14 @@ class X86Arch final : public Arch {
   void PopulateBasicBlockFunction(llvm::Module *module,
                                   llvm::Function *bb_func) const final;
 
+  // Resolve the ISEL ID of every name in `IformFunctionNames`.
+  void PopulateISelIds(void) const final;
+
  private:
   X86Arch(void) = delete;
+
+  // ISEL IDs of the names in `IformFunctionNames`.
+  mutable std::vector<uint32_t> iform_isel_ids;
 };
 
 X86Arch::X86Arch(llvm::LLVMContext *context_, OSName os_name_,
@@ -1172,6 +1225,7 @@ bool X86Arch::DecodeInstruction(uint64_t address, std::string_view inst_bytes,
   inst.sub_arch_name = kArchInvalid;
   inst.category = Instruction::kCategoryInvalid;
   inst.operands.clear();
+  inst.isel_id = kInvalidISelId;
 
   xed_decoded_inst_t xedd_;
   xed_decoded_inst_t *xedd = &xedd_;
@@ -1278,7 +1332,10 @@ bool X86Arch::DecodeInstruction(uint64_t address, std::string_view inst_bytes,
                                 len);
 
   } else {
-    inst.function = InstructionFunctionName(xedd);
+    const auto name_index = InstructionFunctionName(xedd, inst.function);
+    if (0 <= name_index && !iform_isel_ids.empty()) {
+      inst.isel_id = iform_isel_ids[static_cast<unsigned>(name_index)];
+    }
     for (auto i = 0U; i < num_operands; ++i) {
       auto xedo = xed_inst_operand(xedi, i);
       if (XED_OPVIS_SUPPRESSED != xed_operand_operand_visibility(xedo)) {
@@ -1731,6 +1788,16 @@ void X86Arch::PopulateRegisterTable(void) const {
   //#endif
 }
 
+// Resolve the ISEL ID of every name in `IformFunctionNames`, so that decoding
+// an instruction hands back its ID without looking up its name.
+void X86Arch::PopulateISelIds(void) const {
+  const auto &names = IformFunctionNames();
+  iform_isel_ids.resize(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    iform_isel_ids[i] = ISelId(names[i]);
+  }
+}
+
 // Populate the `__remill_basic_block` function with variables.
 void X86Arch::PopulateBasicBlockFunction(llvm::Module *module,
                                          llvm::Function *bb_func) const {
@@ -22,6 +22,7 @@
 #include "remill/Arch/Runtime/Float.h"
 #include "remill/Arch/Runtime/Intrinsics.h"
 #include "remill/Arch/Runtime/Operators.h"
+#include "remill/Arch/X86/Runtime/LazyFlags.h"
 #include "remill/Arch/X86/Runtime/State.h"
 #include "remill/Arch/X86/Runtime/Types.h"
 #include "remill/Arch/X86/Runtime/Operators.h"
@@ -98,12 +99,20 @@
 #  define REG_XBX REG_EBX
 #endif  // 64 == ADDRESS_SIZE_BITS
 
-#define FLAG_CF state.aflag.cf
-#define FLAG_PF state.aflag.pf
-#define FLAG_AF state.aflag.af
-#define FLAG_ZF state.aflag.zf
-#define FLAG_SF state.aflag.sf
-#define FLAG_OF state.aflag.of
+// With lazy flags, accessing any of the arithmetic flags first computes them
+// from the last recorded operation. The direction flag is never recorded.
+#ifdef REMILL_X86_LAZY_FLAGS
+#  define STATE_AFLAG MaterializeLazyFlags(state)
+#else
+#  define STATE_AFLAG state.aflag
+#endif  // REMILL_X86_LAZY_FLAGS
+
+#define FLAG_CF STATE_AFLAG.cf
+#define FLAG_PF STATE_AFLAG.pf
+#define FLAG_AF STATE_AFLAG.af
+#define FLAG_ZF STATE_AFLAG.zf
+#define FLAG_SF STATE_AFLAG.sf
+#define FLAG_OF STATE_AFLAG.of
 #define FLAG_DF state.aflag.df
 
 #define X87_ST0 state.st.elems[0].val
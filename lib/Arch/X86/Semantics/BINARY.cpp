@@ -29,8 +29,15 @@ ALWAYS_INLINE static void WriteFlagsIncDec(State &state, T lhs, T rhs, T res) {
 
 template <typename Tag, typename T>
 ALWAYS_INLINE static void WriteFlagsAddSub(State &state, T lhs, T rhs, T res) {
+#ifdef REMILL_X86_LAZY_FLAGS
+  RecordLazyFlags(
+      state,
+      std::is_same<Tag, tag_add>::value ? kLazyFlagsAdd : kLazyFlagsSub,
+      lhs, rhs, res);
+#else
   FLAG_CF = Carry<Tag>::Flag(lhs, rhs, res);
   WriteFlagsIncDec<Tag>(state, lhs, rhs, res);
+#endif  // REMILL_X86_LAZY_FLAGS
 }
 
 template <typename D, typename S1, typename S2>
@@ -172,16 +172,16 @@ struct Carry<tag_sub> {
 
 }  // namespace
 
-#define UndefFlag(name) do { state.aflag.name = __remill_undefined_8(); } while (false)
+#define UndefFlag(name) do { STATE_AFLAG.name = __remill_undefined_8(); } while (false)
 
 #define ClearArithFlags() \
   do { \
-    state.aflag.cf = __remill_undefined_8(); \
-    state.aflag.pf = __remill_undefined_8(); \
-    state.aflag.af = __remill_undefined_8(); \
-    state.aflag.zf = __remill_undefined_8(); \
-    state.aflag.sf = __remill_undefined_8(); \
-    state.aflag.of = __remill_undefined_8(); \
+    STATE_AFLAG.cf = __remill_undefined_8(); \
+    STATE_AFLAG.pf = __remill_undefined_8(); \
+    STATE_AFLAG.af = __remill_undefined_8(); \
+    STATE_AFLAG.zf = __remill_undefined_8(); \
+    STATE_AFLAG.sf = __remill_undefined_8(); \
+    STATE_AFLAG.of = __remill_undefined_8(); \
   } while (false)
 
 
@@ -20,12 +20,16 @@ namespace {
 
 template <typename T>
 ALWAYS_INLINE void SetFlagsLogical(State &state, T lhs, T rhs, T res) {
-  state.aflag.cf = false;
-  state.aflag.pf = ParityFlag(res);
-  state.aflag.zf = ZeroFlag(res);
-  state.aflag.sf = SignFlag(res);
-  state.aflag.of = false;
-  state.aflag.af = false;  // Undefined, but ends up being `0`.
+#ifdef REMILL_X86_LAZY_FLAGS
+  RecordLazyFlags(state, kLazyFlagsLogical, lhs, rhs, res);
+#else
+  FLAG_CF = false;
+  FLAG_PF = ParityFlag(res);
+  FLAG_ZF = ZeroFlag(res);
+  FLAG_SF = SignFlag(res);
+  FLAG_OF = false;
+  FLAG_AF = false;  // Undefined, but ends up being `0`.
+#endif  // REMILL_X86_LAZY_FLAGS
 }
 
 template <typename D, typename S1, typename S2>
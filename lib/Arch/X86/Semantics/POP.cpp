@@ -78,13 +78,13 @@ DEF_SEM(DoPOPAD) {
 DEF_SEM(DoPOPFD) {
   Flags f;
   f.flat = ZExt(PopFromStack<uint32_t>(memory, state));
-  state.aflag.af = f.af;
-  state.aflag.cf = f.cf;
-  state.aflag.df = f.df;
-  state.aflag.of = f.of;
-  state.aflag.pf = f.pf;
-  state.aflag.sf = f.sf;
-  state.aflag.zf = f.zf;
+  FLAG_AF = f.af;
+  FLAG_CF = f.cf;
+  FLAG_DF = f.df;
+  FLAG_OF = f.of;
+  FLAG_PF = f.pf;
+  FLAG_SF = f.sf;
+  FLAG_ZF = f.zf;
 
   state.rflag.id = f.id;
 
@@ -99,13 +99,13 @@ DEF_SEM(DoPOPFD) {
 DEF_SEM(DoPOPFQ) {
   Flags f;
   f.flat = PopFromStack<uint64_t>(memory, state);
-  state.aflag.af = f.af;
-  state.aflag.cf = f.cf;
-  state.aflag.df = f.df;
-  state.aflag.of = f.of;
-  state.aflag.pf = f.pf;
-  state.aflag.sf = f.sf;
-  state.aflag.zf = f.zf;
+  FLAG_AF = f.af;
+  FLAG_CF = f.cf;
+  FLAG_DF = f.df;
+  FLAG_OF = f.of;
+  FLAG_PF = f.pf;
+  FLAG_SF = f.sf;
+  FLAG_ZF = f.zf;
 
   state.rflag.id = f.id;
 
@@ -120,13 +120,13 @@ DEF_SEM(DoPOPFQ) {
 DEF_SEM(DoPOPF) {
   Flags f;
   f.flat = ZExt(ZExt(PopFromStack<uint16_t>(memory, state)));
-  state.aflag.af = f.af;
-  state.aflag.cf = f.cf;
-  state.aflag.df = f.df;
-  state.aflag.of = f.of;
-  state.aflag.pf = f.pf;
-  state.aflag.sf = f.sf;
-  state.aflag.zf = f.zf;
+  FLAG_AF = f.af;
+  FLAG_CF = f.cf;
+  FLAG_DF = f.df;
+  FLAG_OF = f.of;
+  FLAG_PF = f.pf;
+  FLAG_SF = f.sf;
+  FLAG_ZF = f.zf;
   return memory;
 }
 }  // namespace
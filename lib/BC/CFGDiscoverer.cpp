@@ -0,0 +1,778 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remill/BC/CFGDiscoverer.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+
+namespace remill {
+namespace {
+
+// Jump tables without a bounds check end at the first entry that isn't the
+// address of code, or after this many entries.
+static constexpr size_t kMaxJumpTableEntries = 4096u;
+
+// How many instructions from a relocated pointer into code have to decode
+// before it is taken as the start of a block, unless the block ends earlier.
+static constexpr size_t kMaxCodePointerCheckInstructions = 16u;
+
+// The set of block addresses is split into shards, each with a lock of its
+// own, so that the threads rarely wait for each other.
+static constexpr size_t kNumLeaderShards = 64u;
+
+struct Region {
+  uint64_t addr;
+  std::string_view bytes;
+  bool is_executable;
+
+  inline uint64_t EndAddress(void) const {
+    return addr + bytes.size();
+  }
+};
+
+// Which indices a conditional branch right after `cmp index, n` lets through
+// to one of its sides.
+enum RangeCheck : uint8_t {
+  kRangeCheckNone,
+
+  // `ja` and `jae`: `[0, n]` and `[0, n)` are not taken.
+  kRangeCheckNotTakenInclusive,
+  kRangeCheckNotTakenExclusive,
+
+  // `jbe` and `jb`: `[0, n]` and `[0, n)` are taken.
+  kRangeCheckTakenInclusive,
+  kRangeCheckTakenExclusive,
+};
+
+// What's left of a decoded instruction.
+struct DecodedInst {
+  uint64_t addr;
+  uint64_t next_pc;
+  uint64_t branch_taken_pc;
+  uint64_t branch_not_taken_pc;
+  Instruction::Category category;
+  RangeCheck range_check;
+  bool is_valid;
+};
+
+// `cmp reg, imm`.
+struct Comparison {
+  std::string reg;
+  uint64_t imm;
+};
+
+// `jmp [table + index * scale]`, which may be a jump through a jump table.
+struct IndirectJump {
+  std::string index_reg;
+  uint64_t table_addr;
+  uint64_t scale;
+};
+
+struct WorkQueue {
+  std::mutex lock;
+  std::deque<uint64_t> addrs;
+};
+
+struct LeaderShard {
+  std::mutex lock;
+  std::unordered_set<uint64_t> addrs;
+};
+
+// What one thread found, merged into the rest after every round.
+struct ThreadResults {
+  std::vector<DecodedInst> insts;
+  std::vector<std::pair<uint64_t, Comparison>> comparisons;
+  std::vector<std::pair<uint64_t, IndirectJump>> indirect_jumps;
+  std::vector<uint64_t> call_targets;
+};
+
+static RangeCheck GetRangeCheck(const Instruction &inst) {
+  const std::string_view name = inst.function;
+  if (name.rfind("JNBE", 0) == 0) {
+    return kRangeCheckNotTakenInclusive;
+  } else if (name.rfind("JNB", 0) == 0) {
+    return kRangeCheckNotTakenExclusive;
+  } else if (name.rfind("JBE", 0) == 0) {
+    return kRangeCheckTakenInclusive;
+  } else if (name.rfind("JB", 0) == 0) {
+    return kRangeCheckTakenExclusive;
+  } else {
+    return kRangeCheckNone;
+  }
+}
+
+// Returns `true` if `category` ends a block, as opposed to falling through.
+static bool EndsBlock(Instruction::Category category) {
+  switch (category) {
+    case Instruction::kCategoryNormal:
+    case Instruction::kCategoryNoOp:
+    case Instruction::kCategoryDirectFunctionCall:
+    case Instruction::kCategoryConditionalDirectFunctionCall:
+    case Instruction::kCategoryIndirectFunctionCall:
+    case Instruction::kCategoryConditionalIndirectFunctionCall:
+    case Instruction::kCategoryAsyncHyperCall:
+    case Instruction::kCategoryConditionalAsyncHyperCall: return false;
+    default: return true;
+  }
+}
+
+}  // namespace
+
+class CFGDiscoverer::Impl {
+ public:
+  explicit Impl(const Arch *arch_)
+      : arch(arch_),
+        addr_mask(arch->address_size >= 64 ? ~0ULL
+                                           : (~0ULL >> (64 - arch->address_size))),
+        max_inst_bytes(arch->MaxInstructionSize()) {}
+
+  const Region *FindRegion(uint64_t addr) const;
+  std::string_view CodeAt(uint64_t addr) const;
+  bool IsCode(uint64_t addr) const;
+  bool ReadWord(uint64_t addr, uint64_t size, uint64_t &val) const;
+  bool IsWithinRelocation(uint64_t addr) const;
+  bool LooksLikeCode(uint64_t addr) const;
+
+  bool IsLeader(uint64_t addr);
+  void Push(unsigned thread, uint64_t addr);
+  bool Pop(unsigned thread, uint64_t &addr);
+  void Work(unsigned thread);
+  void DecodeBlock(unsigned thread, uint64_t block_addr);
+  void RunWorkers(unsigned num_threads);
+  void MergeResults(void);
+  std::vector<uint64_t> SortedLeaders(void);
+  bool ResolveJumpTables(void);
+  DiscoveredCFG Build(void);
+
+  const Arch *const arch;
+  const uint64_t addr_mask;
+  const uint64_t max_inst_bytes;
+
+  // Sorted by address.
+  std::vector<Region> regions;
+  std::vector<uint64_t> entries;
+
+  // Sorted before discovery.
+  std::vector<uint64_t> relocations;
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<ThreadResults> thread_results;
+  std::array<LeaderShard, kNumLeaderShards> leaders;
+  std::atomic<size_t> num_pending{0};
+
+  // Everything found in the rounds so far.
+  std::map<uint64_t, DecodedInst> insts;
+  std::unordered_map<uint64_t, Comparison> comparisons;
+  std::map<uint64_t, IndirectJump> indirect_jumps;
+  std::set<uint64_t> call_targets;
+  std::map<uint64_t, DiscoveredJumpTable> jump_tables;
+};
+
+const Region *CFGDiscoverer::Impl::FindRegion(uint64_t addr) const {
+  auto it = std::upper_bound(
+      regions.begin(), regions.end(), addr,
+      [](uint64_t addr_, const Region &region) { return addr_ < region.addr; });
+  if (it == regions.begin()) {
+    return nullptr;
+  }
+  --it;
+  return addr < it->EndAddress() ? &*it : nullptr;
+}
+
+// Returns the bytes of the instruction at `addr`, and maybe some more, or
+// nothing if `addr` isn't executable.
+std::string_view CFGDiscoverer::Impl::CodeAt(uint64_t addr) const {
+  auto region = FindRegion(addr);
+  if (!region || !region->is_executable) {
+    return {};
+  }
+  return region->bytes.substr(addr - region->addr, max_inst_bytes);
+}
+
+bool CFGDiscoverer::Impl::IsCode(uint64_t addr) const {
+  auto region = FindRegion(addr);
+  return region && region->is_executable;
+}
+
+// Reads the little-endian word of `size` bytes at `addr`.
+bool CFGDiscoverer::Impl::ReadWord(uint64_t addr, uint64_t size,
+                                   uint64_t &val) const {
+  auto region = FindRegion(addr);
+  if (!region || (region->EndAddress() - addr) < size) {
+    return false;
+  }
+  val = 0;
+  for (uint64_t i = 0; i < size; ++i) {
+    val |= static_cast<uint64_t>(
+               static_cast<uint8_t>(region->bytes[addr - region->addr + i]))
+           << (i * 8u);
+  }
+  return true;
+}
+
+// Returns `true` if `addr` is one of the bytes of a relocated pointer.
+bool CFGDiscoverer::Impl::IsWithinRelocation(uint64_t addr) const {
+  auto it = std::upper_bound(relocations.begin(), relocations.end(), addr);
+  return it != relocations.begin() &&
+         addr - *std::prev(it) < arch->address_size / 8u;
+}
+
+// Returns `true` if `addr` plausibly starts code, rather than being data that
+// is kept in an executable section, e.g. a jump table or a string that an
+// instruction refers to. The instructions from `addr` up to the end of the
+// block, or the first few of them, must decode, and the first one can't be
+// inside a relocated pointer.
+bool CFGDiscoverer::Impl::LooksLikeCode(uint64_t addr) const {
+  if (IsWithinRelocation(addr)) {
+    return false;
+  }
+
+  Instruction inst;
+  auto pc = addr;
+  for (size_t i = 0; i < kMaxCodePointerCheckInstructions; ++i) {
+    inst.Reset();
+    const auto bytes = CodeAt(pc);
+    if (bytes.empty() || !arch->DecodeInstruction(pc, bytes, inst)) {
+      return false;
+    }
+    switch (inst.category) {
+      case Instruction::kCategoryInvalid:
+      case Instruction::kCategoryError: return false;
+      default:
+        if (EndsBlock(inst.category)) {
+          return true;
+        }
+        break;
+    }
+    pc = inst.next_pc & addr_mask;
+  }
+  return true;
+}
+
+bool CFGDiscoverer::Impl::IsLeader(uint64_t addr) {
+  auto &shard = leaders[addr % kNumLeaderShards];
+  std::lock_guard<std::mutex> locker(shard.lock);
+  return shard.addrs.count(addr) != 0;
+}
+
+// Queues the block at `addr` on the queue of `thread`, unless some thread
+// has queued it already.
+void CFGDiscoverer::Impl::Push(unsigned thread, uint64_t addr) {
+  addr &= addr_mask;
+  {
+    auto &shard = leaders[addr % kNumLeaderShards];
+    std::lock_guard<std::mutex> locker(shard.lock);
+    if (!shard.addrs.insert(addr).second) {
+      return;
+    }
+  }
+
+  num_pending++;
+  auto &queue = *queues[thread];
+  std::lock_guard<std::mutex> locker(queue.lock);
+  queue.addrs.push_back(addr);
+}
+
+// Takes the newest block off the queue of `thread`, or else steals the
+// oldest block of some other thread, which is likely to lead to the most
+// work of its own.
+bool CFGDiscoverer::Impl::Pop(unsigned thread, uint64_t &addr) {
+  {
+    auto &queue = *queues[thread];
+    std::lock_guard<std::mutex> locker(queue.lock);
+    if (!queue.addrs.empty()) {
+      addr = queue.addrs.back();
+      queue.addrs.pop_back();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < queues.size(); ++i) {
+    auto &victim = *queues[(thread + i) % queues.size()];
+    std::lock_guard<std::mutex> locker(victim.lock);
+    if (!victim.addrs.empty()) {
+      addr = victim.addrs.front();
+      victim.addrs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void CFGDiscoverer::Impl::Work(unsigned thread) {
+  uint64_t addr = 0;
+  while (true) {
+    if (Pop(thread, addr)) {
+      DecodeBlock(thread, addr);
+
+      // Only now, after its successors have been queued.
+      num_pending--;
+
+    } else if (!num_pending.load()) {
+      return;
+
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Decodes instructions starting at `block_addr` up to the end of the block,
+// and queues its successors and the functions it calls.
+void CFGDiscoverer::Impl::DecodeBlock(unsigned thread, uint64_t block_addr) {
+  auto &results = thread_results[thread];
+  Instruction inst;
+
+  for (auto pc = block_addr;; pc = inst.next_pc & addr_mask) {
+
+    // Fall through into the next block.
+    if (pc != block_addr && IsLeader(pc)) {
+      return;
+    }
+
+    inst.Reset();
+    const auto bytes = CodeAt(pc);
+    if (bytes.empty() || !arch->DecodeInstruction(pc, bytes, inst)) {
+      results.insts.push_back({pc, pc, 0, 0, Instruction::kCategoryInvalid,
+                               kRangeCheckNone, false});
+      return;
+    }
+
+    results.insts.push_back({pc, inst.next_pc & addr_mask,
+                             inst.branch_taken_pc & addr_mask,
+                             inst.branch_not_taken_pc & addr_mask,
+                             inst.category, kRangeCheckNone, true});
+
+    switch (inst.category) {
+      case Instruction::kCategoryInvalid:
+      case Instruction::kCategoryError:
+      case Instruction::kCategoryFunctionReturn: return;
+
+      case Instruction::kCategoryNormal:
+      case Instruction::kCategoryNoOp:
+        if (inst.function.rfind("CMP_", 0) == 0 && inst.operands.size() >= 2 &&
+            inst.operands[0].type == Operand::kTypeRegister &&
+            inst.operands[1].type == Operand::kTypeImmediate) {
+          results.comparisons.emplace_back(
+              pc, Comparison{inst.operands[0].reg.name,
+                             inst.operands[1].imm.val});
+        }
+        break;
+
+      case Instruction::kCategoryDirectFunctionCall:
+      case Instruction::kCategoryConditionalDirectFunctionCall:
+        results.call_targets.push_back(inst.branch_taken_pc & addr_mask);
+        Push(thread, inst.branch_taken_pc);
+        break;
+
+      case Instruction::kCategoryIndirectFunctionCall:
+      case Instruction::kCategoryConditionalIndirectFunctionCall:
+      case Instruction::kCategoryAsyncHyperCall:
+      case Instruction::kCategoryConditionalAsyncHyperCall: break;
+
+      case Instruction::kCategoryDirectJump:
+        Push(thread, inst.branch_taken_pc);
+        return;
+
+      case Instruction::kCategoryConditionalBranch:
+        results.insts.back().range_check = GetRangeCheck(inst);
+        Push(thread, inst.branch_taken_pc);
+        Push(thread, inst.branch_not_taken_pc);
+        return;
+
+      // Jump tables are resolved once all threads are done.
+      case Instruction::kCategoryIndirectJump:
+        for (const auto &op : inst.operands) {
+          if (op.type == Operand::kTypeAddress && op.addr.IsMemoryAccess() &&
+              !op.addr.index_reg.name.empty() && op.addr.base_reg.name.empty() &&
+              op.addr.scale > 0) {
+            results.indirect_jumps.emplace_back(
+                pc, IndirectJump{op.addr.index_reg.name,
+                                 static_cast<uint64_t>(op.addr.displacement) &
+                                     addr_mask,
+                                 static_cast<uint64_t>(op.addr.scale)});
+            break;
+          }
+        }
+        return;
+
+      case Instruction::kCategoryConditionalIndirectJump:
+      case Instruction::kCategoryConditionalFunctionReturn:
+        Push(thread, inst.next_pc);
+        return;
+    }
+  }
+}
+
+void CFGDiscoverer::Impl::RunWorkers(unsigned num_threads) {
+  std::vector<std::thread> threads;
+  for (auto t = 1u; t < num_threads; ++t) {
+    threads.emplace_back([=](void) { Work(t); });
+  }
+  Work(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void CFGDiscoverer::Impl::MergeResults(void) {
+  for (auto &results : thread_results) {
+    for (const auto &inst : results.insts) {
+      insts.emplace(inst.addr, inst);
+    }
+    for (auto &cmp : results.comparisons) {
+      comparisons.emplace(cmp.first, std::move(cmp.second));
+    }
+    for (auto &jump : results.indirect_jumps) {
+      indirect_jumps.emplace(jump.first, std::move(jump.second));
+    }
+    call_targets.insert(results.call_targets.begin(),
+                        results.call_targets.end());
+    results = ThreadResults();
+  }
+}
+
+std::vector<uint64_t> CFGDiscoverer::Impl::SortedLeaders(void) {
+  std::vector<uint64_t> addrs;
+  for (auto &shard : leaders) {
+    std::lock_guard<std::mutex> locker(shard.lock);
+    addrs.insert(addrs.end(), shard.addrs.begin(), shard.addrs.end());
+  }
+  std::sort(addrs.begin(), addrs.end());
+  return addrs;
+}
+
+// Reads the targets of the indirect jumps found in the last round out of
+// their tables, and queues them. The number of entries comes from a bounds
+// check of the index right before a conditional branch to the block of the
+// jump, like in:
+//
+//        cmp eax, 7
+//        ja default
+//        jmp [table + eax * 4]
+//
+// This runs once the threads are done, so that the result doesn't depend on
+// the order in which blocks were decoded. Returns `true` if there is more to
+// decode.
+bool CFGDiscoverer::Impl::ResolveJumpTables(void) {
+  const auto sorted_leaders = SortedLeaders();
+
+  // Conditional branches by the blocks they go to.
+  std::unordered_map<uint64_t, std::vector<const DecodedInst *>> branches_to;
+  for (const auto &[addr, inst] : insts) {
+    if (inst.category == Instruction::kCategoryConditionalBranch &&
+        inst.range_check != kRangeCheckNone) {
+      branches_to[inst.branch_taken_pc].push_back(&inst);
+      branches_to[inst.branch_not_taken_pc].push_back(&inst);
+    }
+  }
+
+  const auto entry_size = arch->address_size / 8u;
+  bool pushed = false;
+  for (const auto &[jump_addr, jump] : indirect_jumps) {
+    if (jump_tables.count(jump_addr) || jump.scale != entry_size) {
+      continue;
+    }
+
+    auto leader_it = std::upper_bound(sorted_leaders.begin(),
+                                      sorted_leaders.end(), jump_addr);
+    if (leader_it == sorted_leaders.begin()) {
+      continue;
+    }
+    const auto block_addr = *std::prev(leader_it);
+
+    DiscoveredJumpTable table;
+    table.inst_addr = jump_addr;
+    table.table_addr = jump.table_addr;
+    table.entry_size = entry_size;
+
+    uint64_t num_entries = kMaxJumpTableEntries;
+    for (auto branch : branches_to[block_addr]) {
+
+      // The comparison must be right before the branch.
+      auto prev_it = insts.find(branch->addr);
+      if (prev_it == insts.begin()) {
+        continue;
+      }
+      --prev_it;
+      auto cmp_it = comparisons.find(prev_it->first);
+      if (prev_it->second.next_pc != branch->addr ||
+          cmp_it == comparisons.end() || cmp_it->second.reg != jump.index_reg) {
+        continue;
+      }
+
+      const auto n = cmp_it->second.imm;
+      const auto to_taken = branch->branch_taken_pc == block_addr;
+      switch (branch->range_check) {
+        case kRangeCheckNotTakenInclusive:
+          table.is_bounded = !to_taken;
+          num_entries = n + 1u;
+          break;
+        case kRangeCheckNotTakenExclusive:
+          table.is_bounded = !to_taken;
+          num_entries = n;
+          break;
+        case kRangeCheckTakenInclusive:
+          table.is_bounded = to_taken;
+          num_entries = n + 1u;
+          break;
+        case kRangeCheckTakenExclusive:
+          table.is_bounded = to_taken;
+          num_entries = n;
+          break;
+        case kRangeCheckNone: break;
+      }
+      if (table.is_bounded) {
+        break;
+      }
+      num_entries = kMaxJumpTableEntries;
+    }
+
+    num_entries = std::min<uint64_t>(num_entries, kMaxJumpTableEntries);
+    for (uint64_t i = 0; i < num_entries; ++i) {
+      const auto entry_addr = jump.table_addr + i * entry_size;
+      uint64_t target = 0;
+      if (!ReadWord(entry_addr, entry_size, target) || !IsCode(target)) {
+        break;
+      }
+      if (!table.is_bounded && !relocations.empty() &&
+          !std::binary_search(relocations.begin(), relocations.end(),
+                              entry_addr)) {
+        break;
+      }
+      table.targets.push_back(target);
+    }
+
+    for (auto target : table.targets) {
+      if (!IsLeader(target)) {
+        Push(0, target);
+        pushed = true;
+      }
+    }
+    if (!table.targets.empty()) {
+      jump_tables.emplace(jump_addr, std::move(table));
+    }
+  }
+  return pushed;
+}
+
+DiscoveredCFG CFGDiscoverer::Impl::Build(void) {
+  DiscoveredCFG cfg;
+  cfg.jump_tables = jump_tables;
+
+  const auto sorted_leaders = SortedLeaders();
+  const std::unordered_set<uint64_t> leader_set(sorted_leaders.begin(),
+                                                sorted_leaders.end());
+
+  for (auto block_addr : sorted_leaders) {
+    DiscoveredBlock block;
+    block.addr = block_addr;
+    block.end_addr = block_addr;
+
+    for (auto pc = block_addr;;) {
+      auto inst_it = insts.find(pc);
+      if (inst_it == insts.end() || !inst_it->second.is_valid) {
+        block.is_incomplete = true;
+        break;
+      }
+
+      const auto &inst = inst_it->second;
+      block.num_instructions += 1;
+      block.end_addr = inst.next_pc;
+
+      if (!EndsBlock(inst.category)) {
+        if (leader_set.count(inst.next_pc)) {
+          block.successors.push_back(inst.next_pc);
+          break;
+        }
+        pc = inst.next_pc;
+        continue;
+      }
+
+      switch (inst.category) {
+        case Instruction::kCategoryDirectJump:
+          block.successors.push_back(inst.branch_taken_pc);
+          break;
+        case Instruction::kCategoryConditionalBranch:
+          block.successors.push_back(inst.branch_taken_pc);
+          block.successors.push_back(inst.branch_not_taken_pc);
+          break;
+        case Instruction::kCategoryIndirectJump:
+          if (auto table_it = jump_tables.find(inst.addr);
+              table_it != jump_tables.end()) {
+            block.successors = table_it->second.targets;
+            block.is_incomplete = !table_it->second.is_bounded;
+          } else {
+            block.is_incomplete = true;
+          }
+          break;
+        case Instruction::kCategoryConditionalIndirectJump:
+          block.successors.push_back(inst.next_pc);
+          block.is_incomplete = true;
+          break;
+        case Instruction::kCategoryConditionalFunctionReturn:
+          block.successors.push_back(inst.next_pc);
+          break;
+        default: break;
+      }
+      break;
+    }
+
+    std::sort(block.successors.begin(), block.successors.end());
+    block.successors.erase(
+        std::unique(block.successors.begin(), block.successors.end()),
+        block.successors.end());
+
+    // Nothing could be decoded here, e.g. a call into data.
+    if (block.num_instructions) {
+      cfg.blocks.emplace(block_addr, std::move(block));
+    }
+  }
+
+  for (auto &[addr, block] : cfg.blocks) {
+    block.successors.erase(
+        std::remove_if(block.successors.begin(), block.successors.end(),
+                       [&](uint64_t succ) { return !cfg.blocks.count(succ); }),
+        block.successors.end());
+  }
+
+  std::set<uint64_t> func_entries;
+  for (auto entry : entries) {
+    func_entries.insert(entry & addr_mask);
+  }
+  for (auto entry : call_targets) {
+    func_entries.insert(entry & addr_mask);
+  }
+
+  // A jump to the entry of another function is a tail call, so the walk of a
+  // function stops there instead of taking in the other function's blocks.
+  for (auto entry : func_entries) {
+    if (!cfg.blocks.count(entry)) {
+      continue;
+    }
+
+    auto &func = cfg.functions[entry];
+    func.entry = entry;
+
+    std::vector<uint64_t> work_list = {entry};
+    std::unordered_set<uint64_t> seen = {entry};
+    while (!work_list.empty()) {
+      const auto block_addr = work_list.back();
+      work_list.pop_back();
+      func.blocks.push_back(block_addr);
+      for (auto succ : cfg.blocks[block_addr].successors) {
+        if (!seen.insert(succ).second) {
+          continue;
+        }
+        if (func_entries.count(succ) && cfg.blocks.count(succ)) {
+          func.tail_calls.push_back(succ);
+        } else {
+          work_list.push_back(succ);
+        }
+      }
+    }
+    std::sort(func.blocks.begin(), func.blocks.end());
+    std::sort(func.tail_calls.begin(), func.tail_calls.end());
+  }
+
+  return cfg;
+}
+
+std::vector<uint64_t> DiscoveredCFG::TraceHeads(void) const {
+  std::vector<uint64_t> heads;
+  heads.reserve(blocks.size());
+  for (const auto &[addr, block] : blocks) {
+    heads.push_back(addr);
+  }
+  return heads;
+}
+
+CFGDiscoverer::CFGDiscoverer(const Arch *arch_) : impl(new Impl(arch_)) {}
+
+CFGDiscoverer::~CFGDiscoverer(void) {}
+
+void CFGDiscoverer::AddRegion(uint64_t addr, std::string_view bytes,
+                              bool is_executable) {
+  auto it = std::upper_bound(
+      impl->regions.begin(), impl->regions.end(), addr,
+      [](uint64_t addr_, const Region &region) { return addr_ < region.addr; });
+  impl->regions.insert(it, Region{addr, bytes, is_executable});
+}
+
+void CFGDiscoverer::AddFunctionEntry(uint64_t addr) {
+  impl->entries.push_back(addr);
+}
+
+void CFGDiscoverer::AddRelocation(uint64_t addr) {
+  impl->relocations.push_back(addr);
+}
+
+DiscoveredCFG CFGDiscoverer::Discover(unsigned num_threads) {
+  if (!num_threads) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  impl->queues.clear();
+  for (auto t = 0u; t < num_threads; ++t) {
+    impl->queues.emplace_back(new WorkQueue);
+  }
+  impl->thread_results.resize(num_threads);
+
+  // Spread the seeds, so that every thread has something to start with.
+  for (size_t i = 0; i < impl->entries.size(); ++i) {
+    impl->Push(static_cast<unsigned>(i % num_threads), impl->entries[i]);
+  }
+
+  std::sort(impl->relocations.begin(), impl->relocations.end());
+  const auto ptr_size = impl->arch->address_size / 8u;
+  size_t num_code_ptrs = 0;
+  for (auto addr : impl->relocations) {
+    uint64_t target = 0;
+    if (impl->ReadWord(addr, ptr_size, target) && impl->IsCode(target) &&
+        impl->LooksLikeCode(target & impl->addr_mask)) {
+      impl->Push(static_cast<unsigned>(num_code_ptrs++ % num_threads), target);
+    }
+  }
+
+  do {
+    impl->RunWorkers(num_threads);
+    impl->MergeResults();
+  } while (impl->ResolveJumpTables());
+
+  auto cfg = impl->Build();
+  LOG(INFO) << "Discovered " << cfg.blocks.size() << " blocks in "
+            << cfg.functions.size() << " functions, with "
+            << cfg.jump_tables.size() << " jump tables";
+  return cfg;
+}
+
+}  // namespace remill
@@ -18,6 +18,10 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/CFG.h>
 #include <llvm/IR/DerivedTypes.h>
@@ -27,9 +31,17 @@
 #include <llvm/IR/Module.h>
 #include <llvm/Transforms/Utils/Local.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -39,9 +51,12 @@
 #include "remill/BC/ABI.h"
 #include "remill/BC/Compat/CallSite.h"
 #include "remill/BC/Compat/VectorType.h"
+#include "remill/BC/LiftStats.h"
 #include "remill/BC/Util.h"
 #include "remill/OS/FileSystem.h"
 
+#include "ParallelFor.h"
+
 DEFINE_string(dot_output_dir, "",
               "The directory in which to log DOT digraphs of the alias "
               "analysis information derived during the process of "
@@ -62,20 +77,180 @@ DEFINE_bool(log_dse_stats, false,
 DEFINE_bool(name_register_variables, false,
             "Try to apply a register's name to its GEP variable.");
 
+DEFINE_uint32(dse_num_threads, 0,
+              "Number of threads used to analyze the functions of a module "
+              "for aliasing loads and stores. Zero means one thread per "
+              "hardware thread.");
+
+DEFINE_string(dse_calling_convention, "none",
+              "Comma-separated assumptions that liveness across x86 calls and "
+              "returns may make of the lifted code: `none`; `cdecl`, i.e. "
+              "that EAX, ECX and EDX are clobbered by calls, and that ECX "
+              "isn't read after returns, as with cdecl and stdcall; and "
+              "`eflags`, i.e. that the arithmetic flags aren't read across "
+              "calls and returns. `cdecl` miscompiles code that keeps values "
+              "in ECX or EDX across calls, e.g. Watcom's __watcall, or "
+              "helpers like _aulldvrm that return a result in ECX. `eflags` "
+              "miscompiles code that passes values in flags, e.g. "
+              "hand-written helpers returning a result in CF or ZF.");
+
 namespace remill {
 namespace {
 
-static constexpr size_t kMaxNumSlots = 256;
-
 using ValueToOffset = std::unordered_map<llvm::Value *, uint64_t>;
 using InstToOffset = std::unordered_map<llvm::Instruction *, uint64_t>;
-using LiveSet = std::bitset<kMaxNumSlots>;
 
-// TODO(pag): Map to `LiveSet` pointers. The common cases are:
-//            - all set
-//            - none set
-//            - one set
-using InstToLiveSet = std::unordered_map<llvm::Instruction *, LiveSet>;
+// Set of live slots of the `State` structure, with as many bits as there are
+// slots. Slot indices out of range, i.e. those of padding bytes, are ignored.
+class LiveSet {
+ public:
+  explicit LiveSet(size_t num_slots_)
+      : words((num_slots_ + 63u) / 64u, 0u),
+        num_slots(num_slots_) {}
+
+  inline size_t size(void) const {
+    return num_slots;
+  }
+
+  inline bool test(size_t i) const {
+    return i < num_slots && ((words[i / 64u] >> (i % 64u)) & 1u);
+  }
+
+  inline void set(size_t i) {
+    if (i < num_slots) {
+      words[i / 64u] |= 1ull << (i % 64u);
+    }
+  }
+
+  inline void reset(size_t i) {
+    if (i < num_slots) {
+      words[i / 64u] &= ~(1ull << (i % 64u));
+    }
+  }
+
+  void set(void) {
+    std::fill(words.begin(), words.end(), ~0ull);
+    if (num_slots % 64u) {
+      words.back() = (1ull << (num_slots % 64u)) - 1u;
+    }
+  }
+
+  void reset(void) {
+    std::fill(words.begin(), words.end(), 0ull);
+  }
+
+  size_t count(void) const {
+    size_t num = 0;
+    for (auto word : words) {
+      num += static_cast<size_t>(__builtin_popcountll(word));
+    }
+    return num;
+  }
+
+  LiveSet &operator|=(const LiveSet &that) {
+    for (size_t i = 0; i < words.size(); ++i) {
+      words[i] |= that.words[i];
+    }
+    return *this;
+  }
+
+  // Applies a block's summary to the live set on exit from the block, giving
+  // the live set on entry: `*this = gen | (*this & ~kill)`.
+  void Transfer(const LiveSet &gen, const LiveSet &kill) {
+    for (size_t i = 0; i < words.size(); ++i) {
+      words[i] = gen.words[i] | (words[i] & ~kill.words[i]);
+    }
+  }
+
+  bool operator==(const LiveSet &that) const {
+    return words == that.words;
+  }
+
+  bool operator!=(const LiveSet &that) const {
+    return words != that.words;
+  }
+
+  size_t Hash(void) const {
+    size_t hash = num_slots;
+    for (auto word : words) {
+      hash = (hash * 0x100000001b3ull) ^ static_cast<size_t>(word);
+    }
+    return hash;
+  }
+
+ private:
+  std::vector<uint64_t> words;
+  size_t num_slots;
+};
+
+// Hash-consed `LiveSet`s. Most live sets are one of a few common ones (no
+// slots, all slots, one slot), so the analysis only keeps pointers to the
+// canonical copies in here, and compares live sets by address. `Intern` may be
+// called from several threads at once.
+class LiveSetPool {
+ public:
+  explicit LiveSetPool(size_t num_slots_) : num_slots(num_slots_) {
+    LiveSet set(num_slots);
+    none = Intern(set);
+    set.set();
+    all = Intern(set);
+  }
+
+  const LiveSet *Intern(const LiveSet &set) {
+    std::lock_guard<std::mutex> locker(lock);
+    return &*(sets.insert(set).first);
+  }
+
+  const LiveSet *None(void) const {
+    return none;
+  }
+
+  const LiveSet *All(void) const {
+    return all;
+  }
+
+  const LiveSet *One(size_t slot) {
+    LiveSet set(num_slots);
+    set.set(slot);
+    return Intern(set);
+  }
+
+  size_t Size(void) {
+    std::lock_guard<std::mutex> locker(lock);
+    return sets.size();
+  }
+
+  const size_t num_slots;
+
+ private:
+  struct Hash {
+    size_t operator()(const LiveSet &set) const {
+      return set.Hash();
+    }
+  };
+
+  std::mutex lock;
+  std::unordered_set<LiveSet, Hash> sets;
+  const LiveSet *none{nullptr};
+  const LiveSet *all{nullptr};
+};
+
+using InstToLiveSet = std::unordered_map<llvm::Instruction *, const LiveSet *>;
+using FunctionSet = std::unordered_set<llvm::Function *>;
+
+// What the calling convention of the lifted code says about the slots at
+// calls and returns of guest functions.
+struct CallingConvention {
+
+  // Slots that a called guest function may read on entry.
+  const LiveSet *live_on_call;
+
+  // Slots that the caller may read after a guest function returns.
+  const LiveSet *live_on_return;
+
+  // Slots whose values from before a call the caller won't read after it.
+  const LiveSet *clobbered_by_call;
+};
 
 // Struct to keep track of how murderous the dead store eliminator is.
 struct KillCounter {
@@ -92,6 +267,22 @@ struct KillCounter {
   uint64_t fwd_failed;
 };
 
+// Wall-clock time spent in each phase of the dead store eliminator, in
+// milliseconds.
+struct PhaseTimes {
+  double alias;
+  double forward;
+  double liveness;
+  double collect;
+  double remove;
+};
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
 // Return true if the given function is a lifted function
 // (and not the `__remill_basic_block`).
 static bool IsLiftedFunction(llvm::Function *func,
@@ -242,27 +433,6 @@ static bool TryGetOffset(llvm::Value *val, const ValueToOffset &state_offset,
   }
 }
 
-// Try to get the offset associated with some value, or if the value is
-// a constant integer, get that instead.
-static bool TryGetOffsetOrConst(llvm::Value *val,
-                                const ValueToOffset &state_offset,
-                                uint64_t *offset_out) {
-  if (auto const_val = llvm::dyn_cast<llvm::ConstantInt>(val)) {
-    const auto &val_apint = const_val->getValue();
-    if (val_apint.getMinSignedBits() <= 64) {
-      *offset_out = static_cast<uint64_t>(const_val->getSExtValue());
-      return true;
-    } else {
-      LOG(WARNING) << "Unable to fit offset from "
-                   << remill::LLVMThingToString(val)
-                   << " into a 64-bit signed integer";
-      return false;
-    }
-  } else {
-    return TryGetOffset(val, state_offset, offset_out);
-  }
-}
-
 enum class VisitResult : int {
   Progress,
   NoProgress,
@@ -297,11 +467,13 @@ static bool TryCombineOffsets(uint64_t lhs_offset, OpType op_type,
   return (*out_offset) < max_offset;
 }
 
-static LiveSet GetLiveSetFromArgs(llvm::iterator_range<llvm::Use *> args,
-                                  const ValueToOffset &val_to_offset,
-                                  const std::vector<StateSlot> &state_slots) {
-  LiveSet live;
-  live.reset();
+static const LiveSet *
+GetLiveSetFromArgs(llvm::iterator_range<llvm::Use *> args,
+                   const ValueToOffset &val_to_offset,
+                   const std::vector<StateSlot> &state_slots,
+                   LiveSetPool &pool) {
+  LiveSet live(pool.num_slots);
+  bool any_live = false;
   for (auto &arg_it : args) {
     auto arg = arg_it->stripPointerCasts();
     const auto offset_it = val_to_offset.find(arg);
@@ -313,6 +485,7 @@ static LiveSet GetLiveSetFromArgs(llvm::iterator_range<llvm::Use *> args,
     // If we access a single non-zero offset, mark just that offset.
     if (offset != 0) {
       live.set(state_slots[offset].index);
+      any_live = true;
 
     // If we access offset `0`, then maybe we're actually passing
     // a state pointer, in which anything can be changed, so we want
@@ -323,11 +496,10 @@ static LiveSet GetLiveSetFromArgs(llvm::iterator_range<llvm::Use *> args,
     // Typically this case is hit when we have a call to another lifted
     // function.
     } else {
-      live.set();
-      break;
+      return pool.All();
     }
   }
-  return live;
+  return any_live ? pool.Intern(live) : pool.None();
 }
 
 // Visits instructions and propagates information about where in the
@@ -339,12 +511,22 @@ struct ForwardAliasVisitor
 
   ForwardAliasVisitor(const llvm::DataLayout &dl_,
                       const std::vector<StateSlot> &offset_to_slot_,
-                      InstToLiveSet &live_args_,
+                      LiveSetPool &live_sets_, InstToLiveSet &live_args_,
                       InstToOffset &state_access_offset_,
                       llvm::LLVMContext &context);
 
-  bool Analyze(const remill::Arch *arch, KillCounter &stats,
-               llvm::Function *func);
+  // Find the `State` offsets accessed by the instructions of `func`. This
+  // doesn't change the IR, nor anything else owned by the `LLVMContext`, and
+  // so can run on different functions concurrently.
+  bool Analyze(KillCounter &stats, llvm::Function *func);
+
+  // Attach `remill_register` metadata to the `State` pointers found by
+  // `Analyze`, and name them if `--name_register_variables` is set.
+  void AnnotateRegisterPointers(const remill::Arch *arch, llvm::Function *func);
+
+  // Emit the warnings of `Analyze`. Printing IR may use the `LLVMContext`,
+  // so `Analyze` only records them, and this must be called serially.
+  void FlushLogs(void);
 
  protected:
   friend class llvm::InstVisitor<ForwardAliasVisitor, VisitResult>;
@@ -371,11 +553,19 @@ struct ForwardAliasVisitor
   void AddInstruction(llvm::Instruction *inst);
   virtual VisitResult visitBinaryOp_(llvm::BinaryOperator &inst, OpType op);
 
+  // Try to get the offset associated with some value, or if the value is
+  // a constant integer, get that instead.
+  bool TryGetOffsetOrConst(llvm::Value *val, uint64_t *offset_out);
+
+  // Warnings to be emitted by `FlushLogs`.
+  std::vector<std::function<void(void)>> deferred_logs;
+
  public:
   const llvm::DataLayout dl;
   const std::vector<StateSlot> &offset_to_slot;
   ValueToOffset state_offset;
   InstToOffset &state_access_offset;
+  LiveSetPool &live_sets;
   InstToLiveSet &live_args;
   std::unordered_set<llvm::Value *> exclude;
   std::unordered_set<llvm::Value *> missing;
@@ -546,28 +736,38 @@ void ForwardAliasVisitor::CreateDOTDigraph(const remill::Arch *arch,
 
 ForwardAliasVisitor::ForwardAliasVisitor(
     const llvm::DataLayout &dl_, const std::vector<StateSlot> &offset_to_slot_,
-    InstToLiveSet &live_args_, InstToOffset &state_access_offset_,
-    llvm::LLVMContext &context)
+    LiveSetPool &live_sets_, InstToLiveSet &live_args_,
+    InstToOffset &state_access_offset_, llvm::LLVMContext &context)
     : dl(dl_),
       offset_to_slot(offset_to_slot_),
       state_access_offset(state_access_offset_),
+      live_sets(live_sets_),
       live_args(live_args_),
       state_ptr(nullptr),
       reg_md_id(context.getMDKindID("remill_register")) {}
 
-void ForwardAliasVisitor::AddInstruction(llvm::Instruction *inst) {
-
-  if (!inst->getMetadata(reg_md_id)) {
-    if (FLAGS_dot_output_dir.empty()) {
-      inst->setName(llvm::Twine::createNull());
-    } else {
-      static int r = static_cast<int>(remill::kNumBlockArgs);
-      if (!inst->getType()->isVoidTy()) {
-        inst->setName("r" + std::to_string(r++));
+// Strip the names of the instructions of `func` that aren't register
+// variables, or number them for the DOT digraphs. Value names live in the
+// `LLVMContext`, so this must not run while other functions are analyzed.
+static void ResetInstructionNames(llvm::Function &func, unsigned reg_md_id) {
+  for (auto &block : func) {
+    for (auto &inst : block) {
+      if (inst.getMetadata(reg_md_id)) {
+        continue;
+      }
+      if (FLAGS_dot_output_dir.empty()) {
+        inst.setName(llvm::Twine::createNull());
+      } else {
+        static int r = static_cast<int>(remill::kNumBlockArgs);
+        if (!inst.getType()->isVoidTy()) {
+          inst.setName("r" + std::to_string(r++));
+        }
       }
     }
   }
+}
 
+void ForwardAliasVisitor::AddInstruction(llvm::Instruction *inst) {
   if (llvm::isa<llvm::StoreInst>(inst)) {
     curr_wl.push_back(inst);
 
@@ -595,8 +795,7 @@ void ForwardAliasVisitor::AddInstruction(llvm::Instruction *inst) {
 // are not yet in `state_offset`) is withheld to the next analysis round
 // in the next worklist. Analysis repeats until the current worklist is
 // empty or until an error condition is hit.
-bool ForwardAliasVisitor::Analyze(const remill::Arch *arch, KillCounter &stats,
-                                  llvm::Function *func) {
+bool ForwardAliasVisitor::Analyze(KillCounter &stats, llvm::Function *func) {
   curr_wl.clear();
   exclude.clear();
   calls.clear();
@@ -700,6 +899,11 @@ bool ForwardAliasVisitor::Analyze(const remill::Arch *arch, KillCounter &stats,
                   << " iteration";
   }
 
+  return true;
+}
+
+void ForwardAliasVisitor::AnnotateRegisterPointers(const remill::Arch *arch,
+                                                   llvm::Function *func) {
   auto &context = func->getContext();
   for (auto [val, offset] : state_offset) {
     const auto inst = llvm::dyn_cast<llvm::Instruction>(val);
@@ -764,8 +968,33 @@ bool ForwardAliasVisitor::Analyze(const remill::Arch *arch, KillCounter &stats,
       }
     }
   }
+}
 
-  return true;
+bool ForwardAliasVisitor::TryGetOffsetOrConst(llvm::Value *val,
+                                              uint64_t *offset_out) {
+  if (auto const_val = llvm::dyn_cast<llvm::ConstantInt>(val)) {
+    const auto &val_apint = const_val->getValue();
+    if (val_apint.getMinSignedBits() <= 64) {
+      *offset_out = static_cast<uint64_t>(const_val->getSExtValue());
+      return true;
+    } else {
+      deferred_logs.emplace_back([val] {
+        LOG(WARNING) << "Unable to fit offset from "
+                     << remill::LLVMThingToString(val)
+                     << " into a 64-bit signed integer";
+      });
+      return false;
+    }
+  } else {
+    return TryGetOffset(val, state_offset, offset_out);
+  }
+}
+
+void ForwardAliasVisitor::FlushLogs(void) {
+  for (auto &log : deferred_logs) {
+    log();
+  }
+  deferred_logs.clear();
 }
 
 VisitResult ForwardAliasVisitor::visitInstruction(llvm::Instruction &I) {
@@ -864,12 +1093,16 @@ ForwardAliasVisitor::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
                          static_cast<uint64_t>(const_offset.getSExtValue()),
                          offset_to_slot.size(), &offset)) {
 
-    LOG(WARNING) << "Out of bounds GEP operation: " << LLVMThingToString(&inst)
-                 << " on base " << LLVMThingToString(val)
-                 << " with inferred offset " << static_cast<int64_t>(offset)
-                 << " (" << ptr->second << " + " << const_offset.getSExtValue()
-                 << ")"
-                 << " and max allowed offset of " << offset_to_slot.size();
+    deferred_logs.emplace_back([=, &inst, base = ptr->second,
+                                max_offset = offset_to_slot.size(),
+                                const_offset = const_offset.getSExtValue()] {
+      LOG(WARNING) << "Out of bounds GEP operation: "
+                   << LLVMThingToString(&inst) << " on base "
+                   << LLVMThingToString(val) << " with inferred offset "
+                   << static_cast<int64_t>(offset) << " (" << base << " + "
+                   << const_offset << ")"
+                   << " and max allowed offset of " << max_offset;
+    });
     return VisitResult::Error;
   }
 
@@ -922,7 +1155,7 @@ VisitResult ForwardAliasVisitor::visitBinaryOp_(llvm::BinaryOperator &inst,
   if (exclude.count(lhs_val)) {
     num_excluded += 1;
 
-  } else if (TryGetOffsetOrConst(lhs_val, state_offset, &lhs_offset)) {
+  } else if (TryGetOffsetOrConst(lhs_val, &lhs_offset)) {
     if (llvm::isa<llvm::Constant>(lhs_val)) {
       num_consts += 1;
     } else {
@@ -945,7 +1178,7 @@ VisitResult ForwardAliasVisitor::visitBinaryOp_(llvm::BinaryOperator &inst,
   if (exclude.count(rhs_val)) {
     num_excluded += 1;
 
-  } else if (TryGetOffsetOrConst(rhs_val, state_offset, &rhs_offset)) {
+  } else if (TryGetOffsetOrConst(rhs_val, &rhs_offset)) {
     if (llvm::isa<llvm::Constant>(rhs_val)) {
       num_consts += 1;
     } else {
@@ -982,11 +1215,14 @@ VisitResult ForwardAliasVisitor::visitBinaryOp_(llvm::BinaryOperator &inst,
     uint64_t offset = 0;
     if (!TryCombineOffsets(lhs_offset, op, rhs_offset, offset_to_slot.size(),
                            &offset)) {
-      LOG(WARNING) << "Out of bounds operation `" << LLVMThingToString(&inst)
-                   << "` with LHS offset " << static_cast<int64_t>(lhs_offset)
-                   << ", RHS offset " << static_cast<int64_t>(rhs_offset)
-                   << ", combined offset " << static_cast<int64_t>(offset)
-                   << ", and max allowed offset of " << offset_to_slot.size();
+      deferred_logs.emplace_back([=, &inst,
+                                  max_offset = offset_to_slot.size()] {
+        LOG(WARNING) << "Out of bounds operation `" << LLVMThingToString(&inst)
+                     << "` with LHS offset " << static_cast<int64_t>(lhs_offset)
+                     << ", RHS offset " << static_cast<int64_t>(rhs_offset)
+                     << ", combined offset " << static_cast<int64_t>(offset)
+                     << ", and max allowed offset of " << max_offset;
+      });
       return VisitResult::Error;
     }
 
@@ -1146,7 +1382,7 @@ VisitResult ForwardAliasVisitor::visitCallInst(llvm::CallInst &inst) {
     if (auto func = llvm::dyn_cast<llvm::Function>(const_val); func) {
       if (func->hasFnAttribute(llvm::Attribute::ReadNone) ||
           func->hasFnAttribute(llvm::Attribute::ReadOnly)) {
-        live_args[&inst].reset();
+        live_args[&inst] = live_sets.None();
         return VisitResult::Ignored;
       }
     }
@@ -1164,29 +1400,29 @@ VisitResult ForwardAliasVisitor::visitCallInst(llvm::CallInst &inst) {
         name == "__mcsema_printf") {
 
       // Don't let this affect anything.
-      live_args[&inst].reset();
+      live_args[&inst] = live_sets.None();
       return VisitResult::Ignored;
 
     } else if (name.startswith("__mcsema")) {
-      live_args[&inst].set();
+      live_args[&inst] = live_sets.All();
       return VisitResult::Ignored;
     }
 
   // Don't let this affect anything.
   } else if (llvm::isa<llvm::InlineAsm>(val)) {
-    live_args[&inst].reset();
+    live_args[&inst] = live_sets.None();
     return VisitResult::Ignored;
 
   // It's an indirect call.
   } else {
-    live_args[&inst].set();
+    live_args[&inst] = live_sets.All();
     return VisitResult::Ignored;
   }
 
   // If we have not seen this instruction before, add it.
   auto args = inst.arg_operands();
-  auto live = GetLiveSetFromArgs(args, state_offset, offset_to_slot);
-  live_args.emplace(&inst, std::move(live));
+  auto live = GetLiveSetFromArgs(args, state_offset, offset_to_slot, live_sets);
+  live_args.emplace(&inst, live);
   return VisitResult::Ignored;
 }
 
@@ -1194,21 +1430,43 @@ VisitResult ForwardAliasVisitor::visitInvokeInst(llvm::InvokeInst &inst) {
   auto val =
       compat::llvm::CallSite(&inst).getCalledValue()->stripPointerCasts();
   if (llvm::isa<llvm::InlineAsm>(val)) {
-    live_args[&inst].set();  // Weird to invoke inline assembly.
+    live_args[&inst] = live_sets.All();  // Weird to invoke inline assembly.
 
   } else if (auto func = llvm::dyn_cast<llvm::Constant>(val);
              func && func->getName().startswith("__mcsema")) {
-    live_args[&inst].set();
+    live_args[&inst] = live_sets.All();
 
   // If we have not seen this instruction before, add it.
   } else {
     auto args = inst.arg_operands();
-    auto live = GetLiveSetFromArgs(args, state_offset, offset_to_slot);
-    live_args.emplace(&inst, std::move(live));
+    auto live =
+        GetLiveSetFromArgs(args, state_offset, offset_to_slot, live_sets);
+    live_args.emplace(&inst, live);
   }
   return VisitResult::Ignored;
 }
 
+// Returns `true` if code that `inst` returns or branches to could read any
+// register, i.e. if all slots are live before `inst`.
+static bool MakesAllSlotsLive(llvm::Instruction *inst) {
+  if (llvm::isa<llvm::ReturnInst>(inst) ||
+      llvm::isa<llvm::UnreachableInst>(inst) ||
+      llvm::isa<llvm::IndirectBrInst>(inst) ||
+      llvm::isa<llvm::ResumeInst>(inst)) {
+    return true;
+  }
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(3, 8)
+  if (llvm::isa<llvm::CatchSwitchInst>(inst) ||
+      llvm::isa<llvm::CatchReturnInst>(inst) ||
+      llvm::isa<llvm::CatchPadInst>(inst) ||
+      llvm::isa<llvm::CleanupPadInst>(inst) ||
+      llvm::isa<llvm::CleanupReturnInst>(inst)) {
+    return true;
+  }
+#endif
+  return false;
+}
+
 class LiveSetBlockVisitor {
  public:
   llvm::Module &module;
@@ -1216,82 +1474,328 @@ class LiveSetBlockVisitor {
   const InstToLiveSet &live_args;
   InstToOffset &state_access_offset;
   const std::vector<StateSlot> &offset_to_slot;
+  LiveSetPool &live_sets;
   std::vector<llvm::BasicBlock *> curr_wl;
-  std::unordered_map<llvm::BasicBlock *, LiveSet> block_map;
   std::vector<llvm::Instruction *> to_remove;
   const llvm::Function *bb_func;
 
+  // Position of every block in a post-order walk of its function. Liveness
+  // flows backwards, so visiting blocks in this order sees successors before
+  // their predecessors.
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> block_order;
+
+  // Effect of a whole block on the live slots: the live set on entry to the
+  // block is `gen | (live_on_exit & ~kill)`. If the block ends in a branch or
+  // switch, then its live set on exit is the union of the live sets on entry
+  // to its successors, and otherwise it is empty. Blocks that call lifted
+  // functions depend on the live sets on entry to those, so they are `dynamic`
+  // and walked in full every time instead.
+  struct BlockSummary {
+    const LiveSet *gen;
+    const LiveSet *kill;
+    bool branches;
+    bool dynamic;
+  };
+
+  // Effect of a call on the live slots: the live set before the call is
+  // `uses | (live_after & ~kills)`. It is `dynamic` if `uses` is the live set
+  // on entry to the called lifted function, which may still change.
+  struct CallEffect {
+    const LiveSet *uses;
+    const LiveSet *kills;
+    bool dynamic;
+  };
+
+  // Summaries and live sets on entry of all blocks, indexed by `block_order`.
+  std::vector<BlockSummary> summaries;
+  std::vector<const LiveSet *> live_on_entry;
+
   LiveSetBlockVisitor(llvm::Module &module_, const InstToLiveSet &live_args_,
                       InstToOffset &state_access_offset_,
                       const std::vector<StateSlot> &state_slots_,
+                      LiveSetPool &live_sets_, const CallingConvention &conv_,
+                      const FunctionSet &analyzed_funcs_,
                       const llvm::Function *bb_func_,
                       const llvm::DataLayout *dl_);
 
+  inline const LiveSet *LiveOnEntry(llvm::BasicBlock *block) const {
+    return live_on_entry[block_order.lookup(block)];
+  }
+
   void FindLiveInsts(KillCounter &stats);
   void CollectDeadInsts(KillCounter &stats);
-  bool VisitBlock(llvm::BasicBlock *block, KillCounter &stats);
-  bool DeleteDeadInsts(KillCounter &stats);
+  void VisitBlock(llvm::BasicBlock *block, KillCounter &stats);
+  bool DeleteDeadInsts(KillCounter &stats, LiftStats *lift_stats);
   void CreateDOTDigraph(const remill::Arch *, llvm::Function *func,
                         const char *extensions);
 
  private:
-  bool on_remove_pass;
+  BlockSummary Summarize(llvm::BasicBlock *block);
+  bool UpdateBlock(llvm::BasicBlock *block);
+
+  // Walk `block` backwards from its live set on exit, leaving its live set on
+  // entry in `live`. Dead stores are collected if `stats` is non-null.
+  void WalkBlock(llvm::BasicBlock *block, LiveSet &live, KillCounter *stats);
+
+  // Returns `true` if `inst` calls a lifted function or control-flow intrinsic
+  // with our `State`, and then `ret`urns what it returns, i.e. if it is where
+  // a lifted trace hands over to the code after it.
+  bool IsTailCall(llvm::Instruction *inst) const;
+
+  CallEffect GetCallEffect(llvm::Instruction *inst) const;
+
+  // Returns the slot stored to by `inst` if it overwrites all of the slot.
+  bool GetKilledSlot(llvm::StoreInst *inst, uint64_t *slot_num) const;
+
+  const CallingConvention &conv;
+
+  // Lifted functions whose alias analysis succeeded.
+  const FunctionSet &analyzed_funcs;
+
+  LiveSet scratch;
   const llvm::DataLayout *dl;
 };
 
 LiveSetBlockVisitor::LiveSetBlockVisitor(
     llvm::Module &module_, const InstToLiveSet &live_args_,
     InstToOffset &state_access_offset_,
-    const std::vector<StateSlot> &state_slots_, const llvm::Function *bb_func_,
-    const llvm::DataLayout *dl_)
+    const std::vector<StateSlot> &state_slots_, LiveSetPool &live_sets_,
+    const CallingConvention &conv_,
+    const FunctionSet &analyzed_funcs_,
+    const llvm::Function *bb_func_, const llvm::DataLayout *dl_)
     : module(module_),
       live_args(live_args_),
       state_access_offset(state_access_offset_),
       offset_to_slot(state_slots_),
+      live_sets(live_sets_),
       curr_wl(),
-      block_map(),
       to_remove(),
       bb_func(bb_func_),
-      on_remove_pass(false),
+      conv(conv_),
+      analyzed_funcs(analyzed_funcs_),
+      scratch(live_sets_.num_slots),
       dl(dl_) {
   for (auto &func : module) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    for (auto block : llvm::post_order(&func)) {
+      block_order.try_emplace(block, block_order.size());
+    }
     for (auto &block : func) {
-      auto succ_begin_it = llvm::succ_begin(&block);
-      auto succ_end_it = llvm::succ_end(&block);
-      if (succ_begin_it == succ_end_it) {
-        curr_wl.push_back(&block);
+      block_order.try_emplace(&block, block_order.size());  // Unreachable.
+
+      // Exits don't all make every slot live anymore, so the live sets on
+      // entry of some blocks may stay empty, and their predecessors must be
+      // visited regardless.
+      curr_wl.push_back(&block);
+    }
+  }
+
+  summaries.resize(block_order.size());
+  live_on_entry.resize(block_order.size(), live_sets.None());
+  for (auto [block, order] : block_order) {
+    summaries[order] = Summarize(block);
+  }
+}
+
+bool LiveSetBlockVisitor::GetKilledSlot(llvm::StoreInst *inst,
+                                        uint64_t *slot_num) const {
+  auto offset_ptr = state_access_offset.find(inst);
+  if (offset_ptr == state_access_offset.end()) {
+    return false;
+  }
+  const auto &state_slot = offset_to_slot[offset_ptr->second];
+  const auto val_size = dl->getTypeAllocSize(inst->getOperand(0)->getType());
+  *slot_num = state_slot.index;
+  return val_size == state_slot.size;
+}
+
+// Returns `true` if `inst` passes the `State` pointer of its own function on
+// to the function that it calls.
+static bool PassesOwnState(llvm::Instruction *inst) {
+  auto func = inst->getFunction();
+  return func->arg_size() > kStatePointerArgNum &&
+         inst->getNumOperands() > kStatePointerArgNum &&
+         inst->getOperand(kStatePointerArgNum)->stripPointerCasts() ==
+             func->getArg(kStatePointerArgNum);
+}
+
+bool LiveSetBlockVisitor::IsTailCall(llvm::Instruction *inst) const {
+  auto call = llvm::dyn_cast<llvm::CallInst>(inst);
+  auto ret = llvm::dyn_cast_or_null<llvm::ReturnInst>(inst->getNextNode());
+  if (!call || !ret || ret->getReturnValue() != call || !PassesOwnState(call)) {
+    return false;
+  }
+  auto callee = llvm::dyn_cast<llvm::Function>(
+      compat::llvm::CallSite(call).getCalledValue()->stripPointerCasts());
+  return callee && callee != bb_func &&
+         callee->getFunctionType() == bb_func->getFunctionType();
+}
+
+// Calls of guest functions and hand-overs to the code after a trace read what
+// the calling convention, or the summary of the called lifted function, says
+// they do. Anything else reads what its arguments point to.
+LiveSetBlockVisitor::CallEffect
+LiveSetBlockVisitor::GetCallEffect(llvm::Instruction *inst) const {
+  auto callee = llvm::dyn_cast<llvm::Function>(
+      compat::llvm::CallSite(inst).getCalledValue()->stripPointerCasts());
+  if (callee && callee != bb_func &&
+      callee->getFunctionType() == bb_func->getFunctionType() &&
+      PassesOwnState(inst)) {
+    const auto is_tail = IsTailCall(inst);
+    const auto kills = is_tail ? live_sets.None() : conv.clobbered_by_call;
+    const auto name = callee->getName();
+    if (name == "__remill_function_return") {
+      return {conv.live_on_return, kills, false};
+
+    } else if (name == "__remill_function_call") {
+      return {conv.live_on_call, kills, false};
+
+    // Our summary of a lifted function is only as good as the alias analysis
+    // of its loads and stores.
+    } else if (!callee->isDeclaration()) {
+      if (analyzed_funcs.count(callee)) {
+        return {LiveOnEntry(&(callee->getEntryBlock())), kills, true};
       }
+
+    // A direct call of a function lifted into another module.
+    } else if (!is_tail && !name.startswith("__remill_")) {
+      return {conv.live_on_call, kills, false};
     }
   }
+
+  // Likely due to a more general failure to analyze this particular
+  // function.
+  auto arg_live_it = live_args.find(inst);
+  if (arg_live_it == live_args.end()) {
+    return {live_sets.All(), live_sets.None(), false};
+  } else {
+    return {arg_live_it->second, live_sets.None(), false};
+  }
 }
 
-// Visit the basic blocks in the worklist and update the block_map.
-void LiveSetBlockVisitor::FindLiveInsts(KillCounter &stats) {
+// Summarize the effect of `block` on the live slots, by walking it backwards.
+// Loads and calls add to `gen`, and stores to whole slots and calls that
+// clobber slots remove from `gen` and add to `kill`.
+LiveSetBlockVisitor::BlockSummary
+LiveSetBlockVisitor::Summarize(llvm::BasicBlock *block) {
+  LiveSet gen(live_sets.num_slots);
+  LiveSet kill(live_sets.num_slots);
+  bool branches = false;
+
+  for (auto inst_it = block->rbegin(); inst_it != block->rend(); ++inst_it) {
+    auto inst = &*inst_it;
+    if (llvm::isa<llvm::ReturnInst>(inst) && inst->getPrevNode() &&
+        IsTailCall(inst->getPrevNode())) {
+      continue;
+
+    } else if (MakesAllSlotsLive(inst)) {
+      gen.set();
+
+    } else if (llvm::isa<llvm::BranchInst>(inst) ||
+               llvm::isa<llvm::SwitchInst>(inst)) {
+      branches = true;
+
+    } else if (llvm::isa<llvm::CallInst>(inst) ||
+               llvm::isa<llvm::InvokeInst>(inst)) {
+      const auto effect = GetCallEffect(inst);
+      if (effect.dynamic) {
+        return {nullptr, nullptr, false, true};
+      }
+      gen.Transfer(*effect.uses, *effect.kills);
+      kill |= *effect.kills;
+
+    } else if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
+      uint64_t slot_num = 0;
+      if (GetKilledSlot(store_inst, &slot_num)) {
+        gen.reset(slot_num);
+        kill.set(slot_num);
+      }
+
+    } else if (llvm::isa<llvm::LoadInst>(inst)) {
+      auto offset_ptr = state_access_offset.find(inst);
+      if (offset_ptr != state_access_offset.end()) {
+        gen.set(offset_to_slot[offset_ptr->second].index);
+      }
+    }
+  }
+
+  return {live_sets.Intern(gen), live_sets.Intern(kill), branches, false};
+}
+
+// Recompute the live set on entry to `block` from its summary. Returns `true`
+// if it changed.
+bool LiveSetBlockVisitor::UpdateBlock(llvm::BasicBlock *block) {
+  const auto order = block_order.lookup(block);
+  const auto &summary = summaries[order];
+
+  if (summary.dynamic) {
+    WalkBlock(block, scratch, nullptr);
+
+  } else {
+    scratch.reset();
+    if (summary.branches) {
+      auto succ_it = llvm::succ_begin(block);
+      auto succ_end = llvm::succ_end(block);
+      for (; succ_it != succ_end; succ_it++) {
+        scratch |= *LiveOnEntry(*succ_it);
+      }
+    }
+    scratch.Transfer(*summary.gen, *summary.kill);
+  }
+
+  const auto live = live_sets.Intern(scratch);
+  if (live_on_entry[order] != live) {
+    live_on_entry[order] = live;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+// Visit the basic blocks in the worklist and update their live sets on entry.
+// Every round visits its blocks in post-order, and queues each block at most
+// once for the next round.
+void LiveSetBlockVisitor::FindLiveInsts(KillCounter &) {
   std::vector<llvm::BasicBlock *> next_wl;
+  std::vector<bool> queued(block_order.size(), false);
+
+  auto by_order = [this](llvm::BasicBlock *a, llvm::BasicBlock *b) {
+    return block_order.lookup(a) < block_order.lookup(b);
+  };
+
+  auto enqueue = [&](llvm::BasicBlock *block) {
+    const auto order = block_order.lookup(block);
+    if (!queued[order]) {
+      queued[order] = true;
+      next_wl.push_back(block);
+    }
+  };
+
+  std::sort(curr_wl.begin(), curr_wl.end(), by_order);
   while (!curr_wl.empty()) {
     for (auto block : curr_wl) {
 
       // If we change the live slots state of the block, then add the
       // block's predecessors to the next work list.
-      if (VisitBlock(block, stats)) {
-        int num_preds = 0;
+      if (UpdateBlock(block)) {
         auto pred_it = llvm::pred_begin(block);
         auto pred_end = llvm::pred_end(block);
         for (; pred_it != pred_end; ++pred_it) {
-          auto pred = *pred_it;
-          next_wl.push_back(pred);
-          num_preds++;
+          enqueue(*pred_it);
         }
 
         // If we've visited an entry block, add its callers to the
-        // next work list.
-        if (!num_preds) {
-          auto func = block->getParent();
+        // next work list. The entry block of a trace can also be the
+        // header of a loop, so this doesn't go by the predecessors.
+        auto func = block->getParent();
+        if (block == &(func->getEntryBlock())) {
           for (auto user : func->users()) {
             if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
               if (llvm::isa<llvm::CallInst>(inst) ||
                   llvm::isa<llvm::InvokeInst>(inst)) {
-                next_wl.push_back(inst->getParent());
+                enqueue(inst->getParent());
               }
             }
           }
@@ -1299,45 +1803,40 @@ void LiveSetBlockVisitor::FindLiveInsts(KillCounter &stats) {
       }
     }
 
+    for (auto block : next_wl) {
+      queued[block_order.lookup(block)] = false;
+    }
+    std::sort(next_wl.begin(), next_wl.end(), by_order);
     curr_wl.swap(next_wl);
     next_wl.clear();
   }
 }
 
-bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
-                                     KillCounter &stats) {
-  LiveSet live;
+void LiveSetBlockVisitor::WalkBlock(llvm::BasicBlock *block, LiveSet &live,
+                                    KillCounter *stats) {
+  live.reset();
 
   for (auto inst_it = block->rbegin(); inst_it != block->rend(); ++inst_it) {
     auto inst = &*inst_it;
 
+    // What is live after a tail call is up to its callee, which is handled
+    // with the call itself.
+    if (llvm::isa<llvm::ReturnInst>(inst) && inst->getPrevNode() &&
+        IsTailCall(inst->getPrevNode())) {
+      continue;
+
     // Code that we return to or branch to could read out registers
     // so mark as all live.
-    if (llvm::isa<llvm::ReturnInst>(inst) ||
-        llvm::isa<llvm::UnreachableInst>(inst) ||
-        llvm::isa<llvm::IndirectBrInst>(inst) ||
-        llvm::isa<llvm::ResumeInst>(inst)) {
-      live.set();
-
-#if LLVM_VERSION_NUMBER >= LLVM_VERSION(3, 8)
-    } else if (llvm::isa<llvm::CatchSwitchInst>(inst) ||
-               llvm::isa<llvm::CatchReturnInst>(inst) ||
-               llvm::isa<llvm::CatchPadInst>(inst) ||
-               llvm::isa<llvm::CleanupPadInst>(inst) ||
-               llvm::isa<llvm::CleanupReturnInst>(inst)) {
+    } else if (MakesAllSlotsLive(inst)) {
       live.set();
-#endif
 
-    // Update the live set from the successors. If a successors has not
-    // been visited yet then we will inherit an empty live set. This is
-    // fine because our algorithm converges towards bits being set.
+    // Update the live set from the successors.
     } else if (llvm::isa<llvm::BranchInst>(inst) ||
                llvm::isa<llvm::SwitchInst>(inst)) {
       auto succ_it = llvm::succ_begin(block);
       auto succ_end = llvm::succ_end(block);
       for (; succ_it != succ_end; succ_it++) {
-        auto succ = *succ_it;
-        live |= block_map[succ];
+        live |= *LiveOnEntry(*succ_it);
       }
 
     // This could be a call to another lifted function or control-flow
@@ -1345,40 +1844,31 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
     // memory intrinsic or LLVM intrinsic (e.g. bswap).
     } else if (llvm::isa<llvm::CallInst>(inst) ||
                llvm::isa<llvm::InvokeInst>(inst)) {
-
-      // Likely due to a more general failure to analyze this particular
-      // function.
-      auto arg_live_it = live_args.find(inst);
-      if (arg_live_it == live_args.end()) {
-        live.set();
-
-      } else {
-        live |= arg_live_it->second;
-      }
+      const auto effect = GetCallEffect(inst);
+      live.Transfer(*effect.uses, *effect.kills);
 
     } else if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
-      auto offset_ptr = state_access_offset.find(inst);
-      if (offset_ptr == state_access_offset.end()) {
+      if (!state_access_offset.count(inst)) {
         continue;
       }
 
-      if (on_remove_pass) {
-        stats.num_stores++;
+      if (stats) {
+        stats->num_stores++;
       }
 
-      auto val = store_inst->getOperand(0);
-      auto val_size = dl->getTypeAllocSize(val->getType());
-      const auto &state_slot = offset_to_slot[offset_ptr->second];
-      auto slot_num = state_slot.index;
+      uint64_t slot_num = 0;
+      const auto kills_slot = GetKilledSlot(store_inst, &slot_num);
+      if (slot_num >= live.size()) {
+        continue;  // Padding.
 
-      if (!live.test(slot_num)) {
-        if (on_remove_pass) {
+      } else if (!live.test(slot_num)) {
+        if (stats) {
           to_remove.push_back(inst);
         }
 
       // We're storing to all the bytes, so kill it. Ignore partial stores
       // (that would revive it) because it's already marked as live.
-      } else if (val_size == state_slot.size) {
+      } else if (kills_slot) {
         live.reset(slot_num);
       }
 
@@ -1391,29 +1881,36 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
       }
     }
   }
+}
 
-  auto &old_live_on_entry = block_map[block];
-  if (old_live_on_entry != live) {
-    old_live_on_entry = live;
-    return true;
-  } else {
-    return false;
-  }
+// Walk `block` backwards from its live set on exit, and collect the stores
+// into slots that aren't live.
+void LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
+                                     KillCounter &stats) {
+  WalkBlock(block, scratch, &stats);
 }
 
 void LiveSetBlockVisitor::CollectDeadInsts(KillCounter &stats) {
-  on_remove_pass = true;
   for (auto &func : module) {
     for (auto &block : func) {
       VisitBlock(&block, stats);
     }
   }
-  on_remove_pass = false;
 }
 
 // Remove all dead stores.
-bool LiveSetBlockVisitor::DeleteDeadInsts(KillCounter &stats) {
+bool LiveSetBlockVisitor::DeleteDeadInsts(KillCounter &stats,
+                                          LiftStats *lift_stats) {
   stats.dead_stores += to_remove.size();
+  if (lift_stats) {
+    for (auto inst : to_remove) {
+      const std::string_view name = inst->getFunction()->getName();
+      if (auto trace_stats = lift_stats->FindTrace(name)) {
+        trace_stats->num_dead_stores += 1;
+      }
+    }
+  }
+
   bool changed = false;
   while (!to_remove.empty()) {
     stats.removed_insts++;
@@ -1460,7 +1957,7 @@ void LiveSetBlockVisitor::CreateDOTDigraph(const remill::Arch *arch,
       << "node [shape=none margin=0 nojustify=false labeljust=l]" << std::endl;
 
   // Figure out relevant load/stores to print.
-  LiveSet used;
+  LiveSet used(live_sets.num_slots);
   for (auto &block : *func) {
     for (auto &inst : block) {
       auto offset_ptr = state_access_offset.find(&inst);
@@ -1482,22 +1979,17 @@ void LiveSetBlockVisitor::CreateDOTDigraph(const remill::Arch *arch,
 
   // Stream node information for each block.
   for (auto &block_ref : *func) {
-    auto block_live_ptr = block_map.find(&block_ref);
-    if (block_live_ptr == block_map.end()) {
-      continue;
-    }
-
     auto block = &block_ref;
-    const auto &blive = block_live_ptr->second;
+    const auto &blive = *LiveOnEntry(block);
 
     // Figure out the live set on exit from the block.
-    LiveSet exit_live;
+    LiveSet exit_live(live_sets.num_slots);
     int num_succs = 0;
     auto succ_it = llvm::succ_begin(block);
     auto succ_end = llvm::succ_end(block);
     for (; succ_it != succ_end; succ_it++) {
       auto succ = *succ_it;
-      exit_live |= block_map[succ];
+      exit_live |= *LiveOnEntry(succ);
       num_succs++;
       dot << "b" << reinterpret_cast<uintptr_t>(block) << " -> b"
           << reinterpret_cast<uintptr_t>(succ) << std::endl;
@@ -1527,7 +2019,7 @@ void LiveSetBlockVisitor::CreateDOTDigraph(const remill::Arch *arch,
 
       // First row, print out the DEAD slots on entry.
       if (debug_live_args_at_call.count(&inst)) {
-        const auto &clive = debug_live_args_at_call[&inst];
+        const auto &clive = *debug_live_args_at_call[&inst];
         dot << "<tr><td align=\"left\" colspan=\"3\">";
         sep = "dead: ";
         for (uint64_t i = 0; i < slots.size(); i++) {
@@ -1714,13 +2206,14 @@ void ForwardingBlockVisitor::VisitBlock(llvm::BasicBlock *block,
         slot_to_load.clear();
 
       } else {
-        const auto count = live_args_it->second.count();
-        if (count == kMaxNumSlots) {
+        const auto &live = *(live_args_it->second);
+        const auto count = live.count();
+        if (count == live.size()) {
           slot_to_load.clear();
 
         } else if (count) {
-          for (auto i = 0u; i < kMaxNumSlots; ++i) {
-            if (live_args_it->second.test(i)) {
+          for (auto i = 0u; i < live.size(); ++i) {
+            if (live.test(i)) {
               slot_to_load.erase(i);
             }
           }
@@ -1934,19 +2427,94 @@ std::vector<StateSlot> StateSlots(const remill::Arch *arch,
   StateVisitor vis(&dl, num_bytes);
   vis.Visit(type);
   CHECK_EQ(vis.offset_to_slot.size(), num_bytes);
-  CHECK_LT(vis.index, kMaxNumSlots);
 
   std::vector<StateSlot> offset_to_slot;
   offset_to_slot = std::move(vis.offset_to_slot);
   return offset_to_slot;
 }
 
+// Returns what `--dse_calling_convention` lets us assume about the slots at
+// calls and returns in code lifted for `arch`. Only 32-bit x86 code has a
+// calling convention that we know of.
+static CallingConvention
+GetCallingConvention(const remill::Arch *arch,
+                     const std::vector<StateSlot> &slots,
+                     LiveSetPool &live_sets) {
+  CallingConvention conv = {live_sets.All(), live_sets.All(),
+                            live_sets.None()};
+  if (!arch || !arch->IsX86()) {
+    return conv;
+  }
+
+  bool is_cdecl = false;
+  bool flags_are_dead = false;
+  llvm::SmallVector<llvm::StringRef, 2> names;
+  llvm::StringRef(FLAGS_dse_calling_convention).split(names, ',');
+  for (auto name : names) {
+    if (name == "cdecl") {
+      is_cdecl = true;
+    } else if (name == "eflags") {
+      flags_are_dead = true;
+    } else {
+      CHECK(name == "none")
+          << "Unsupported calling convention " << name.str()
+          << " for --dse_calling_convention";
+    }
+  }
+  if (!is_cdecl && !flags_are_dead) {
+    return conv;
+  }
+
+  LiveSet live_on_call(live_sets.num_slots);
+  LiveSet live_on_return(live_sets.num_slots);
+  LiveSet clobbered_by_call(live_sets.num_slots);
+  live_on_call.set();
+  live_on_return.set();
+
+  auto clobber = [&](std::string_view name, bool read_on_call,
+                     bool read_on_return) {
+    auto reg = arch->RegisterByName(name);
+    if (!reg || reg->offset >= slots.size()) {
+      return;
+    }
+    const auto slot = slots[reg->offset].index;
+    clobbered_by_call.set(slot);
+    if (!read_on_call) {
+      live_on_call.reset(slot);
+    }
+    if (!read_on_return) {
+      live_on_return.reset(slot);
+    }
+  };
+
+  // The direction flag is left alone, as it must be clear on both calls and
+  // returns.
+  if (flags_are_dead) {
+    for (auto flag : {"AF", "CF", "OF", "PF", "SF", "ZF"}) {
+      clobber(flag, false, false);
+    }
+  }
+
+  // Callees may still take arguments in registers (`thiscall`, `fastcall`),
+  // and return values in EAX and EDX.
+  if (is_cdecl) {
+    clobber("EAX", true, true);
+    clobber("ECX", true, false);
+    clobber("EDX", true, true);
+  }
+
+  conv.live_on_call = live_sets.Intern(live_on_call);
+  conv.live_on_return = live_sets.Intern(live_on_return);
+  conv.clobbered_by_call = live_sets.Intern(clobbered_by_call);
+  return conv;
+}
+
 // Analyze a module, discover aliasing loads and stores, and remove dead
 // stores into the `State` structure.
 void RemoveDeadStores(const remill::Arch *arch, llvm::Module *module,
                       llvm::Function *bb_func,
                       const std::vector<StateSlot> &slots,
-                      llvm::Function *ds_func) {
+                      llvm::Function *ds_func, LiftStats *lift_stats) {
   if (FLAGS_disable_dead_store_elimination) {
     return;
   }
@@ -1954,11 +2522,24 @@ void RemoveDeadStores(const remill::Arch *arch, llvm::Module *module,
   const auto print_dot = !FLAGS_dot_output_dir.empty();
 
   KillCounter stats = {};
+  PhaseTimes times = {};
   const llvm::DataLayout dl(module);
 
+  // Padding bytes have an out-of-range slot index.
+  size_t num_slots = 0;
+  for (const auto &slot : slots) {
+    if (slot.index != static_cast<uint64_t>(~0u)) {
+      num_slots = std::max<size_t>(num_slots, slot.index + 1u);
+    }
+  }
+
+  LiveSetPool live_sets(num_slots);
   InstToLiveSet live_args;
   InstToOffset state_access_offset;
+  FunctionSet analyzed_funcs;
+  const auto conv = GetCallingConvention(arch, slots, live_sets);
 
+  std::vector<llvm::Function *> funcs;
   for (auto &func : *module) {
     if (!IsLiftedFunction(&func, bb_func)) {
       continue;
@@ -1969,31 +2550,97 @@ void RemoveDeadStores(const remill::Arch *arch, llvm::Module *module,
       continue;
     }
 
-    ForwardAliasVisitor fav(dl, slots, live_args, state_access_offset,
-                            func.getContext());
+    funcs.push_back(&func);
+  }
 
-    // If the analysis succeeds for this function, then do store-to-load
-    // and load-to-load forwarding.
-    if (fav.Analyze(arch, stats, &func)) {
-      if (print_dot) {
-        fav.CreateDOTDigraph(arch, &func, ".offsets.dot");
-      }
+  auto num_threads = FLAGS_dse_num_threads;
+  if (!num_threads) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // The alias analysis of a function only reads the IR, so it runs on many
+  // functions at once, each with maps of its own. Anything that changes the
+  // IR or the `LLVMContext` (naming, metadata, forwarding) happens serially
+  // afterwards. Functions go through this in batches, to bound how many
+  // analyses are kept around at once.
+  struct FunctionAliases {
+    FunctionAliases(const llvm::DataLayout &dl_,
+                    const std::vector<StateSlot> &slots_,
+                    LiveSetPool &live_sets_, llvm::Function *func_)
+        : func(func_),
+          fav(dl_, slots_, live_sets_, live_args, state_access_offset,
+              func_->getContext()) {}
+
+    llvm::Function *const func;
+    InstToLiveSet live_args;
+    InstToOffset state_access_offset;
+    ForwardAliasVisitor fav;
+    KillCounter stats{};
+    bool analyzed{false};
+  };
+
+  const size_t batch_size = 64u * num_threads;
+  std::vector<std::unique_ptr<FunctionAliases>> batch;
+  for (size_t batch_begin = 0; batch_begin < funcs.size();
+       batch_begin += batch_size) {
+    const auto batch_end = std::min(funcs.size(), batch_begin + batch_size);
+
+    auto start = std::chrono::steady_clock::now();
+    batch.clear();
+    for (auto i = batch_begin; i < batch_end; ++i) {
+      batch.emplace_back(new FunctionAliases(dl, slots, live_sets, funcs[i]));
+      ResetInstructionNames(*funcs[i], batch.back()->fav.reg_md_id);
+    }
+
+    ParallelFor(batch.size(), num_threads, [&](size_t i) {
+      auto &aliases = *batch[i];
+      aliases.analyzed = aliases.fav.Analyze(aliases.stats, aliases.func);
+    });
+    times.alias += MillisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (auto &aliases : batch) {
+      auto &func = *aliases->func;
+      stats.failed_funcs += aliases->stats.failed_funcs;
+      aliases->fav.FlushLogs();
+
+      // If the analysis succeeds for this function, then do store-to-load
+      // and load-to-load forwarding.
+      if (aliases->analyzed) {
+        analyzed_funcs.insert(&func);
+        aliases->fav.AnnotateRegisterPointers(arch, &func);
+
+        if (print_dot) {
+          aliases->fav.CreateDOTDigraph(arch, &func, ".offsets.dot");
+        }
 
-      if (!FLAGS_disable_register_forwarding) {
-        llvm::DominatorTree dominator_tree(func);
-        ForwardingBlockVisitor fbv(func, dominator_tree, state_access_offset,
-                                   slots, live_args, &dl);
-        fbv.Visit(fav.state_offset, stats);
+        if (!FLAGS_disable_register_forwarding) {
+          llvm::DominatorTree dominator_tree(func);
+          ForwardingBlockVisitor fbv(func, dominator_tree,
+                                     aliases->state_access_offset, slots,
+                                     aliases->live_args, &dl);
+          fbv.Visit(aliases->fav.state_offset, stats);
+        }
       }
+
+      live_args.merge(aliases->live_args);
+      state_access_offset.merge(aliases->state_access_offset);
     }
+    times.forward += MillisecondsSince(start);
   }
+  batch.clear();
 
   // Perform live set analysis
+  auto start = std::chrono::steady_clock::now();
   LiveSetBlockVisitor visitor(*module, live_args, state_access_offset, slots,
-                              bb_func, &dl);
+                              live_sets, conv, analyzed_funcs, bb_func, &dl);
 
   visitor.FindLiveInsts(stats);
+  times.liveness = MillisecondsSince(start);
+
+  start = std::chrono::steady_clock::now();
   visitor.CollectDeadInsts(stats);
+  times.collect = MillisecondsSince(start);
 
   if (print_dot) {
     for (auto &func : *module) {
@@ -2003,7 +2650,9 @@ void RemoveDeadStores(const remill::Arch *arch, llvm::Module *module,
     }
   }
 
-  visitor.DeleteDeadInsts(stats);
+  start = std::chrono::steady_clock::now();
+  visitor.DeleteDeadInsts(stats, lift_stats);
+  times.remove = MillisecondsSince(start);
 
   LOG_IF(ERROR, FLAGS_log_dse_stats)
       << "Candidate stores: " << stats.num_stores << "; "
@@ -2016,7 +2665,17 @@ void RemoveDeadStores(const remill::Arch *arch, llvm::Module *module,
       << "Forwarded by casting: " << stats.fwd_casted << "; "
       << "Forwarded by reordering: " << stats.fwd_reordered << "; "
       << "Could not forward: " << stats.fwd_failed << "; "
-      << "Unanalyzed functions: " << stats.failed_funcs;
+      << "Unanalyzed functions: " << stats.failed_funcs << "; "
+      << "Distinct live sets: " << live_sets.Size() << " of " << num_slots
+      << " slots";
+
+  LOG_IF(ERROR, FLAGS_log_dse_stats)
+      << "Alias analysis: " << times.alias << " ms (" << funcs.size()
+      << " functions, " << num_threads << " threads); "
+      << "Forwarding: " << times.forward << " ms; "
+      << "Liveness: " << times.liveness << " ms; "
+      << "Collecting dead stores: " << times.collect << " ms; "
+      << "Removing dead stores: " << times.remove << " ms";
 }
 
 }  // namespace remill
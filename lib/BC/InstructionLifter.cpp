@@ -25,9 +25,8 @@ namespace {
 // Try to find the function that implements this semantics.
 llvm::Function *GetInstructionFunction(llvm::Module *module,
                                        std::string_view function) {
-  std::stringstream ss;
-  ss << "ISEL_" << function;
-  auto isel_name = ss.str();
+  std::string isel_name("ISEL_");
+  isel_name += function;
 
   auto isel = FindGlobaVariable(module, isel_name);
   if (!isel) {
@@ -47,7 +46,8 @@ llvm::Function *GetInstructionFunction(llvm::Module *module,
 }  // namespace
 
 InstructionLifter::Impl::Impl(const Arch *arch_,
-                              const IntrinsicTable *intrinsics_)
+                              const IntrinsicTable *intrinsics_,
+                              LiftStats *stats_)
     : arch(arch_),
       word_type(llvm::Type::getIntNTy(
           intrinsics_->async_hyper_call->getContext(), arch->address_size)),
@@ -56,20 +56,52 @@ InstructionLifter::Impl::Impl(const Arch *arch_,
       invalid_instruction(
           GetInstructionFunction(module, kInvalidInstructionISelName)),
       unsupported_instruction(
-          GetInstructionFunction(module, kUnsupportedInstructionISelName)) {
+          GetInstructionFunction(module, kUnsupportedInstructionISelName)),
+      stats(stats_) {
 
   CHECK(invalid_instruction != nullptr)
       << kInvalidInstructionISelName << " doesn't exist";
 
   CHECK(unsupported_instruction != nullptr)
       << kUnsupportedInstructionISelName << " doesn't exist";
+
+  isel_funcs.resize(arch->NumISels(), nullptr);
+  ForEachISel(module, [this](llvm::GlobalVariable *isel, llvm::Function *sem) {
+    const auto name = isel->getName();
+    if (!sem || !isel->isConstant() || !name.startswith("ISEL_")) {
+      return;
+    }
+    const auto id = arch->ISelId(name.drop_front(5));
+    if (id < isel_funcs.size()) {
+      isel_funcs[id] = sem;
+    }
+  });
+}
+
+// Find the function that implements the semantics of `inst`. This is an index
+// lookup if the decoder resolved the ISEL ID of the instruction, and a name
+// lookup in the ISEL index otherwise.
+llvm::Function *
+InstructionLifter::Impl::GetISelFunction(const Instruction &inst) const {
+  auto id = inst.isel_id;
+  if (id == kInvalidISelId || inst.arch != arch) {
+    id = arch->ISelId(inst.function);
+  }
+  if (id < isel_funcs.size() && isel_funcs[id]) {
+    return isel_funcs[id];
+  }
+
+  // Not indexed, e.g. because `arch` was initialized from another semantics
+  // module. This also reports malformed `ISEL_` variables.
+  return GetInstructionFunction(module, inst.function);
 }
 
 InstructionLifter::~InstructionLifter(void) {}
 
 InstructionLifter::InstructionLifter(const Arch *arch_,
-                                     const IntrinsicTable *intrinsics_)
-    : impl(new Impl(arch_, intrinsics_)) {}
+                                     const IntrinsicTable *intrinsics_,
+                                     LiftStats *stats_)
+    : impl(new Impl(arch_, intrinsics_, stats_)) {}
 
 // Lift a single instruction into a basic block. `is_delayed` signifies that
 // this instruction will execute within the delay slot of another instruction.
@@ -94,7 +126,7 @@ LiftStatus InstructionLifter::LiftIntoBlock(Instruction &arch_inst,
 
   // Cache invalidation.
   if (func != impl->last_func) {
-    impl->reg_ptr_cache.clear();
+    impl->ResetRegisterCache();
     impl->last_func = func;
 
     CHECK_EQ(impl->module, module)
@@ -102,7 +134,7 @@ LiftStatus InstructionLifter::LiftIntoBlock(Instruction &arch_inst,
   }
 
   if (arch_inst.IsValid()) {
-    isel_func = GetInstructionFunction(module, arch_inst.function);
+    isel_func = impl->GetISelFunction(arch_inst);
   } else {
     isel_func = impl->invalid_instruction;
     arch_inst.operands.clear();
@@ -111,6 +143,9 @@ LiftStatus InstructionLifter::LiftIntoBlock(Instruction &arch_inst,
 
   if (!isel_func) {
     LOG(ERROR) << "Missing semantics for instruction " << arch_inst.Serialize();
+    if (impl->stats) {
+      impl->stats->AddUnsupportedInstruction(arch_inst.function);
+    }
     isel_func = impl->unsupported_instruction;
     arch_inst.operands.clear();
     status = kLiftedUnsupportedInstruction;
@@ -229,15 +264,14 @@ InstructionLifter::LoadRegAddress(llvm::BasicBlock *block,
 
   // Invalidate the cache.
   if (func != impl->last_func) {
-    impl->reg_ptr_cache.clear();
+    impl->ResetRegisterCache();
     impl->last_func = func;
 
     CHECK_EQ(func->getParent(), impl->module);
   }
 
-  std::string reg_name(reg_name_.data(), reg_name_.size());
-  auto [reg_ptr_it, added] =
-      impl->reg_ptr_cache.emplace(std::move(reg_name), nullptr);
+  auto [reg_ptr_it, added] = impl->reg_ptr_cache.try_emplace(
+      llvm::StringRef(reg_name_.data(), reg_name_.size()), nullptr);
 
   if (reg_ptr_it->second) {
     (void) added;
@@ -293,7 +327,7 @@ InstructionLifter::LoadRegAddress(llvm::BasicBlock *block,
 
 // Clear out the cache of the current register values/addresses loaded.
 void InstructionLifter::ClearCache(void) const {
-  impl->reg_ptr_cache.clear();
+  impl->ResetRegisterCache();
   impl->last_func = nullptr;
 }
 
@@ -16,6 +16,7 @@
 
 #include <glog/logging.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
@@ -49,6 +50,7 @@
 #include "remill/BC/ABI.h"
 #include "remill/BC/Compat/DataLayout.h"
 #include "remill/BC/IntrinsicTable.h"
+#include "remill/BC/LiftStats.h"
 #include "remill/BC/Util.h"
 #include "remill/OS/OS.h"
 
@@ -56,7 +58,8 @@ namespace remill {
 
 class InstructionLifter::Impl {
  public:
-  Impl(const Arch *arch_, const IntrinsicTable *intrinsics_);
+  Impl(const Arch *arch_, const IntrinsicTable *intrinsics_,
+       LiftStats *stats_);
 
   // Architecture being used for lifting.
   const Arch *const arch;
@@ -67,8 +70,17 @@ class InstructionLifter::Impl {
   // Set of intrinsics.
   const IntrinsicTable *const intrinsics;
 
-  // Cache of looked up registers inside of `last_func`.
-  std::unordered_map<std::string, llvm::Value *> reg_ptr_cache;
+  // Cache of looked up registers inside of `last_func`. Entries are kept when
+  // moving on to another function and only their values are reset, so that
+  // looking up a register doesn't allocate in the steady state.
+  llvm::StringMap<llvm::Value *> reg_ptr_cache;
+
+  // Forget the cached register addresses of `last_func`.
+  void ResetRegisterCache(void) {
+    for (auto &entry : reg_ptr_cache) {
+      entry.second = nullptr;
+    }
+  }
 
   // The function into which we're lifting. If This gets out of date, we
   // clear out `reg_ptr_cache`.
@@ -77,6 +89,15 @@ class InstructionLifter::Impl {
   llvm::Module *const module;
   llvm::Function *const invalid_instruction;
   llvm::Function *const unsupported_instruction;
+
+  // Semantics functions of `module`, indexed by their ISEL ID in `arch`.
+  std::vector<llvm::Function *> isel_funcs;
+
+  // Where instructions without semantics are counted, if anywhere.
+  LiftStats *const stats;
+
+  // Find the function that implements the semantics of `inst`.
+  llvm::Function *GetISelFunction(const Instruction &inst) const;
 };
 
 }  // namespace remill
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remill/BC/LiftStats.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace remill {
+namespace {
+
+static void WriteTraceStats(llvm::json::OStream &json,
+                            const TraceStats &stats) {
+  auto attr = [&json](llvm::StringRef name, uint64_t val) {
+    json.attribute(name, static_cast<int64_t>(val));
+  };
+  attr("num_decoded", stats.num_decoded);
+  attr("num_lifted", stats.num_lifted);
+  attr("num_unsupported", stats.num_unsupported);
+  attr("decode_ns", stats.decode_ns);
+  attr("lift_ns", stats.lift_ns);
+  attr("num_ir_insts", stats.num_ir_insts);
+  attr("num_optimized_ir_insts", stats.num_optimized_ir_insts);
+  attr("num_dead_stores", stats.num_dead_stores);
+}
+
+}  // namespace
+
+void TraceStats::Merge(const TraceStats &that) {
+  addr = addr ? addr : that.addr;
+  num_decoded += that.num_decoded;
+  num_lifted += that.num_lifted;
+  num_unsupported += that.num_unsupported;
+  decode_ns += that.decode_ns;
+  lift_ns += that.lift_ns;
+  num_ir_insts += that.num_ir_insts;
+  num_optimized_ir_insts += that.num_optimized_ir_insts;
+  num_dead_stores += that.num_dead_stores;
+}
+
+TraceStats &LiftStats::Trace(std::string_view name) {
+  auto it = traces.find(name);
+  if (it == traces.end()) {
+    it = traces.emplace(std::string(name), TraceStats()).first;
+  }
+  return it->second;
+}
+
+TraceStats *LiftStats::FindTrace(std::string_view name) {
+  auto it = traces.find(name);
+  return it == traces.end() ? nullptr : &(it->second);
+}
+
+void LiftStats::AddUnsupportedInstruction(std::string_view isel_name) {
+  auto it = unsupported_isels.find(isel_name);
+  if (it == unsupported_isels.end()) {
+    it = unsupported_isels.emplace(std::string(isel_name), 0u).first;
+  }
+  it->second += 1;
+}
+
+void LiftStats::Merge(const LiftStats &that) {
+  for (const auto &[name, stats] : that.traces) {
+    Trace(name).Merge(stats);
+  }
+  for (const auto &[isel_name, count] : that.unsupported_isels) {
+    unsupported_isels[isel_name] += count;
+  }
+}
+
+TraceStats LiftStats::Total(void) const {
+  TraceStats total;
+  for (const auto &[name, stats] : traces) {
+    total.Merge(stats);
+  }
+  total.addr = 0;
+  return total;
+}
+
+bool LiftStats::WriteJSON(const std::string &path) const {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Could not save lifting statistics to " << path << ": "
+               << ec.message();
+    return false;
+  }
+
+  std::vector<const std::pair<const std::string, TraceStats> *> by_addr;
+  for (const auto &entry : traces) {
+    by_addr.push_back(&entry);
+  }
+  std::stable_sort(by_addr.begin(), by_addr.end(),
+                   [](const auto *a, const auto *b) {
+                     return a->second.addr < b->second.addr;
+                   });
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("num_traces", static_cast<int64_t>(traces.size()));
+    json.attributeObject("total", [&] { WriteTraceStats(json, Total()); });
+    json.attributeObject("unsupported_isels", [&] {
+      for (const auto &[isel_name, count] : unsupported_isels) {
+        json.attribute(isel_name, static_cast<int64_t>(count));
+      }
+    });
+    json.attributeArray("traces", [&] {
+      for (const auto *entry : by_addr) {
+        json.object([&] {
+          json.attribute("name", entry->first);
+          json.attribute("addr", static_cast<int64_t>(entry->second.addr));
+          WriteTraceStats(json, entry->second);
+        });
+      }
+    });
+  });
+  os << '\n';
+  os.close();
+  if (os.has_error()) {
+    LOG(ERROR) << "Could not save lifting statistics to " << path << ": "
+               << os.error().message();
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace remill
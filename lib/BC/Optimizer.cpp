@@ -16,33 +16,772 @@
 
 #include "remill/BC/Optimizer.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/Any.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/LazyCallGraph.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/Constants.h>
-#include <llvm/IR/DataLayout.h>
-#include <llvm/IR/DebugInfo.h>
-#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/LegacyPassManager.h>
-#include <llvm/IR/MDBuilder.h>
-#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
-#include <llvm/IR/Type.h>
-#include <llvm/Transforms/IPO.h>
-#include <llvm/Transforms/IPO/PassManagerBuilder.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Utils/Cloning.h>
-#include <llvm/Transforms/Utils/Local.h>
-#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/IRMover.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/DeadStoreElimination.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "remill/Arch/Arch.h"
+#include "remill/BC/Compat/BitcodeReaderWriter.h"
+#include "remill/BC/Compat/PassBuilder.h"
 #include "remill/BC/Compat/ScalarTransforms.h"
 #include "remill/BC/Compat/TargetLibraryInfo.h"
 #include "remill/BC/DeadStoreEliminator.h"
+#include "remill/BC/LiftStats.h"
+#include "remill/BC/StatePromoter.h"
 #include "remill/BC/Util.h"
 
+#include "ParallelFor.h"
+
+DEFINE_uint32(optimizer_num_threads, 0,
+              "Number of threads used to optimize the functions of a module. "
+              "Zero means one thread per hardware thread.");
+
 namespace remill {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// What the runs of a pass did, summed up over all jobs.
+struct PassStats {
+  uint64_t num_runs{0};
+  double seconds{0};
+  int64_t instruction_delta{0};
+};
+
+using PassReport = std::map<std::string, PassStats>;
+
+// What `OptimizeModule` or `OptimizeBareModule` did, for
+// `OptimizationGuide::report_filename`. Pass times add up the time spent on
+// every thread, whereas stage times are wall-clock times.
+struct OptimizationReport {
+  PassReport passes;
+  std::vector<std::pair<std::string, double>> stages;
+  uint64_t num_functions{0};
+  uint64_t num_jobs{0};
+  uint64_t num_threads{0};
+  uint64_t num_instructions_before{0};
+  uint64_t num_instructions_after{0};
+};
+
+// Times the stage of an optimization that lives as long as this.
+class StageTimer {
+ public:
+  StageTimer(OptimizationReport *report_, const char *name_)
+      : report(report_),
+        name(name_),
+        start(Clock::now()) {}
+
+  ~StageTimer(void) {
+    if (report) {
+      const std::chrono::duration<double> elapsed = Clock::now() - start;
+      report->stages.emplace_back(name, elapsed.count());
+    }
+  }
+
+ private:
+  OptimizationReport *const report;
+  const char *const name;
+  const Clock::time_point start;
+};
+
+// A batch of functions that are optimized together, in a module and context
+// of their own.
+struct OptimizationJob {
+  std::vector<std::string> func_names;
+
+  // Subset of `func_names` whose `State` is promoted to locals.
+  std::vector<std::string> promote_names;
+
+  // Bitcode of a module holding the optimized `func_names`, and declarations
+  // of whatever they still reference.
+  llvm::SmallVector<char, 0> output;
+
+  // What the passes did to this job, if there is a report.
+  PassReport passes;
+};
+
+using StringSet = std::unordered_set<std::string>;
+
+// Adds the functions that `val` refers to, possibly through constant
+// expressions, to `funcs`. Global variables are not looked through.
+static void FindReferencedFunctions(
+    llvm::Value *val, std::unordered_set<llvm::Value *> &seen,
+    std::vector<llvm::Function *> &funcs) {
+  auto c = llvm::dyn_cast<llvm::Constant>(val);
+  if (!c || !seen.insert(c).second) {
+    return;
+  }
+  if (auto func = llvm::dyn_cast<llvm::Function>(c)) {
+    funcs.push_back(func);
+  } else if (!llvm::isa<llvm::GlobalValue>(c)) {
+    for (auto &op : c->operands()) {
+      FindReferencedFunctions(op.get(), seen, funcs);
+    }
+  }
+}
+
+// Counts the instructions of the unit of IR that a pass runs on.
+static uint64_t CountInstructions(const llvm::Any &ir) {
+  if (llvm::any_isa<const llvm::Module *>(ir)) {
+    return llvm::any_cast<const llvm::Module *>(ir)->getInstructionCount();
+
+  } else if (llvm::any_isa<const llvm::Function *>(ir)) {
+    return llvm::any_cast<const llvm::Function *>(ir)->getInstructionCount();
+
+  } else if (llvm::any_isa<const llvm::LazyCallGraph::SCC *>(ir)) {
+    uint64_t num_insts = 0;
+    for (auto &node : *llvm::any_cast<const llvm::LazyCallGraph::SCC *>(ir)) {
+      num_insts += node.getFunction().getInstructionCount();
+    }
+    return num_insts;
+
+  } else if (llvm::any_isa<const llvm::Loop *>(ir)) {
+    uint64_t num_insts = 0;
+    for (auto block : llvm::any_cast<const llvm::Loop *>(ir)->blocks()) {
+      num_insts += block->size();
+    }
+    return num_insts;
+
+  } else {
+    return 0;
+  }
+}
+
+// Pass managers and adaptors show up as passes too, but only the passes that
+// they run are reported.
+static bool IsPassWrapper(llvm::StringRef name) {
+  return name.contains("PassManager") || name.contains("PassAdaptor") ||
+         name.contains("AnalysisManagerProxy") ||
+         name.contains("RepeatedPass") ||
+         name.contains("ModuleInlinerWrapperPass");
+}
+
+// The analysis managers and the default pipeline of the new pass manager for
+// one module. Everything in here belongs to the context of that module, and so
+// to a single thread.
+class Pipeline {
+ public:
+  Pipeline(llvm::Module &module, const OptimizationGuide &guide,
+           PassReport *report);
+
+  void Run(void);
+  void PromoteStateToLocals(llvm::Function *func);
+
+ private:
+  void BeforePass(llvm::StringRef name, uint64_t num_insts);
+  void AfterPass(llvm::StringRef name, const llvm::Any *ir);
+
+  llvm::Module &module;
+  const OptimizationGuide &guide;
+
+  // Passes that are running, innermost last. The time spent in analyses is
+  // counted towards the passes that asked for them.
+  struct RunningPass {
+    Clock::time_point start;
+    uint64_t num_insts;
+  };
+  PassReport *const report;
+  std::vector<RunningPass> running;
+  llvm::PassInstrumentationCallbacks callbacks;
+
+  llvm::TargetLibraryInfoImpl tli;
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+  std::unique_ptr<llvm::PassBuilder> pass_builder;
+};
+
+Pipeline::Pipeline(llvm::Module &module_, const OptimizationGuide &guide_,
+                   PassReport *report_)
+    : module(module_),
+      guide(guide_),
+      report(report_),
+      tli(llvm::Triple(module_.getTargetTriple())) {
+
+  tli.disableAllFunctions();  // `-fno-builtin`.
+
+  llvm::PipelineTuningOptions tuning;
+  tuning.LoopUnrolling = !guide.disable_loop_unrolling;
+  tuning.SLPVectorization = guide.slp_vectorize;
+  tuning.LoopVectorization = guide.loop_vectorize;
+
+  // Otherwise, the inline threshold is the one of the level, e.g. 250 at
+  // `-O3`, which is what we used to give the legacy inliner.
+  if (guide.inline_threshold &&
+      !compat::llvm::SetInlineThreshold(tuning, module,
+                                        guide.inline_threshold)) {
+    LOG(WARNING) << "Ignoring the inline threshold, which can't be set with "
+                 << "this version of LLVM";
+  }
+
+  if (report) {
+    callbacks.registerBeforeNonSkippedPassCallback(
+        [this](llvm::StringRef name, llvm::Any ir) {
+          if (!IsPassWrapper(name)) {
+            BeforePass(name, CountInstructions(ir));
+          }
+        });
+    callbacks.registerAfterPassCallback(
+        [this](llvm::StringRef name, llvm::Any ir,
+               const llvm::PreservedAnalyses &) {
+          if (!IsPassWrapper(name)) {
+            AfterPass(name, &ir);
+          }
+        });
+    callbacks.registerAfterPassInvalidatedCallback(
+        [this](llvm::StringRef name, const llvm::PreservedAnalyses &) {
+          if (!IsPassWrapper(name)) {
+            AfterPass(name, nullptr);
+          }
+        });
+  }
+
+  pass_builder = compat::llvm::CreatePassBuilder(tuning, &callbacks);
+  fam.registerPass([this] { return llvm::TargetLibraryAnalysis(tli); });
+  pass_builder->registerModuleAnalyses(mam);
+  pass_builder->registerCGSCCAnalyses(cgam);
+  pass_builder->registerFunctionAnalyses(fam);
+  pass_builder->registerLoopAnalyses(lam);
+  pass_builder->crossRegisterProxies(lam, fam, cgam, mam);
+}
+
+void Pipeline::BeforePass(llvm::StringRef, uint64_t num_insts) {
+  running.push_back({Clock::now(), num_insts});
+}
+
+// `ir` is null if the pass deleted it, in which case its instructions aren't
+// counted as removed.
+void Pipeline::AfterPass(llvm::StringRef name, const llvm::Any *ir) {
+  CHECK(!running.empty());
+  const auto pass = running.back();
+  running.pop_back();
+
+  const std::chrono::duration<double> elapsed = Clock::now() - pass.start;
+  auto &stats = (*report)[name.str()];
+  stats.num_runs += 1;
+  stats.seconds += elapsed.count();
+  if (ir) {
+    stats.instruction_delta += static_cast<int64_t>(CountInstructions(*ir)) -
+                               static_cast<int64_t>(pass.num_insts);
+  }
+}
+
+static llvm::OptimizationLevel
+GetOptimizationLevel(OptimizationProfile profile) {
+  switch (profile) {
+    case kOptimizationBalanced: return llvm::OptimizationLevel::O2;
+    case kOptimizationFastCompile: return llvm::OptimizationLevel::O1;
+    case kOptimizationSize: return llvm::OptimizationLevel::Os;
+    default: return llvm::OptimizationLevel::O3;
+  }
+}
+
+void Pipeline::Run(void) {
+  llvm::ModulePassManager module_manager;
+  if (guide.verify_input) {
+    module_manager.addPass(llvm::VerifierPass());
+  }
+  module_manager.addPass(pass_builder->buildPerModuleDefaultPipeline(
+      GetOptimizationLevel(guide.profile)));
+  if (guide.verify_output) {
+    module_manager.addPass(llvm::VerifierPass());
+  }
+  module_manager.run(module, mam);
+}
+
+// Promoting `State` only pays off once the semantics are inlined, and then
+// the locals have to be cleaned up again.
+void Pipeline::PromoteStateToLocals(llvm::Function *func) {
+  static constexpr auto kPassName = "remill::PromoteStateToLocals";
+  if (report) {
+    BeforePass(kPassName, func->getInstructionCount());
+  }
+  const auto num_promoted = ::remill::PromoteStateToLocals(func);
+  if (report) {
+    llvm::Any ir(static_cast<const llvm::Function *>(func));
+    AfterPass(kPassName, &ir);
+  }
+  if (!num_promoted) {
+    return;
+  }
+
+  fam.invalidate(*func, llvm::PreservedAnalyses::none());
+
+  llvm::FunctionPassManager cleanup_manager;
+  cleanup_manager.addPass(llvm::PromotePass());
+  cleanup_manager.addPass(llvm::EarlyCSEPass(true));
+  cleanup_manager.addPass(llvm::InstCombinePass());
+  cleanup_manager.addPass(llvm::GVNPass());
+  cleanup_manager.addPass(llvm::DSEPass());
+  cleanup_manager.addPass(llvm::SimplifyCFGPass());
+  cleanup_manager.run(*func, fam);
+}
+
+// Loads the functions of `job` out of `input`, which is the bitcode of the
+// whole module, optimizes them, and saves them into `job.output`.
+//
+// Only the functions of `job` and what they call are materialized. Callees
+// become `available_externally`, so that they can be inlined but not changed
+// in ways that the functions of other jobs wouldn't see.
+//
+// The other functions in `optimized` are only materialized if `inline_funcs`
+// is set, and then without the other functions in `optimized` that they call,
+// as otherwise every job could end up with most of the module. If it isn't
+// set, the functions of `job` aren't inlined into each other either, so that
+// the result doesn't depend on how the functions are split into jobs.
+static void OptimizeJob(llvm::MemoryBufferRef input, const StringSet &optimized,
+                        bool inline_funcs, const OptimizationGuide &guide,
+                        OptimizationJob &job) {
+  llvm::LLVMContext context;
+  auto module_or_err = llvm::getLazyBitcodeModule(
+      input, context, true /* ShouldLazyLoadMetadata */);
+  CHECK(module_or_err) << "Unable to load module to optimize: "
+                       << llvm::toString(module_or_err.takeError());
+  auto module = std::move(*module_or_err);
+
+  auto materialize = [](llvm::Function *func) {
+    if (auto err = func->materialize()) {
+      LOG(FATAL) << "Unable to load function " << func->getName().str()
+                 << ": " << llvm::toString(std::move(err));
+    }
+  };
+
+  std::unordered_set<llvm::Function *> job_funcs;
+  std::vector<llvm::Function *> work_list;
+  for (const auto &name : job.func_names) {
+    auto func = module->getFunction(name);
+    CHECK(func != nullptr) << "Missing function " << name << " to optimize";
+    materialize(func);
+    job_funcs.insert(func);
+    work_list.push_back(func);
+  }
+
+  std::unordered_set<llvm::Function *> callees;
+  std::unordered_set<llvm::Value *> seen;
+  std::vector<llvm::Function *> refs;
+  while (!work_list.empty()) {
+    auto func = work_list.back();
+    work_list.pop_back();
+
+    refs.clear();
+    for (auto &inst : llvm::instructions(*func)) {
+      for (auto &op : inst.operands()) {
+        FindReferencedFunctions(op.get(), seen, refs);
+      }
+    }
+    for (auto ref : refs) {
+      if (job_funcs.count(ref) || callees.count(ref)) {
+        continue;
+      }
+      const auto is_optimized = optimized.count(ref->getName().str()) != 0;
+      if (is_optimized && (!inline_funcs || !job_funcs.count(func))) {
+        continue;
+      }
+      materialize(ref);
+      callees.insert(ref);
+      work_list.push_back(ref);
+    }
+  }
+
+  // Everything else becomes a declaration.
+  for (auto &func : *module) {
+    if (!job_funcs.count(&func) && !callees.count(&func)) {
+      func.setIsMaterializable(false);
+    }
+  }
+  if (auto err = module->materializeAll()) {
+    LOG(FATAL) << "Unable to load module to optimize: "
+               << llvm::toString(std::move(err));
+  }
+
+  for (auto &func : *module) {
+    if (job_funcs.count(&func)) {
+      if (!inline_funcs) {
+        func.addFnAttr(llvm::Attribute::NoInline);
+      }
+    } else if (!func.isDeclaration()) {
+      func.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+      func.setComdat(nullptr);
+    } else {
+      func.setComdat(nullptr);
+    }
+  }
+
+  Pipeline pipeline(*module, guide,
+                    guide.report_filename.empty() ? nullptr : &job.passes);
+  pipeline.Run();
+  for (const auto &name : job.promote_names) {
+    pipeline.PromoteStateToLocals(module->getFunction(name));
+  }
+
+  // Keep only what the optimized functions need in order to be linked back
+  // into the original module. Variables made up by the optimizer (e.g. switch
+  // tables) are internal, and get copied over.
+  for (auto &func : *module) {
+    if (job_funcs.count(&func)) {
+      if (!inline_funcs) {
+        func.removeFnAttr(llvm::Attribute::NoInline);
+      }
+      if (guide.inline_threshold) {
+        compat::llvm::ClearInlineThreshold(func);
+      }
+    } else if (!func.isDeclaration()) {
+      func.deleteBody();
+    }
+  }
+
+  for (auto &var : module->globals()) {
+    if (!var.hasLocalLinkage() && var.hasInitializer()) {
+      var.setInitializer(nullptr);
+      var.setComdat(nullptr);
+    }
+  }
+
+  for (auto changed = true; changed;) {
+    changed = false;
+    for (auto it = module->global_begin(); it != module->global_end();) {
+      auto &var = *it++;
+      if (var.use_empty()) {
+        var.eraseFromParent();
+        changed = true;
+      }
+    }
+    for (auto it = module->begin(); it != module->end();) {
+      auto &func = *it++;
+      if (!job_funcs.count(&func) && func.use_empty()) {
+        func.eraseFromParent();
+        changed = true;
+      }
+    }
+  }
+
+  for (auto it = module->named_metadata_begin();
+       it != module->named_metadata_end();) {
+    auto &md = *it++;
+    if (md.getName() != "llvm.module.flags") {
+      module->eraseNamedMetadata(&md);
+    }
+  }
+
+  llvm::raw_svector_ostream os(job.output);
+  llvm::WriteBitcodeToFile(*module, os);
+}
+
+// Replaces the bodies of the functions of `job` in `module` with the optimized
+// ones. The functions themselves stay the same, as callers of the optimizer
+// hold on to them.
+//
+// Loading the bitcode into the context of `module` makes fresh copies of the
+// named structure types, so this goes through `mover`, which maps them back
+// to the ones of `module`.
+static void ImportJob(llvm::IRMover &mover, llvm::Module *module,
+                      const OptimizationJob &job) {
+  llvm::MemoryBufferRef input(
+      llvm::StringRef(job.output.data(), job.output.size()), "optimized");
+  auto result_or_err = llvm::parseBitcodeFile(input, module->getContext());
+  CHECK(result_or_err) << "Unable to load optimized functions: "
+                       << llvm::toString(result_or_err.takeError());
+  auto result = std::move(*result_or_err);
+
+  // Get the originals out of the way, so that the optimized functions are
+  // moved in as new ones.
+  std::vector<llvm::Function *> dest_funcs;
+  std::vector<llvm::GlobalValue *> source_funcs;
+  for (const auto &name : job.func_names) {
+    auto dest_func = module->getFunction(name);
+    dest_func->setName("");
+    dest_funcs.push_back(dest_func);
+    source_funcs.push_back(result->getFunction(name));
+  }
+
+  auto err = mover.move(
+      std::move(result), source_funcs,
+      [](llvm::GlobalValue &, llvm::IRMover::ValueAdder) {},
+      false /* IsPerformingImport */);
+  if (err) {
+    LOG(FATAL) << "Unable to link optimized functions: "
+               << llvm::toString(std::move(err));
+  }
+
+  for (size_t i = 0; i < dest_funcs.size(); ++i) {
+    const auto &name = job.func_names[i];
+    auto dest_func = dest_funcs[i];
+    auto func = module->getFunction(name);
+    CHECK_EQ(func->getFunctionType(), dest_func->getFunctionType());
+
+    dest_func->deleteBody();
+    dest_func->getBasicBlockList().splice(dest_func->end(),
+                                          func->getBasicBlockList());
+    auto dest_arg = dest_func->arg_begin();
+    for (auto &arg : func->args()) {
+      dest_arg->takeName(&arg);
+      arg.replaceAllUsesWith(&*dest_arg++);
+    }
+    dest_func->setAttributes(func->getAttributes());
+    func->replaceAllUsesWith(dest_func);
+    func->eraseFromParent();
+    dest_func->setName(name);
+  }
+}
+
+// Optimizes `funcs` on up to `--optimizer_num_threads` threads. LLVM contexts
+// can't be shared between threads, so `module` is saved as bitcode, and every
+// job loads what it needs into a context of its own. Only moving the results
+// back into `module` happens on this thread.
+static void
+OptimizeFunctions(llvm::Module *module,
+                  const std::vector<llvm::Function *> &funcs,
+                  const std::unordered_set<llvm::Function *> &promote,
+                  bool inline_funcs, const OptimizationGuide &guide,
+                  OptimizationReport *report) {
+  if (funcs.empty()) {
+    return;
+  }
+
+  auto num_threads = FLAGS_optimizer_num_threads;
+  if (!num_threads) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Every job loads the declarations of the whole module, so don't make more
+  // of them than it takes to keep the threads busy.
+  const auto num_jobs = std::min<size_t>(funcs.size(), num_threads * 4u);
+  const auto job_size = (funcs.size() + num_jobs - 1u) / num_jobs;
+  std::vector<OptimizationJob> jobs((funcs.size() + job_size - 1u) / job_size);
+  StringSet func_names;
+  for (size_t i = 0; i < funcs.size(); ++i) {
+    auto func = funcs[i];
+    CHECK(func->hasName()) << "Can't optimize unnamed functions";
+    func_names.insert(func->getName().str());
+    auto &job = jobs[i / job_size];
+    job.func_names.push_back(func->getName().str());
+    if (promote.count(func)) {
+      job.promote_names.push_back(func->getName().str());
+    }
+  }
+
+  if (report) {
+    report->num_functions = funcs.size();
+    report->num_jobs = jobs.size();
+    report->num_threads = num_threads;
+  }
+
+  // The optimized functions are linked back in by name, so for the time being,
+  // nothing can be internal. Moving the bodies also resets the linkage of the
+  // functions that are optimized.
+  std::vector<std::pair<llvm::GlobalValue *, llvm::GlobalValue::LinkageTypes>>
+      linkages;
+  for (auto func : funcs) {
+    linkages.emplace_back(func, func->getLinkage());
+  }
+  for (auto &gv : module->global_values()) {
+    if (gv.hasLocalLinkage()) {
+      if (!gv.hasName()) {
+        gv.setName("__remill_internal");
+      }
+      linkages.emplace_back(&gv, gv.getLinkage());
+      gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  llvm::SmallVector<char, 0> input;
+  {
+    StageTimer timer(report, "save");
+    llvm::raw_svector_ostream os(input);
+    llvm::WriteBitcodeToFile(*module, os);
+  }
+  const llvm::MemoryBufferRef input_ref(
+      llvm::StringRef(input.data(), input.size()),
+      module->getModuleIdentifier());
+
+  {
+    StageTimer timer(report, "optimize");
+    ParallelFor(jobs.size(), num_threads, [&](size_t i) {
+      OptimizeJob(input_ref, func_names, inline_funcs, guide, jobs[i]);
+    });
+  }
+
+  {
+    StageTimer timer(report, "import");
+    llvm::IRMover mover(*module);
+    for (auto &job : jobs) {
+      ImportJob(mover, module, job);
+      job.output.clear();
+    }
+  }
+
+  for (auto [gv, linkage] : linkages) {
+    gv->setLinkage(linkage);
+  }
+
+  // The only module-level work left is dropping what is no longer used, e.g.
+  // the inlined semantics.
+  {
+    StageTimer timer(report, "global-dce");
+    llvm::ModuleAnalysisManager mam;
+    llvm::ModulePassManager module_manager;
+    mam.registerPass([] { return llvm::PassInstrumentationAnalysis(); });
+    module_manager.addPass(llvm::GlobalDCEPass());
+    module_manager.run(*module, mam);
+  }
+
+  if (report) {
+    for (const auto &job : jobs) {
+      for (const auto &[name, job_stats] : job.passes) {
+        auto &stats = report->passes[name];
+        stats.num_runs += job_stats.num_runs;
+        stats.seconds += job_stats.seconds;
+        stats.instruction_delta += job_stats.instruction_delta;
+      }
+    }
+  }
+}
+
+// Counts the instructions of the functions named `names` that are still in
+// `module`. The optimizer may have dropped some of them.
+static uint64_t CountInstructions(const llvm::Module *module,
+                                  const std::vector<std::string> &names) {
+  uint64_t num_insts = 0;
+  for (const auto &name : names) {
+    if (auto func = module->getFunction(name)) {
+      num_insts += func->getInstructionCount();
+    }
+  }
+  return num_insts;
+}
+
+// Writes `report` to `guide.report_filename`, slowest passes first.
+static void WriteReport(const OptimizationGuide &guide,
+                        const OptimizationReport &report) {
+  std::vector<std::pair<std::string, PassStats>> passes(report.passes.begin(),
+                                                        report.passes.end());
+  std::stable_sort(passes.begin(), passes.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second.seconds > b.second.seconds;
+                   });
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(guide.report_filename, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Could not save optimization report to "
+               << guide.report_filename << ": " << ec.message();
+    return;
+  }
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("profile", llvm::StringRef(GetOptimizationProfileName(
+                                  guide.profile).data()));
+    json.attribute("num_functions", static_cast<int64_t>(report.num_functions));
+    json.attribute("num_jobs", static_cast<int64_t>(report.num_jobs));
+    json.attribute("num_threads", static_cast<int64_t>(report.num_threads));
+    json.attribute("num_instructions_before",
+                   static_cast<int64_t>(report.num_instructions_before));
+    json.attribute("num_instructions_after",
+                   static_cast<int64_t>(report.num_instructions_after));
+    json.attributeObject("stages", [&] {
+      for (const auto &[name, seconds] : report.stages) {
+        json.attribute(name, seconds);
+      }
+    });
+    json.attributeArray("passes", [&] {
+      for (const auto &[name, stats] : passes) {
+        json.object([&] {
+          json.attribute("name", name);
+          json.attribute("num_runs", static_cast<int64_t>(stats.num_runs));
+          json.attribute("seconds", stats.seconds);
+          json.attribute("instruction_delta", stats.instruction_delta);
+        });
+      }
+    });
+  });
+  os << '\n';
+}
+
+}  // namespace
+
+OptimizationProfile GetOptimizationProfile(std::string_view name) {
+  if (name == "max-speed") {
+    return kOptimizationMaxSpeed;
+  } else if (name == "balanced") {
+    return kOptimizationBalanced;
+  } else if (name == "fast-compile") {
+    return kOptimizationFastCompile;
+  } else if (name == "size") {
+    return kOptimizationSize;
+  } else {
+    return kOptimizationInvalid;
+  }
+}
+
+std::string_view GetOptimizationProfileName(OptimizationProfile profile) {
+  switch (profile) {
+    case kOptimizationMaxSpeed: return "max-speed";
+    case kOptimizationBalanced: return "balanced";
+    case kOptimizationFastCompile: return "fast-compile";
+    case kOptimizationSize: return "size";
+    case kOptimizationInvalid: return "invalid";
+  }
+  return "invalid";
+}
+
+OptimizationGuide GetOptimizationGuide(OptimizationProfile profile) {
+  OptimizationGuide guide = {};
+  guide.profile = profile;
+  switch (profile) {
+    case kOptimizationMaxSpeed:
+    case kOptimizationBalanced:
+      guide.slp_vectorize = true;
+      guide.loop_vectorize = true;
+      guide.eliminate_dead_stores = true;
+      break;
+    case kOptimizationSize:
+      guide.disable_loop_unrolling = true;
+      guide.eliminate_dead_stores = true;
+      break;
+    case kOptimizationFastCompile:
+    case kOptimizationInvalid:
+      guide.disable_loop_unrolling = true;
+      break;
+  }
+  return guide;
+}
 
 void OptimizeModule(const remill::Arch *arch, llvm::Module *module,
                     std::function<llvm::Function *(void)> generator,
@@ -51,42 +790,54 @@ void OptimizeModule(const remill::Arch *arch, llvm::Module *module,
   auto bb_func = BasicBlockFunction(module);
   auto slots = StateSlots(arch, module);
 
-  llvm::legacy::FunctionPassManager func_manager(module);
-  llvm::legacy::PassManager module_manager;
-
-  auto TLI =
-      new llvm::TargetLibraryInfoImpl(llvm::Triple(module->getTargetTriple()));
-
-  TLI->disableAllFunctions();  // `-fno-builtin`.
-
-  llvm::PassManagerBuilder builder;
-  builder.OptLevel = 3;
-  builder.SizeLevel = 0;
-  builder.Inliner = llvm::createFunctionInliningPass(250);
-  builder.LibraryInfo = TLI;  // Deleted by `llvm::~PassManagerBuilder`.
-  builder.DisableUnrollLoops = false;  // Unroll loops!
-  IF_LLVM_LT_900(builder.DisableUnitAtATime = false;)
-  builder.RerollLoops = false;
-  builder.SLPVectorize = guide.slp_vectorize;
-  builder.LoopVectorize = guide.loop_vectorize;
-  IF_LLVM_GTE_360(builder.VerifyInput = guide.verify_input;)
-  IF_LLVM_GTE_360(builder.VerifyOutput = guide.verify_output;)
-
-  // TODO(pag): Not sure when this became available.
-  IF_LLVM_GTE_800(builder.MergeFunctions = false;)
-
-  builder.populateFunctionPassManager(func_manager);
-  builder.populateModulePassManager(module_manager);
-  func_manager.doInitialization();
+  std::vector<llvm::Function *> funcs;
+  std::unordered_set<llvm::Function *> promote;
+  std::unordered_set<llvm::Function *> seen;
   llvm::Function *func = nullptr;
   while (nullptr != (func = generator())) {
-    func_manager.run(*func);
+    if (func->isDeclaration() || !seen.insert(func).second) {
+      continue;
+    }
+    funcs.push_back(func);
+    if (guide.promote_state_to_locals && func != bb_func &&
+        func->getFunctionType() == bb_func->getFunctionType()) {
+      promote.insert(func);
+    }
+  }
+
+  OptimizationReport report;
+  const auto report_ptr = guide.report_filename.empty() ? nullptr : &report;
+  std::vector<std::string> names;
+  if (report_ptr || guide.stats) {
+    for (auto func : funcs) {
+      names.push_back(func->getName().str());
+    }
+  }
+  if (report_ptr) {
+    report.num_instructions_before = CountInstructions(module, names);
   }
-  func_manager.doFinalization();
-  module_manager.run(*module);
+
+  OptimizeFunctions(module, funcs, promote, !guide.isolate_functions, guide,
+                    report_ptr);
 
   if (guide.eliminate_dead_stores) {
-    RemoveDeadStores(arch, module, bb_func, slots);
+    StageTimer timer(report_ptr, "dead-store-elimination");
+    RemoveDeadStores(arch, module, bb_func, slots, nullptr, guide.stats);
+  }
+
+  if (guide.stats) {
+    for (const auto &name : names) {
+      auto trace_stats = guide.stats->FindTrace(name);
+      auto func = module->getFunction(name);
+      if (trace_stats && func) {
+        trace_stats->num_optimized_ir_insts = func->getInstructionCount();
+      }
+    }
+  }
+
+  if (report_ptr) {
+    report.num_instructions_after = CountInstructions(module, names);
+    WriteReport(guide, report);
   }
 }
 
@@ -97,38 +848,29 @@ void OptimizeModule(const remill::Arch *arch, llvm::Module *module,
 //            `true`.
 void OptimizeBareModule(llvm::Module *module, OptimizationGuide guide) {
   CHECK(!guide.eliminate_dead_stores);
-  llvm::legacy::FunctionPassManager func_manager(module);
-  llvm::legacy::PassManager module_manager;
-
-  auto TLI =
-      new llvm::TargetLibraryInfoImpl(llvm::Triple(module->getTargetTriple()));
-
-  TLI->disableAllFunctions();  // `-fno-builtin`.
-
-  llvm::PassManagerBuilder builder;
-  builder.OptLevel = 3;
-  builder.SizeLevel = 0;
-  builder.Inliner = llvm::createFunctionInliningPass(250);
-  builder.LibraryInfo = TLI;  // Deleted by `llvm::~PassManagerBuilder`.
-  builder.DisableUnrollLoops = false;  // Unroll loops!
-  IF_LLVM_LT_900(builder.DisableUnitAtATime = false;)
-  builder.RerollLoops = false;
-  builder.SLPVectorize = guide.slp_vectorize;
-  builder.LoopVectorize = guide.loop_vectorize;
-  IF_LLVM_GTE_360(builder.VerifyInput = guide.verify_input;)
-  IF_LLVM_GTE_360(builder.VerifyOutput = guide.verify_output;)
-
-  // TODO(pag): Not sure when this became available.
-  IF_LLVM_GTE_800(builder.MergeFunctions = false;)
-
-  builder.populateFunctionPassManager(func_manager);
-  builder.populateModulePassManager(module_manager);
-  func_manager.doInitialization();
+  std::vector<llvm::Function *> funcs;
   for (auto &func : *module) {
-    func_manager.run(func);
+    if (!func.isDeclaration()) {
+      funcs.push_back(&func);
+    }
+  }
+  OptimizationReport report;
+  const auto report_ptr = guide.report_filename.empty() ? nullptr : &report;
+  std::vector<std::string> names;
+  if (report_ptr) {
+    for (auto func : funcs) {
+      names.push_back(func->getName().str());
+    }
+    report.num_instructions_before = CountInstructions(module, names);
+  }
+
+  OptimizeFunctions(module, funcs, {}, true /* inline_funcs */, guide,
+                    report_ptr);
+
+  if (report_ptr) {
+    report.num_instructions_after = CountInstructions(module, names);
+    WriteReport(guide, report);
   }
-  func_manager.doFinalization();
-  module_manager.run(*module);
 }
 
 }  // namespace remill
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace remill {
+
+// Calls `cb(i)` for every `i` in `[0, n)`, spread over up to `num_threads`
+// threads, including the calling one.
+template <typename CB>
+static void ParallelFor(size_t n, unsigned num_threads, CB cb) {
+  std::atomic<size_t> next_i(0);
+  auto work = [&](void) {
+    for (auto i = next_i++; i < n; i = next_i++) {
+      cb(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (auto t = 1u; t < num_threads && t < n; ++t) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace remill
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remill/BC/StatePromoter.h"
+
+#include <llvm/ADT/APInt.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "remill/BC/ABI.h"
+#include "remill/BC/Compat/CallSite.h"
+
+namespace remill {
+namespace {
+
+// A field of `State`, as accessed by the loads and stores of a function.
+struct Field {
+  uint64_t offset;
+  uint64_t size;
+  llvm::Type *type;
+  llvm::Align align;
+
+  // Whether the field is cached in `local` for the whole function. It isn't if
+  // some other load or store overlaps it in a different way.
+  bool promotable{true};
+
+  // Whether any of the `accesses` are stores, i.e. whether the field has to be
+  // written back.
+  bool stored{false};
+
+  std::vector<llvm::Instruction *> accesses;
+  llvm::AllocaInst *local{nullptr};
+  llvm::Value *state_ptr{nullptr};
+};
+
+class StatePromoter {
+ public:
+  explicit StatePromoter(llvm::Function &func_)
+      : func(func_),
+        dl(func_.getParent()->getDataLayout()),
+        state(func_.getArg(kStatePointerArgNum)) {}
+
+  uint64_t Promote(void);
+
+ private:
+  bool FindAccesses(void);
+  void AddAccess(llvm::Instruction *inst, llvm::Value *ptr, llvm::Type *type,
+                 llvm::Align align, bool is_store);
+  void FindEscapingCalls(void);
+  void FindPromotableFields(void);
+  void CreateLocals(void);
+  void WriteBack(llvm::Instruction *before);
+  void Reload(llvm::Instruction *before);
+
+  llvm::Function &func;
+  const llvm::DataLayout &dl;
+  llvm::Argument *const state;
+
+  // Fields in order of their first access, so that the output doesn't depend
+  // on the addresses of types.
+  std::vector<Field> fields;
+  std::map<std::pair<uint64_t, llvm::Type *>, size_t> field_index;
+
+  // Instructions that may access `State` other than through the promoted
+  // fields, e.g. calls that are passed a pointer into `State`.
+  std::vector<llvm::Instruction *> escapes;
+  std::unordered_set<llvm::Instruction *> escape_set;
+};
+
+// Follows the pointers derived from `state` to the loads and stores through
+// them. Returns `false` if a pointer into `State` leaves the function in some
+// way other than as a call argument.
+bool StatePromoter::FindAccesses(void) {
+  std::vector<llvm::Value *> work_list = {state};
+  std::unordered_set<llvm::Value *> seen = {state};
+
+  while (!work_list.empty()) {
+    auto ptr = work_list.back();
+    work_list.pop_back();
+
+    for (auto &use : ptr->uses()) {
+      auto user = use.getUser();
+      if (llvm::isa<llvm::GetElementPtrInst>(user) ||
+          llvm::isa<llvm::BitCastInst>(user) ||
+          llvm::isa<llvm::AddrSpaceCastInst>(user) ||
+          llvm::isa<llvm::PHINode>(user) || llvm::isa<llvm::SelectInst>(user)) {
+        if (seen.insert(user).second) {
+          work_list.push_back(user);
+        }
+
+      } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(user)) {
+        if (load->isSimple()) {
+          AddAccess(load, ptr, load->getType(), load->getAlign(), false);
+        } else if (escape_set.insert(load).second) {
+          escapes.push_back(load);
+        }
+
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+        if (use.getOperandNo() != store->getPointerOperandIndex()) {
+          return false;  // A pointer into `State` is stored to memory.
+
+        } else if (store->isSimple()) {
+          AddAccess(store, ptr, store->getValueOperand()->getType(),
+                    store->getAlign(), true);
+
+        } else if (escape_set.insert(store).second) {
+          escapes.push_back(store);
+        }
+
+      // We can't put the reloads on the edges out of an `invoke`, or between
+      // a `musttail` call and the `ret` after it.
+      } else if (llvm::isa<llvm::InvokeInst>(user)) {
+        return false;
+
+      } else if (auto call = llvm::dyn_cast<llvm::CallInst>(user)) {
+        if (call->isMustTailCall()) {
+          return false;
+        } else if (escape_set.insert(call).second) {
+          escapes.push_back(call);
+        }
+
+      // Comparing pointers doesn't access `State`.
+      } else if (!llvm::isa<llvm::ICmpInst>(user)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void StatePromoter::AddAccess(llvm::Instruction *inst, llvm::Value *ptr,
+                              llvm::Type *type, llvm::Align align,
+                              bool is_store) {
+  llvm::APInt offset(dl.getIndexTypeSizeInBits(ptr->getType()), 0);
+  auto base = ptr->stripAndAccumulateConstantOffsets(dl, offset, true);
+
+  // Accesses at variable offsets, e.g. into the x87 stack, could overlap any
+  // field, so they must see `State` as it is.
+  if (base != state || offset.isNegative()) {
+    if (escape_set.insert(inst).second) {
+      escapes.push_back(inst);
+    }
+    return;
+  }
+
+  const auto key = std::make_pair(offset.getZExtValue(), type);
+  auto [it, added] = field_index.emplace(key, fields.size());
+  if (added) {
+    fields.emplace_back();
+    auto &field = fields.back();
+    field.offset = key.first;
+    field.size = dl.getTypeStoreSize(type);
+    field.type = type;
+    field.align = align;
+  }
+
+  auto &field = fields[it->second];
+  field.align = std::min(field.align, align);
+  field.stored = field.stored || is_store;
+  field.accesses.push_back(inst);
+}
+
+// Like the dead store eliminator, assume that calls access `State` only if they
+// are passed a pointer into it, unless we don't know what they call.
+void StatePromoter::FindEscapingCalls(void) {
+  for (auto &inst : llvm::instructions(func)) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call || escape_set.count(call)) {
+      continue;
+    }
+    auto callee =
+        compat::llvm::CallSite(call).getCalledValue()->stripPointerCasts();
+    if (llvm::isa<llvm::InlineAsm>(callee)) {
+      continue;
+    }
+    auto callee_func = llvm::dyn_cast<llvm::Function>(callee);
+    if (!callee_func || callee_func->getName().startswith("__mcsema")) {
+      escape_set.insert(call);
+      escapes.push_back(call);
+    }
+  }
+}
+
+// A field is only promoted if all accesses to its bytes are to the whole field
+// with the same type. Otherwise, the overlapping fields are left in `State`.
+void StatePromoter::FindPromotableFields(void) {
+  std::vector<Field *> by_offset;
+  for (auto &field : fields) {
+    by_offset.push_back(&field);
+  }
+  std::sort(by_offset.begin(), by_offset.end(),
+            [](const Field *a, const Field *b) { return a->offset < b->offset; });
+
+  for (size_t i = 0; i < by_offset.size(); ++i) {
+    const auto end = by_offset[i]->offset + by_offset[i]->size;
+    for (auto j = i + 1; j < by_offset.size() && by_offset[j]->offset < end;
+         ++j) {
+      by_offset[i]->promotable = false;
+      by_offset[j]->promotable = false;
+    }
+  }
+}
+
+// Creates the `alloca`s for the promoted fields, and initializes them from
+// `State` on entry to the function.
+void StatePromoter::CreateLocals(void) {
+  auto &entry = func.getEntryBlock();
+  llvm::IRBuilder<> ir(&entry, entry.getFirstInsertionPt());
+  for (auto &field : fields) {
+    if (field.promotable) {
+      field.local = ir.CreateAlloca(field.type);
+    }
+  }
+
+  const auto addr_space = state->getType()->getPointerAddressSpace();
+  auto byte_ptr = ir.CreateBitCast(
+      state, llvm::Type::getInt8PtrTy(func.getContext(), addr_space));
+
+  for (auto &field : fields) {
+    if (!field.promotable) {
+      continue;
+    }
+    field.state_ptr = ir.CreateBitCast(
+        ir.CreateConstInBoundsGEP1_64(ir.getInt8Ty(), byte_ptr, field.offset),
+        llvm::PointerType::get(field.type, addr_space));
+    ir.CreateStore(
+        ir.CreateAlignedLoad(field.type, field.state_ptr, field.align),
+        field.local);
+  }
+}
+
+void StatePromoter::WriteBack(llvm::Instruction *before) {
+  llvm::IRBuilder<> ir(before);
+  for (auto &field : fields) {
+    if (field.promotable && field.stored) {
+      ir.CreateAlignedStore(ir.CreateLoad(field.type, field.local),
+                            field.state_ptr, field.align);
+    }
+  }
+}
+
+void StatePromoter::Reload(llvm::Instruction *before) {
+  llvm::IRBuilder<> ir(before);
+  for (auto &field : fields) {
+    if (field.promotable) {
+      ir.CreateStore(
+          ir.CreateAlignedLoad(field.type, field.state_ptr, field.align),
+          field.local);
+    }
+  }
+}
+
+uint64_t StatePromoter::Promote(void) {
+  if (!FindAccesses()) {
+    return 0;
+  }
+
+  FindPromotableFields();
+  const auto num_promoted = static_cast<uint64_t>(std::count_if(
+      fields.begin(), fields.end(),
+      [](const Field &field) { return field.promotable; }));
+  if (!num_promoted) {
+    return 0;
+  }
+
+  FindEscapingCalls();
+  CreateLocals();
+
+  for (auto &field : fields) {
+    if (!field.promotable) {
+      continue;
+    }
+    for (auto inst : field.accesses) {
+      if (auto load = llvm::dyn_cast<llvm::LoadInst>(inst)) {
+        load->setOperand(load->getPointerOperandIndex(), field.local);
+        load->setAlignment(field.local->getAlign());
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(inst)) {
+        store->setOperand(store->getPointerOperandIndex(), field.local);
+        store->setAlignment(field.local->getAlign());
+      }
+    }
+  }
+
+  // Tail calls that return what they return leave nothing to reload, and
+  // nothing has changed since the write back before them.
+  auto is_tail_call = [](llvm::Instruction *inst) {
+    auto ret = llvm::dyn_cast_or_null<llvm::ReturnInst>(inst->getNextNode());
+    return ret && ret->getReturnValue() == inst;
+  };
+
+  for (auto inst : escapes) {
+    WriteBack(inst);
+    if (!is_tail_call(inst)) {
+      Reload(inst->getNextNode());
+    }
+  }
+
+  for (auto &block : func) {
+    if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) {
+      auto prev = ret->getPrevNode();
+      if (!prev || !escape_set.count(prev) || !is_tail_call(prev)) {
+        WriteBack(ret);
+      }
+    }
+  }
+
+  return num_promoted;
+}
+
+}  // namespace
+
+uint64_t PromoteStateToLocals(llvm::Function *func) {
+  if (func->isDeclaration() || func->arg_size() <= kStatePointerArgNum ||
+      !func->getArg(kStatePointerArgNum)->getType()->isPointerTy()) {
+    return 0;
+  }
+  return StatePromoter(*func).Promote();
+}
+
+}  // namespace remill
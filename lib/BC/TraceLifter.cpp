@@ -14,10 +14,15 @@
  * limitations under the License.
  */
 
+#include <llvm/ADT/DenseMap.h>
 #include <remill/BC/TraceLifter.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <set>
 #include <sstream>
+#include <vector>
 
 #include "InstructionLifter.h"
 
@@ -50,6 +55,26 @@ void TraceManager::ForEachDevirtualizedTarget(
   // Must be extended.
 }
 
+// Apply a callback to every secondary entry of the trace at `trace_addr`.
+void TraceManager::ForEachSecondaryEntry(uint64_t,
+                                         std::function<void(uint64_t)>) {}
+
+// Keep the `__remill_function_call` marker of conditional direct calls.
+bool TraceManager::MarkConditionalDirectCalls(void) {
+  return true;
+}
+
+// Try to read up to `num_bytes` executable bytes starting at `addr`.
+size_t TraceManager::TryReadExecutableBytes(uint64_t addr, uint8_t *bytes,
+                                            size_t num_bytes) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    if (!TryReadExecutableByte(addr + i, &(bytes[i]))) {
+      return i;
+    }
+  }
+  return num_bytes;
+}
+
 // Figure out the name for the trace starting at address `addr`.
 std::string TraceManager::TraceName(uint64_t addr) {
   std::stringstream ss;
@@ -61,11 +86,27 @@ namespace {
 
 using DecoderWorkList = std::set<uint64_t>;  // For ordering.
 
+using Clock = std::chrono::steady_clock;
+
+static uint64_t NanosecondsSince(Clock::time_point start) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           start)
+          .count());
+}
+
+// Min-heap of instruction addresses. Unlike a `DecoderWorkList`, it doesn't
+// allocate for every address, and keeps its storage from trace to trace. It
+// may hold an address more than once, but every instruction is only lifted
+// into its (by then non-empty) block once.
+using InstructionWorkList = std::vector<uint64_t>;
+
 }  // namespace
 
 class TraceLifter::Impl {
  public:
-  Impl(InstructionLifter *inst_lifter_, TraceManager *manager_);
+  Impl(InstructionLifter *inst_lifter_, TraceManager *manager_,
+       LiftStats *stats_);
 
   // Lift one or more traces starting from `addr`. Calls `callback` with each
   // lifted trace.
@@ -75,6 +116,14 @@ class TraceLifter::Impl {
   // Reads the bytes of an instruction at `addr` into `state.inst_bytes`.
   bool ReadInstructionBytes(uint64_t addr);
 
+  // Reads and decodes the instruction at `addr` into `inst`. Returns `false`
+  // if there are no executable bytes at `addr`.
+  bool DecodeInstruction(uint64_t addr);
+
+  // Lifts `inst_` into `into_block`, and counts it.
+  LiftStatus LiftIntoBlock(Instruction &inst_, llvm::BasicBlock *into_block,
+                           llvm::Value *state_ptr, bool is_delayed);
+
   // Return an already lifted trace starting with the code at address
   // `addr`.
   //
@@ -98,18 +147,18 @@ class TraceLifter::Impl {
   }
 
   llvm::BasicBlock *GetOrCreateBranchTakenBlock(void) {
-    inst_work_list.insert(inst.branch_taken_pc);
+    PushInstructionAddress(inst.branch_taken_pc);
     return GetOrCreateBlock(inst.branch_taken_pc);
   }
 
   llvm::BasicBlock *GetOrCreateBranchNotTakenBlock(void) {
     CHECK(inst.branch_not_taken_pc != 0);
-    inst_work_list.insert(inst.branch_not_taken_pc);
+    PushInstructionAddress(inst.branch_not_taken_pc);
     return GetOrCreateBlock(inst.branch_not_taken_pc);
   }
 
   llvm::BasicBlock *GetOrCreateNextBlock(void) {
-    inst_work_list.insert(inst.next_pc);
+    PushInstructionAddress(inst.next_pc);
     return GetOrCreateBlock(inst.next_pc);
   }
 
@@ -120,10 +169,17 @@ class TraceLifter::Impl {
     return trace_addr;
   }
 
+  void PushInstructionAddress(uint64_t inst_addr) {
+    inst_work_list.push_back(inst_addr);
+    std::push_heap(inst_work_list.begin(), inst_work_list.end(),
+                   std::greater<uint64_t>());
+  }
+
   uint64_t PopInstructionAddress(void) {
-    auto inst_it = inst_work_list.begin();
-    const auto inst_addr = *inst_it;
-    inst_work_list.erase(inst_it);
+    std::pop_heap(inst_work_list.begin(), inst_work_list.end(),
+                  std::greater<uint64_t>());
+    const auto inst_addr = inst_work_list.back();
+    inst_work_list.pop_back();
     return inst_addr;
   }
 
@@ -143,11 +199,20 @@ class TraceLifter::Impl {
   Instruction inst;
   Instruction delayed_inst;
   DecoderWorkList trace_work_list;
-  DecoderWorkList inst_work_list;
-  std::map<uint64_t, llvm::BasicBlock *> blocks;
+  InstructionWorkList inst_work_list;
+  llvm::DenseMap<uint64_t, llvm::BasicBlock *> blocks;
+
+  // Number of instructions lifted so far, including delayed ones.
+  uint64_t num_lifted_insts{0};
+
+  LiftStats *const stats;
+
+  // Stats of the trace being lifted, if we collect stats.
+  TraceStats *trace_stats{nullptr};
 };
 
-TraceLifter::Impl::Impl(InstructionLifter *inst_lifter_, TraceManager *manager_)
+TraceLifter::Impl::Impl(InstructionLifter *inst_lifter_, TraceManager *manager_,
+                        LiftStats *stats_)
     : arch(inst_lifter_->impl->arch),
       inst_lifter(*inst_lifter_),
       intrinsics(inst_lifter.impl->intrinsics),
@@ -159,7 +224,8 @@ TraceLifter::Impl::Impl(InstructionLifter *inst_lifter_, TraceManager *manager_)
       func(nullptr),
       block(nullptr),
       switch_inst(nullptr),
-      max_inst_bytes(arch->MaxInstructionSize()) {
+      max_inst_bytes(arch->MaxInstructionSize()),
+      stats(stats_) {
 
   inst_bytes.reserve(max_inst_bytes);
 }
@@ -206,30 +272,77 @@ llvm::Function *TraceLifter::Impl::GetLiftedTraceDefinition(uint64_t addr) {
 TraceLifter::~TraceLifter(void) {}
 
 TraceLifter::TraceLifter(InstructionLifter *inst_lifter_,
-                         TraceManager *manager_)
-    : impl(new Impl(inst_lifter_, manager_)) {}
+                         TraceManager *manager_, LiftStats *stats_)
+    : impl(new Impl(inst_lifter_, manager_, stats_)) {}
 
 void TraceLifter::NullCallback(uint64_t, llvm::Function *) {}
 
+// Number of instructions lifted by this lifter so far.
+uint64_t TraceLifter::NumLiftedInstructions(void) const {
+  return impl->num_lifted_insts;
+}
+
 // Reads the bytes of an instruction at `addr` into `inst_bytes`.
 bool TraceLifter::Impl::ReadInstructionBytes(uint64_t addr) {
-  inst_bytes.clear();
-  for (size_t i = 0; i < max_inst_bytes; ++i) {
-    const auto byte_addr = (addr + i) & addr_mask;
-    if (byte_addr < addr) {
-      break;  // 32- or 64-bit address overflow.
-    }
-    uint8_t byte = 0;
-    if (!manager.TryReadExecutableByte(byte_addr, &byte)) {
-      DLOG(WARNING) << "Couldn't read executable byte at " << std::hex
-                    << byte_addr << std::dec;
-      break;
-    }
-    inst_bytes.push_back(static_cast<char>(byte));
+
+  // Don't read past the end of the address space.
+  size_t num_bytes = max_inst_bytes;
+  if (addr > addr_mask) {
+    num_bytes = 0;
+  } else if ((addr_mask - addr) < num_bytes) {
+    num_bytes = static_cast<size_t>(addr_mask - addr) + 1u;
+  }
+
+  inst_bytes.resize(num_bytes);
+  const auto num_read = manager.TryReadExecutableBytes(
+      addr, reinterpret_cast<uint8_t *>(inst_bytes.data()), num_bytes);
+  if (num_read < num_bytes) {
+    DLOG(WARNING) << "Couldn't read executable byte at " << std::hex
+                  << (addr + num_read) << std::dec;
   }
+  inst_bytes.resize(num_read);
   return !inst_bytes.empty();
 }
 
+// Reads and decodes the instruction at `addr` into `inst`.
+bool TraceLifter::Impl::DecodeInstruction(uint64_t addr) {
+  const auto start = trace_stats ? Clock::now() : Clock::time_point();
+  if (!ReadInstructionBytes(addr)) {
+    return false;
+  }
+
+  inst.Reset();
+
+  (void) arch->DecodeInstruction(addr, inst_bytes, inst);
+
+  if (trace_stats) {
+    trace_stats->num_decoded += 1;
+    trace_stats->decode_ns += NanosecondsSince(start);
+  }
+  return true;
+}
+
+// Lifts `inst_` into `into_block`, and counts it.
+LiftStatus TraceLifter::Impl::LiftIntoBlock(Instruction &inst_,
+                                            llvm::BasicBlock *into_block,
+                                            llvm::Value *state_ptr,
+                                            bool is_delayed) {
+  const auto start = trace_stats ? Clock::now() : Clock::time_point();
+  const auto status =
+      inst_lifter.LiftIntoBlock(inst_, into_block, state_ptr, is_delayed);
+  ++num_lifted_insts;
+
+  if (trace_stats) {
+    trace_stats->lift_ns += NanosecondsSince(start);
+    if (kLiftedInstruction == status) {
+      trace_stats->num_lifted += 1;
+    } else {
+      trace_stats->num_unsupported += 1;
+    }
+  }
+  return status;
+}
+
 // Lift one or more traces starting from `addr`.
 bool TraceLifter::Lift(
     uint64_t addr, std::function<void(uint64_t, llvm::Function *)> callback) {
@@ -254,6 +367,7 @@ bool TraceLifter::Impl::Lift(
   func = nullptr;
   switch_inst = nullptr;
   block = nullptr;
+  trace_stats = nullptr;
   inst.Reset();
   delayed_inst.Reset();
 
@@ -295,12 +409,19 @@ bool TraceLifter::Impl::Lift(
 
     CHECK(func->isDeclaration());
 
+    if (stats) {
+      trace_stats = &(stats->Trace(func->getName()));
+      trace_stats->addr = trace_addr;
+    }
+
     // Fill in the function, and make sure the block with all register
     // variables jumps to the block that will contain the first instruction
     // of the trace.
     CloneBlockFunctionInto(func);
     auto state_ptr = NthArgument(func, kStatePointerArgNum);
 
+    CHECK(inst_work_list.empty());
+
     if (auto entry_block = &(func->front())) {
       auto pc = LoadProgramCounterArg(func);
       auto next_pc_ref = inst_lifter.LoadRegAddress(entry_block, state_ptr,
@@ -309,12 +430,33 @@ bool TraceLifter::Impl::Lift(
       // Initialize `NEXT_PC`.
       (void) new llvm::StoreInst(pc, next_pc_ref, entry_block);
 
-      // Branch to the first basic block.
-      llvm::BranchInst::Create(GetOrCreateBlock(trace_addr), entry_block);
+      // Branch to the first basic block, or to the block of the secondary
+      // entry that the PC is at.
+      auto head_block = GetOrCreateBlock(trace_addr);
+      llvm::SwitchInst *entry_switch = nullptr;
+      manager.ForEachSecondaryEntry(trace_addr, [&](uint64_t entry_addr) {
+        entry_addr &= addr_mask;
+        if (entry_addr == trace_addr) {
+          return;
+        }
+        if (!entry_switch) {
+          entry_switch =
+              llvm::SwitchInst::Create(pc, head_block, 0, entry_block);
+        }
+        auto entry_pc = llvm::ConstantInt::get(
+            llvm::cast<llvm::IntegerType>(pc->getType()), entry_addr);
+        if (entry_switch->findCaseValue(entry_pc) ==
+            entry_switch->case_default()) {
+          entry_switch->addCase(entry_pc, GetOrCreateBlock(entry_addr));
+          PushInstructionAddress(entry_addr);
+        }
+      });
+      if (!entry_switch) {
+        llvm::BranchInst::Create(head_block, entry_block);
+      }
     }
 
-    CHECK(inst_work_list.empty());
-    inst_work_list.insert(trace_addr);
+    PushInstructionAddress(trace_addr);
 
     // Decode instructions.
     while (!inst_work_list.empty()) {
@@ -339,16 +481,12 @@ bool TraceLifter::Impl::Lift(
       }
 
       // No executable bytes here.
-      if (!ReadInstructionBytes(inst_addr)) {
+      if (!DecodeInstruction(inst_addr)) {
         AddTerminatingTailCall(block, intrinsics->missing_block);
         continue;
       }
 
-      inst.Reset();
-
-      (void) arch->DecodeInstruction(inst_addr, inst_bytes, inst);
-
-      auto lift_status = inst_lifter.LiftIntoBlock(inst, block, state_ptr);
+      auto lift_status = LiftIntoBlock(inst, block, state_ptr, false);
       if (kLiftedInstruction != lift_status) {
         AddTerminatingTailCall(block, intrinsics->error);
         continue;
@@ -378,8 +516,8 @@ bool TraceLifter::Impl::Lift(
                                             on_branch_taken_path)) {
           return;
         }
-        lift_status = inst_lifter.LiftIntoBlock(
-            delayed_inst, into_block, state_ptr, true /* is_delayed */);
+        lift_status = LiftIntoBlock(delayed_inst, into_block, state_ptr,
+                                    true /* is_delayed */);
         if (kLiftedInstruction != lift_status) {
           AddTerminatingTailCall(block, intrinsics->error);
         }
@@ -408,9 +546,46 @@ bool TraceLifter::Impl::Lift(
           llvm::BranchInst::Create(GetOrCreateBranchTakenBlock(), block);
           break;
 
+        // Jumps with targets known to the trace manager, e.g. through jump
+        // tables, switch on `NEXT_PC`. Anything else goes to the dispatcher.
         case Instruction::kCategoryIndirectJump: {
           try_add_delay_slot(true, block);
-          AddTerminatingTailCall(block, intrinsics->jump);
+
+          llvm::SwitchInst *target_switch = nullptr;
+          manager.ForEachDevirtualizedTarget(
+              inst, [&](uint64_t target_pc, DevirtualizedTargetKind kind) {
+                target_pc &= addr_mask;
+                if (!target_switch) {
+                  auto fallback = llvm::BasicBlock::Create(context, "", func);
+                  AddTerminatingTailCall(fallback, intrinsics->jump);
+                  target_switch = llvm::SwitchInst::Create(
+                      LoadNextProgramCounter(block), fallback, 0, block);
+                }
+
+                auto target_case = llvm::ConstantInt::get(
+                    inst_lifter.impl->word_type, target_pc);
+                if (target_switch->findCaseValue(target_case) !=
+                    target_switch->case_default()) {
+                  return;
+                }
+
+                if (kind == DevirtualizedTargetKind::kTraceLocal) {
+                  PushInstructionAddress(target_pc);
+                  target_switch->addCase(target_case,
+                                         GetOrCreateBlock(target_pc));
+                } else {
+                  trace_work_list.insert(target_pc);
+                  auto target_block =
+                      llvm::BasicBlock::Create(context, "", func);
+                  AddTerminatingTailCall(target_block,
+                                         get_trace_decl(target_pc));
+                  target_switch->addCase(target_case, target_block);
+                }
+              });
+
+          if (!target_switch) {
+            AddTerminatingTailCall(block, intrinsics->jump);
+          }
           break;
         }
 
@@ -523,7 +698,9 @@ bool TraceLifter::Impl::Lift(
           trace_work_list.insert(inst.branch_taken_pc);
           auto target_trace = get_trace_decl(inst.branch_taken_pc);
 
-          AddCall(taken_block, intrinsics->function_call);
+          if (manager.MarkConditionalDirectCalls()) {
+            AddCall(taken_block, intrinsics->function_call);
+          }
           AddCall(taken_block, target_trace);
 
           const auto ret_pc_ref = LoadReturnProgramCounterRef(taken_block);
@@ -660,6 +837,10 @@ bool TraceLifter::Impl::Lift(
       }
     }
 
+    if (trace_stats) {
+      trace_stats->num_ir_insts = func->getInstructionCount();
+    }
+
     callback(trace_addr, func);
     manager.SetLiftedTraceDefinition(trace_addr, func);
   }
@@ -17,12 +17,14 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <chrono>
 #include <exception>
 #include <sstream>
 #include <fstream>
 #include <string_view>
 #include <system_error>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -37,12 +39,14 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/raw_ostream.h>
 
@@ -331,19 +335,143 @@ llvm::GlobalVariable *FindGlobaVariable(llvm::Module *module,
 
 // Loads the semantics for the `arch`-specific machine, i.e. the machine of the
 // code that we want to lift.
-std::unique_ptr<llvm::Module> LoadArchSemantics(const Arch *arch) {
+std::unique_ptr<llvm::Module> LoadArchSemantics(const Arch *arch,
+                                                SemanticsLoadGuide guide) {
+  const auto start = std::chrono::steady_clock::now();
   auto arch_name = GetArchName(arch->arch_name);
-  auto data = FindSemanticsBitcode(arch_name);
+  auto buffer = FindSemanticsBitcodeBuffer(arch_name);
+
+  std::unique_ptr<llvm::Module> module;
+  if (guide.lazy && llvm::isBitcode(
+                        reinterpret_cast<const uint8_t *>(buffer->getBufferStart()),
+                        reinterpret_cast<const uint8_t *>(buffer->getBufferEnd()))) {
+
+    // The module takes ownership of the buffer, as function bodies are read
+    // out of it on demand.
+    auto module_or_err =
+        llvm::getOwningLazyBitcodeModule(std::move(buffer), *arch->context);
+    if (!module_or_err) {
+      LOG(FATAL) << "Unable to parse semantics for " << arch_name << ": "
+                 << llvm::toString(module_or_err.takeError());
+    }
+    module = std::move(*module_or_err);
+
+    // Needed right away to set up the `State` structure and registers.
+    if (auto bb_func = module->getFunction("__remill_basic_block");
+        bb_func && bb_func->isMaterializable()) {
+      if (auto err = bb_func->materialize()) {
+        LOG(FATAL) << "Unable to materialize __remill_basic_block: "
+                   << llvm::toString(std::move(err));
+      }
+    }
+
+  } else {
+    module = LoadModuleFromMemory(
+        arch->context,
+        std::string_view(buffer->getBufferStart(), buffer->getBufferSize()),
+        false, guide.verify);
+  }
 
-  auto module = LoadModuleFromMemory(arch->context, data);
   arch->PrepareModule(module);
   arch->InitFromSemanticsModule(module.get());
   for (auto &func : *module) {
     Annotate<remill::Semantics>(&func);
   }
+
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  LOG(INFO) << "Loaded " << (guide.lazy ? "lazy " : "") << "semantics for "
+            << arch_name << " in " << (elapsed.count() * 1000.0) << " ms";
   return module;
 }
 
+void MaterializeUsedFunctions(llvm::Module *module, bool verify) {
+  if (!module->getMaterializer()) {
+    return;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<llvm::Constant *> work_list;
+  std::unordered_set<llvm::Constant *> seen;
+
+  auto reach = [&](llvm::Value *val) {
+    if (auto const_val = llvm::dyn_cast<llvm::Constant>(val);
+        const_val && seen.insert(const_val).second) {
+      work_list.push_back(const_val);
+    }
+  };
+
+  for (auto &func : *module) {
+    if (!func.isDeclaration() && !func.isMaterializable()) {
+      reach(&func);
+    }
+  }
+
+  unsigned num_materialized = 0;
+  while (!work_list.empty()) {
+    auto const_val = work_list.back();
+    work_list.pop_back();
+
+    if (auto func = llvm::dyn_cast<llvm::Function>(const_val)) {
+      if (func->isMaterializable()) {
+        if (auto err = func->materialize()) {
+          LOG(FATAL) << "Unable to materialize " << func->getName().str()
+                     << ": " << llvm::toString(std::move(err));
+        }
+        ++num_materialized;
+
+        std::string error;
+        llvm::raw_string_ostream error_stream(error);
+        if (verify && llvm::verifyFunction(*func, &error_stream)) {
+          error_stream.flush();
+          LOG(FATAL) << "Error verifying semantics function "
+                     << func->getName().str() << ": " << error;
+        }
+      }
+      for (auto &inst : llvm::instructions(func)) {
+        for (auto &op : inst.operands()) {
+          reach(op.get());
+        }
+      }
+
+    } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(const_val)) {
+      if (var->hasInitializer()) {
+        reach(var->getInitializer());
+      }
+
+    } else if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(const_val)) {
+      reach(alias->getAliasee());
+
+    } else {
+      for (auto &op : const_val->operands()) {
+        reach(op.get());
+      }
+    }
+  }
+
+  // Nothing can call the rest, so there is no point in reading them in.
+  unsigned num_dropped = 0;
+  for (auto &func : *module) {
+    if (func.isMaterializable()) {
+      func.deleteBody();
+      ++num_dropped;
+    }
+  }
+
+  // Finishes up module-level loading (e.g. auto-upgrades), and drops the
+  // bitcode reader.
+  if (auto err = module->materializeAll()) {
+    LOG(FATAL) << "Unable to finish materializing module: "
+               << llvm::toString(std::move(err));
+  }
+
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  LOG(INFO) << "Materialized " << num_materialized << " semantics functions ("
+            << num_dropped << " unused) in " << (elapsed.count() * 1000.0)
+            << " ms";
+}
+
 // Try to verify a module.
 bool VerifyModule(llvm::Module *module) {
   std::string error;
@@ -391,7 +519,8 @@ std::unique_ptr<llvm::Module> LoadModuleFromFile(llvm::LLVMContext *context,
 // Reads an LLVM module from a file.
 std::unique_ptr<llvm::Module> LoadModuleFromMemory(llvm::LLVMContext *context,
                                                  std::string_view module_data,
-                                                 bool allow_failure) {
+                                                 bool allow_failure,
+                                                 bool verify) {
   llvm::SMDiagnostic err;
   llvm::StringRef data_string(module_data.data(), module_data.size());
   llvm::MemoryBufferRef data(data_string, "module_data");
@@ -412,7 +541,7 @@ std::unique_ptr<llvm::Module> LoadModuleFromMemory(llvm::LLVMContext *context,
     return {};
   }
 
-  if (!VerifyModule(module.get())) {
+  if (verify && !VerifyModule(module.get())) {
     LOG_IF(FATAL, !allow_failure)
         << "Error verifying module read from memory";
     return {};
@@ -498,8 +627,9 @@ bool StoreModuleIRToFile(llvm::Module *module, std::string_view file_name_,
 }
 
 
-// Find the path to the semantics bitcode file.
-std::string FindSemanticsBitcode(std::string_view arch) {
+// Find the semantics bitcode for `arch`, without copying it.
+std::unique_ptr<llvm::MemoryBuffer>
+FindSemanticsBitcodeBuffer(std::string_view arch) {
   if (!FLAGS_semantics_search_paths.empty()) {
     std::stringstream pp;
     pp << FLAGS_semantics_search_paths;
@@ -510,11 +640,13 @@ std::string FindSemanticsBitcode(std::string_view arch) {
 
         LOG(INFO) << "Found semantics for " << arch << " at " << sem_path;
 
-        std::ifstream t(sem_path);
-        std::stringstream buffer;
-        buffer << t.rdbuf();
-
-        return buffer.str();
+        // Large files are mapped rather than read.
+        auto buffer_or_err = llvm::MemoryBuffer::getFile(sem_path);
+        if (!buffer_or_err) {
+          LOG(FATAL) << "Unable to read semantics file " << sem_path << ": "
+                     << buffer_or_err.getError().message();
+        }
+        return std::move(*buffer_or_err);
       }
     }
   }
@@ -523,9 +655,15 @@ std::string FindSemanticsBitcode(std::string_view arch) {
   auto arch_sem_filename = std::string(arch) + ".bc";
   while (sm->name != nullptr) {
     if (arch_sem_filename == sm->name) {
-      // This creates unnecessary copy.. Duh
       LOG(INFO) << "Found semantics for  " << arch << " in the embedded files";
-      return std::string(sm->data, sm->data + sm->size);
+      llvm::StringRef data(reinterpret_cast<const char *>(sm->data), sm->size);
+
+      // The bitcode reader wants word-aligned input; only copy if the embedded
+      // data isn't.
+      if (reinterpret_cast<uintptr_t>(sm->data) % 4u) {
+        return llvm::MemoryBuffer::getMemBufferCopy(data, arch_sem_filename);
+      }
+      return llvm::MemoryBuffer::getMemBuffer(data, arch_sem_filename, false);
     }
     sm++;
   }
@@ -534,6 +672,11 @@ std::string FindSemanticsBitcode(std::string_view arch) {
   std::terminate();
 }
 
+// Find the path to the semantics bitcode file.
+std::string FindSemanticsBitcode(std::string_view arch) {
+  return FindSemanticsBitcodeBuffer(arch)->getBuffer().str();
+}
+
 namespace {
 
 // Convert an LLVM thing (e.g. `llvm::Value` or `llvm::Type`) into
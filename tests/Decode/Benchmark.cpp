@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how many instructions per second `Arch::DecodeInstructions` gets
+// through in a linear sweep, for each architecture in `--archs`. The code is
+// read from `--code_filename`, or is `--num_bytes` of random bytes.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+
+DEFINE_string(archs, "x86,amd64,aarch64",
+              "Comma-separated list of architectures to decode with.");
+DEFINE_string(code_filename, "",
+              "File with the code to decode. Random bytes are used if empty.");
+DEFINE_uint64(num_bytes, 16 << 20, "Number of random bytes to decode.");
+DEFINE_uint64(seed, 42, "Seed for the random bytes.");
+DEFINE_uint32(batch_size, 64,
+              "Number of instructions decoded per `DecodeInstructions` call.");
+DEFINE_uint32(repetitions, 3, "Number of sweeps over the code per arch.");
+
+namespace {
+
+static std::string LoadCode(void) {
+  if (!FLAGS_code_filename.empty()) {
+    auto buffer = llvm::MemoryBuffer::getFile(FLAGS_code_filename);
+    CHECK(buffer) << "Unable to read " << FLAGS_code_filename << ": "
+                  << buffer.getError().message();
+    return (*buffer)->getBuffer().str();
+  }
+
+  std::mt19937_64 rng(FLAGS_seed);
+  std::string code(FLAGS_num_bytes, '\0');
+  for (auto &byte : code) {
+    byte = static_cast<char>(rng());
+  }
+  return code;
+}
+
+// Sweeps over `code` once, skipping over undecodable bytes. Returns the number
+// of decoded instructions.
+static uint64_t Sweep(const remill::Arch *arch, std::string_view code,
+                      std::vector<remill::Instruction> &insts) {
+  const auto skip = std::max<uint64_t>(1u, arch->MinInstructionAlign());
+  uint64_t num_decoded = 0;
+  uint64_t offset = 0;
+  while (offset < code.size()) {
+    const auto num_insts = arch->DecodeInstructions(
+        offset, code.substr(offset), insts.data(), insts.size());
+    for (size_t i = 0; i < num_insts; ++i) {
+      offset += insts[i].bytes.size();
+    }
+    if (num_insts < insts.size()) {
+      offset += skip;
+    }
+    num_decoded += num_insts;
+  }
+  return num_decoded;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  const auto code = LoadCode();
+  std::cout << code.size() << " bytes of code" << std::endl;
+
+  std::stringstream archs(FLAGS_archs);
+  for (std::string arch_name; std::getline(archs, arch_name, ',');) {
+    llvm::LLVMContext context;
+    auto arch = remill::Arch::Build(&context, remill::GetOSName(REMILL_OS),
+                                    remill::GetArchName(arch_name));
+    CHECK(arch) << "Unsupported architecture " << arch_name;
+
+    // Decoding looks up registers, which are only known once the semantics
+    // are loaded.
+    remill::SemanticsLoadGuide guide;
+    guide.lazy = true;
+    guide.verify = false;
+    auto module = remill::LoadArchSemantics(arch.get(), guide);
+
+    std::vector<remill::Instruction> insts(std::max(1u, FLAGS_batch_size));
+    uint64_t num_decoded = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < FLAGS_repetitions; ++i) {
+      num_decoded += Sweep(arch.get(), code, insts);
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << arch_name << ": " << num_decoded << " instructions in "
+              << elapsed.count() << " s, "
+              << (num_decoded / elapsed.count()) / 1e6 << " M instructions/s"
+              << std::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
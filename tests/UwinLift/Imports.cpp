@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <stdexcept>
+
+#include "Imports.h"
+
+namespace {
+
+std::string WriteSignatures(const std::string &name, const std::string &data) {
+  const auto path = testing::TempDir() + name;
+  std::ofstream(path, std::ios_base::out | std::ios_base::trunc) << data;
+  return path;
+}
+
+}  // namespace
+
+TEST(ImportTable, LoadsSignatures) {
+  ImportTable imports;
+  imports.Load(WriteSignatures("imports.txt",
+                               "16 strlen cdecl i32 ptr\n"
+                               "\n"
+                               "32 qsort cdecl void ptr i32 i32 ptr callback\n"));
+
+  auto strlen_sig = imports.Find(16);
+  ASSERT_NE(strlen_sig, nullptr);
+  EXPECT_EQ(strlen_sig->name, "strlen");
+  EXPECT_EQ(strlen_sig->convention, ImportConvention::kCdecl);
+  EXPECT_EQ(strlen_sig->return_type, ImportType::kI32);
+  EXPECT_EQ(strlen_sig->arg_types.size(), 1u);
+  EXPECT_FALSE(strlen_sig->calls_back);
+
+  auto qsort_sig = imports.Find(32);
+  ASSERT_NE(qsort_sig, nullptr);
+  EXPECT_EQ(qsort_sig->arg_types.size(), 4u);
+  EXPECT_TRUE(qsort_sig->calls_back);
+}
+
+TEST(ImportTable, ReportsTheLineOfAMalformedSignature) {
+  ImportTable imports;
+  const auto path = WriteSignatures("malformed_imports.txt",
+                                    "16 strlen cdecl i32 ptr\n"
+                                    "\n"
+                                    "strlen cdecl i32 ptr\n");
+  try {
+    imports.Load(path);
+    FAIL() << "Loaded a malformed signature";
+  } catch (const std::runtime_error &e) {
+    EXPECT_NE(std::string(e.what()).find(path + ":3:"), std::string::npos)
+        << e.what();
+  }
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "NameMap.h"
+
+namespace {
+
+std::string FindName(const NameMap &name_map, uint64_t addr) {
+  auto name = name_map.Find(addr);
+  return name ? *name : "";
+}
+
+}  // namespace
+
+TEST(NameMap, FindsContainingRange) {
+  NameMap name_map;
+  name_map.Add(0x2000, 0x2010, "second");
+  name_map.Add(0x1000, 0x1010, "first");
+
+  EXPECT_EQ(FindName(name_map, 0x1000), "first");
+  EXPECT_EQ(FindName(name_map, 0x100f), "first");
+  EXPECT_EQ(FindName(name_map, 0x1010), "");
+  EXPECT_EQ(FindName(name_map, 0x2008), "second");
+  EXPECT_EQ(FindName(name_map, 0xfff), "");
+
+  EXPECT_EQ(name_map.TraceName(0x1004), "lifted_first_1004_func");
+  EXPECT_EQ(name_map.TraceName(0x3000), "lifted_3000_func");
+}
+
+// An inner symbol, e.g. a label inside of a function, must not hide the
+// function that was added before it, neither inside of it nor after it.
+TEST(NameMap, NestedRangesKeepTheFirstAdded) {
+  NameMap name_map;
+  name_map.Add(0x1000, 0x1100, "outer");
+  name_map.Add(0x1010, 0x1020, "inner");
+  name_map.Add(0x1080, 0x1200, "overlapping");
+
+  EXPECT_EQ(FindName(name_map, 0x1000), "outer");
+  EXPECT_EQ(FindName(name_map, 0x1010), "outer");
+  EXPECT_EQ(FindName(name_map, 0x1030), "outer");
+  EXPECT_EQ(FindName(name_map, 0x1090), "outer");
+  EXPECT_EQ(FindName(name_map, 0x1100), "overlapping");
+  EXPECT_EQ(FindName(name_map, 0x1200), "");
+}
+
+// Ranges that are only covered by a later one still get its name.
+TEST(NameMap, LaterRangesNameWhatEarlierOnesDontCover) {
+  NameMap name_map;
+  name_map.Add(0x1010, 0x1020, "inner");
+  name_map.Add(0x1000, 0x1100, "outer");
+  name_map.Add(0x1000, 0x1008, "same_start");
+
+  EXPECT_EQ(FindName(name_map, 0x1000), "outer");
+  EXPECT_EQ(FindName(name_map, 0x1010), "inner");
+  EXPECT_EQ(FindName(name_map, 0x1020), "outer");
+}
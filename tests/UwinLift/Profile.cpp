@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include "Profile.h"
+
+namespace {
+
+std::string WriteProfile(const std::string &name, const std::string &data) {
+  const auto path = testing::TempDir() + name;
+  std::ofstream(path, std::ios_base::out | std::ios_base::trunc) << data;
+  return path;
+}
+
+}  // namespace
+
+TEST(Profile, SumsTheCountsOfEveryRun) {
+  Profile profile;
+  profile.Load(WriteProfile("runs.profile",
+                            "trace:a 1\ntrace:b 2\ntrace:a 3\n"));
+
+  ASSERT_NE(profile.Find("trace:a"), nullptr);
+  EXPECT_EQ(*profile.Find("trace:a"), 4u);
+  ASSERT_NE(profile.Find("trace:b"), nullptr);
+  EXPECT_EQ(*profile.Find("trace:b"), 2u);
+  EXPECT_EQ(profile.Find("trace:c"), nullptr);
+}
+
+// A file that was edited by hand, or cut short, may not end in a newline.
+TEST(Profile, LoadsTheLastLineWithoutANewline) {
+  Profile profile;
+  profile.Load(WriteProfile("no_newline.profile", "trace:a 1\ntrace:b 2"));
+
+  ASSERT_NE(profile.Find("trace:b"), nullptr);
+  EXPECT_EQ(*profile.Find("trace:b"), 2u);
+}
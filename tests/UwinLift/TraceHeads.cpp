@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/CFGDiscoverer.h>
+#include <remill/OS/OS.h>
+
+#include <string>
+
+#include "TraceHeads.h"
+
+namespace {
+
+// Two functions, where `first` tail-jumps into `second`, which is also called
+// from elsewhere:
+//
+//    first:    1000: jmp second
+//    second:   1010: test eax, eax
+//              1012: jz 1020
+//              1014: ret
+//              1020: ret
+const uint64_t kFirst = 0x1000;
+const uint64_t kSecond = 0x1010;
+
+std::string TailJumpCode(void) {
+  std::string code(0x21, '\xcc');
+  code.replace(0x00, 5, "\xe9\x0b\x00\x00\x00", 5);
+  code.replace(0x10, 5, "\x85\xc0\x74\x0c\xc3", 5);
+  code[0x20] = '\xc3';
+  return code;
+}
+
+remill::DiscoveredCFG DiscoverTailJump(const std::string &code) {
+  llvm::LLVMContext context;
+  auto arch = remill::Arch::Build(&context, remill::OSName::kOSWindows,
+                                  remill::ArchName::kArchX86);
+  remill::CFGDiscoverer discoverer(arch.get());
+  discoverer.AddRegion(kFirst, code, true);
+  discoverer.AddFunctionEntry(kFirst);
+  discoverer.AddFunctionEntry(kSecond);
+  return discoverer.Discover(1);
+}
+
+}  // namespace
+
+TEST(TraceHeads, TailJumpStopsAtTheOtherFunction) {
+  const auto code = TailJumpCode();
+  const auto cfg = DiscoverTailJump(code);
+
+  ASSERT_EQ(cfg.functions.count(kFirst), 1u);
+  ASSERT_EQ(cfg.functions.count(kSecond), 1u);
+  EXPECT_EQ(cfg.functions.at(kFirst).blocks, std::vector<uint64_t>({kFirst}));
+  EXPECT_EQ(cfg.functions.at(kFirst).tail_calls,
+            std::vector<uint64_t>({kSecond}));
+  EXPECT_EQ(cfg.functions.at(kSecond).blocks,
+            std::vector<uint64_t>({kSecond, 0x1014, 0x1020}));
+  EXPECT_TRUE(cfg.functions.at(kSecond).tail_calls.empty());
+}
+
+TEST(TraceHeads, TailJumpedFunctionKeepsItsBlocks) {
+  const auto code = TailJumpCode();
+  const auto cfg = DiscoverTailJump(code);
+
+  SecondaryEntries secondary_entries;
+  const auto heads =
+      FunctionTraceHeads(cfg, cfg.TraceHeads(), secondary_entries);
+
+  EXPECT_EQ(heads, std::vector<uint64_t>({kFirst, kSecond}));
+  ASSERT_EQ(secondary_entries.size(), 1u);
+  EXPECT_EQ(secondary_entries[kSecond], std::vector<uint64_t>({0x1014, 0x1020}));
+}
+
+// Even if a function's blocks include another function's entry, the entry
+// heads its own trace.
+TEST(TraceHeads, EntriesAreNeverSecondary) {
+  remill::DiscoveredCFG cfg;
+  cfg.functions[0x1000].entry = 0x1000;
+  cfg.functions[0x1000].blocks = {0x1000, 0x1010, 0x1020};
+  cfg.functions[0x1010].entry = 0x1010;
+  cfg.functions[0x1010].blocks = {0x1010, 0x1020};
+
+  SecondaryEntries secondary_entries;
+  const auto heads = FunctionTraceHeads(cfg, {0x1000, 0x1010, 0x1020, 0x1030},
+                                        secondary_entries);
+
+  EXPECT_EQ(heads, std::vector<uint64_t>({0x1000, 0x1010, 0x1030}));
+  ASSERT_EQ(secondary_entries.size(), 1u);
+  EXPECT_EQ(secondary_entries[0x1000], std::vector<uint64_t>({0x1020}));
+}
@@ -37,6 +37,7 @@
 
 #include "remill/Arch/Runtime/Float.h"
 #include "remill/Arch/Runtime/Runtime.h"
+#include "remill/Arch/X86/Runtime/LazyFlags.h"
 #include "remill/Arch/X86/Runtime/State.h"
 #include "tests/X86/Test.h"
 
@@ -315,16 +316,27 @@ Memory *__remill_delay_slot_end(Memory *) {
 }
 void __remill_defer_inlining(void) {}
 
-Memory *__remill_error(State &, addr_t, Memory *) {
+// Like any runtime, materialize the lazily computed flags before looking at
+// the state, so that the comparison with the native state sees them.
+#ifdef REMILL_X86_LAZY_FLAGS
+# define MATERIALIZE_FLAGS(st) MaterializeLazyFlags(st)
+#else
+# define MATERIALIZE_FLAGS(st)
+#endif
+
+Memory *__remill_error(State &state, addr_t, Memory *) {
+  MATERIALIZE_FLAGS(state);
   siglongjmp(gJmpBuf, 0);
 }
 
-Memory *__remill_missing_block(State &, addr_t, Memory *memory) {
+Memory *__remill_missing_block(State &state, addr_t, Memory *memory) {
+  MATERIALIZE_FLAGS(state);
   return memory;
 }
 
 Memory *__remill_sync_hyper_call(State &state, Memory *mem,
                                  SyncHyperCall::Name call) {
+  MATERIALIZE_FLAGS(state);
   switch (call) {
     case SyncHyperCall::kX86CPUID:
       asm volatile("cpuid"
@@ -382,12 +394,15 @@ Memory *__remill_function_call(State &, addr_t, Memory *) {
   abort();
 }
 
-Memory *__remill_function_return(State &, addr_t, Memory *) {
-  abort();
+// Tests only return or jump indirectly to their own end, see `LAZYADDjmp`.
+Memory *__remill_function_return(State &state, addr_t, Memory *memory) {
+  MATERIALIZE_FLAGS(state);
+  return memory;
 }
 
-Memory *__remill_jump(State &, addr_t, Memory *) {
-  abort();
+Memory *__remill_jump(State &state, addr_t, Memory *memory) {
+  MATERIALIZE_FLAGS(state);
+  return memory;
 }
 
 Memory *__remill_async_hyper_call(State &, addr_t, Memory *) {
@@ -708,6 +723,16 @@ static void RunWithFlags(const test::TestInfo *info, Flags flags,
   native_state->gpr.rip.aword = 0;
 #endif
 
+#ifdef REMILL_X86_LAZY_FLAGS
+
+  // The lifted code must not leave an operation recorded when it gives the
+  // state back to the runtime.
+  EXPECT_EQ(kLazyFlagsNone, lifted_state->lazy_flags.op)
+      << "Lifted code returned with unmaterialized lazy flags";
+  memset(&(lifted_state->lazy_flags), 0, sizeof(lifted_state->lazy_flags));
+  memset(&(native_state->lazy_flags), 0, sizeof(native_state->lazy_flags));
+#endif
+
   // Copy the aflags state back into the rflags state.
   lifted_state->rflag.cf = lifted_state->aflag.cf;
   lifted_state->rflag.pf = lifted_state->aflag.pf;